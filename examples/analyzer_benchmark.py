@@ -0,0 +1,47 @@
+"""
+Compares the ICU tokenization pipeline against its ASCII fast path.
+
+Each line of the input file is treated as a document. Both pipelines are
+run over every document and the time taken by each is reported. See
+icu_differential_check.py for checking that their tokens agree.
+"""
+
+import sys
+import time
+
+import metapy
+
+def icu_pipeline():
+    tok = metapy.analyzers.ICUTokenizer()
+    return metapy.analyzers.LowercaseFilter(tok)
+
+def fast_pipeline():
+    tok = metapy.analyzers.FastICUTokenizer()
+    return metapy.analyzers.FastLowercaseFilter(tok)
+
+def run(pipeline, docs):
+    tokens = []
+    start_time = time.time()
+    for doc in docs:
+        pipeline.set_content(doc)
+        tokens.append([t for t in pipeline])
+    return tokens, time.time() - start_time
+
+if __name__ == '__main__':
+
+    if len(sys.argv) != 2:
+        print("Usage: {} documents.txt".format(sys.argv[0]))
+        sys.exit(1)
+
+    with open(sys.argv[1]) as doc_file:
+        docs = [line for line in doc_file]
+
+    icu_tokens, icu_time = run(icu_pipeline(), docs)
+    _, fast_time = run(fast_pipeline(), docs)
+
+    num_tokens = sum(len(toks) for toks in icu_tokens)
+
+    print("Documents: {}, tokens: {}".format(len(docs), num_tokens))
+    print("ICU:       {} seconds".format(round(icu_time, 4)))
+    print("Fast path: {} seconds".format(round(fast_time, 4)))
+    print("Speedup:   {}x".format(round(icu_time / max(fast_time, 1e-9), 2)))
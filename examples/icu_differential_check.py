@@ -0,0 +1,85 @@
+"""
+Checks that FastICUTokenizer produces exactly the tokens of ICUTokenizer.
+
+Both tokenizers are run (with and without sentence tags) over a set of
+hand-written cases that exercise the punctuation handled by the ASCII fast
+path, over randomly generated ASCII strings, and over each line of an
+optional input file. Every document whose tokens differ is printed, and
+the exit status is nonzero if there were any.
+"""
+
+import random
+import sys
+
+import metapy
+
+CASES = [
+    "a:b",
+    "a:b:c d:e",
+    "Note: see below.",
+    "12:30 and 3:4",
+    "a.b a.B A.b e.g. U.S.A.",
+    "don't can't 'quoted' o'clock",
+    "3.14 1,000,000 1;2 3'4 5.6.7",
+    "x_y _a a_ 1_2 __",
+    "Hello. World",
+    "Hello. world",
+    "Hi!  There? yes.",
+    "He said \"stop.\" Then left.",
+    "(a.) b",
+    "end. 1.5 more",
+    "a. b: c; d, e - f",
+    "a.\tb\x0bc\x0cd",
+    "line one\nline two\r\nline three\rfour",
+    "trailing. ",
+    "x.\"Y",
+    "a.b.",
+    "a..b a''b 1..2 1,,2",
+    "mr. smith: hello.",
+]
+
+ALPHABET = "abcAB019 .,;:'\"!?-_()\t\n\r"
+
+
+def random_cases(count, seed=0):
+    rng = random.Random(seed)
+    for _ in range(count):
+        length = rng.randint(1, 24)
+        yield "".join(rng.choice(ALPHABET) for _ in range(length))
+
+
+def tokenize(tok, doc):
+    tok.set_content(doc)
+    return [t for t in tok]
+
+
+def check(docs):
+    mismatches = 0
+    for suppress_tags in (False, True):
+        icu = metapy.analyzers.ICUTokenizer(suppress_tags=suppress_tags)
+        fast = metapy.analyzers.FastICUTokenizer(suppress_tags=suppress_tags)
+        for doc in docs:
+            expected = tokenize(icu, doc)
+            actual = tokenize(fast, doc)
+            if expected != actual:
+                mismatches += 1
+                print("Mismatch for {!r}:".format(doc))
+                print("  ICU:  {}".format(expected))
+                print("  fast: {}".format(actual))
+    return mismatches
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) > 2:
+        print("Usage: {} [documents.txt]".format(sys.argv[0]))
+        sys.exit(1)
+
+    docs = CASES + list(random_cases(20000))
+    if len(sys.argv) == 2:
+        with open(sys.argv[1]) as doc_file:
+            docs += [line for line in doc_file]
+
+    mismatches = check(docs)
+    print("Documents: {}, mismatches: {}".format(len(docs), mismatches))
+    sys.exit(1 if mismatches else 0)
@@ -0,0 +1,68 @@
+"""
+Compares the generic sparse vector kernels against the vectorized ones.
+
+Random sparse feature vectors are generated, and the dot, cosine, and
+l2norm kernels are run over them once for every instruction set the CPU
+supports. The results are checked against the generic kernels and the
+time taken at each level is reported.
+
+The batched forms of the kernels (learn.dot_batch, learn.cosine_batch,
+and learn.l2norm_batch) are timed, so each kernel crosses the Python
+boundary once per run rather than once per vector.
+"""
+
+import random
+import sys
+import time
+
+import metapy
+
+LEVELS = ['generic', 'avx2', 'avx512']
+
+def make_vectors(count, nnz, seed=1):
+    rng = random.Random(seed)
+    vectors = []
+    for _ in range(count):
+        fid = 0
+        pairs = []
+        for _ in range(nnz):
+            fid += rng.randint(1, 8)
+            pairs.append((fid, rng.uniform(-1, 1)))
+        vectors.append(metapy.learn.FeatureVector(pairs))
+    return vectors
+
+def run(vectors):
+    first, second = vectors[:-1], vectors[1:]
+    start_time = time.time()
+    dots = metapy.learn.dot_batch(first, second)
+    cosines = metapy.learn.cosine_batch(first, second)
+    norms = metapy.learn.l2norm_batch(vectors)
+    elapsed = time.time() - start_time
+    return list(dots) + list(cosines) + list(norms), elapsed
+
+if __name__ == '__main__':
+
+    if len(sys.argv) > 3:
+        print("Usage: {} [num_vectors] [nnz]".format(sys.argv[0]))
+        sys.exit(1)
+
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+    nnz = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+    vectors = make_vectors(count, nnz)
+
+    detected = metapy.learn.detected_simd_level()
+    levels = LEVELS[:LEVELS.index(detected) + 1]
+    print("Vectors: {}, nnz: {}, detected: {}".format(count, nnz, detected))
+
+    baseline = None
+    for level in levels:
+        metapy.learn.set_simd_level(level)
+        results, elapsed = run(vectors)
+        if baseline is None:
+            baseline = (results, elapsed)
+        max_error = max(abs(x - y) for x, y in zip(results, baseline[0]))
+        print("{:8} {} seconds ({}x, max error {})".format(
+            level + ':', round(elapsed, 4),
+            round(baseline[1] / max(elapsed, 1e-9), 2), max_error))
+
+    metapy.learn.set_simd_level(detected)
@@ -0,0 +1,312 @@
+/**
+ * @file metapy_ann.h
+ * @author Chase Geigle
+ *
+ * An approximate k-nearest-neighbor classifier that finds neighbors with
+ * locality sensitive hashing instead of a full retrieval.
+ */
+
+#ifndef METAPY_ANN_H_
+#define METAPY_ANN_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "meta/classify/classifier/classifier.h"
+#include "meta/classify/multiclass_dataset_view.h"
+#include "metapy_save.h"
+#include "metapy_simd.h"
+
+/**
+ * Classifies instances by a vote of their k most cosine-similar training
+ * instances. Candidate neighbors are found with random hyperplane
+ * (SimHash) locality sensitive hashing (Charikar, 2002): every instance
+ * is hashed into one bucket in each of several tables, and only the
+ * instances sharing a bucket with the query are scored exactly.
+ *
+ * The recall/latency trade-off is controlled by:
+ *  - num_tables: more tables find more true neighbors, at the cost of
+ *    memory and more candidates to score;
+ *  - num_bits: more bits per table make buckets smaller and more
+ *    selective, which is faster but misses more neighbors;
+ *  - num_probes: additionally probe, in each table, the buckets reached
+ *    by flipping the query's num_probes least certain bits (multi-probe
+ *    LSH; Lv et al., 2007), which raises recall without more tables.
+ *
+ * The hyperplanes are never stored: the sign of each hyperplane's
+ * component for a feature is derived from a hash of the (table, bit,
+ * feature) triple, so hashing a sparse instance costs
+ * O(nnz * num_tables * num_bits) regardless of the vocabulary size.
+ */
+class ann_knn : public meta::classify::classifier
+{
+  public:
+    constexpr static std::size_t default_num_tables = 8;
+    constexpr static std::size_t default_num_bits = 16;
+    constexpr static std::size_t default_num_probes = 0;
+
+    using neighbor = std::pair<std::size_t, double>;
+
+    ann_knn(meta::classify::multiclass_dataset_view docs, std::size_t k,
+            std::size_t num_tables, std::size_t num_bits,
+            std::size_t num_probes, bool weighted, uint64_t seed)
+        : k_{k},
+          num_tables_{num_tables},
+          num_bits_{num_bits},
+          num_probes_{std::min(num_probes, num_bits)},
+          weighted_{weighted},
+          seed_{seed},
+          tables_(num_tables)
+    {
+        if (k == 0)
+            throw std::invalid_argument{"k must be positive"};
+        if (num_tables == 0 || num_bits == 0 || num_bits > 64)
+            throw std::invalid_argument{
+                "need at least one table and between 1 and 64 bits"};
+
+        vectors_.reserve(docs.size());
+        labels_.reserve(docs.size());
+        for (const auto& inst : docs)
+        {
+            vectors_.push_back(normalize(inst.weights));
+            labels_.push_back(docs.label(inst));
+        }
+
+        std::vector<double> projections(num_bits_);
+        for (std::size_t i = 0; i < vectors_.size(); ++i)
+        {
+            for (std::size_t t = 0; t < num_tables_; ++t)
+            {
+                auto sig = signature(vectors_[i], t, projections.data());
+                tables_[t][sig].push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+    meta::class_label
+    classify(const meta::learn::feature_vector& instance) const override
+    {
+        return vote(neighbors(instance));
+    }
+
+    /**
+     * @return the (approximately) k most similar training instances to
+     * the query, as (training position, cosine similarity) pairs in
+     * decreasing order of similarity
+     */
+    std::vector<neighbor>
+    neighbors(const meta::learn::feature_vector& instance) const
+    {
+        auto query = normalize(instance);
+
+        std::vector<uint32_t> candidates;
+        std::vector<double> projections(num_bits_);
+        std::vector<std::size_t> order(num_bits_);
+        for (std::size_t t = 0; t < num_tables_; ++t)
+        {
+            auto sig = signature(query, t, projections.data());
+            add_bucket(t, sig, candidates);
+            if (num_probes_ == 0)
+                continue;
+
+            // probe the buckets across the hyperplanes the query is
+            // closest to, since those bits are the likeliest to differ
+            // for a true neighbor
+            for (std::size_t b = 0; b < num_bits_; ++b)
+                order[b] = b;
+            std::partial_sort(order.begin(), order.begin() + num_probes_,
+                              order.end(), [&](std::size_t a, std::size_t b) {
+                                  return std::abs(projections[a])
+                                         < std::abs(projections[b]);
+                              });
+            for (std::size_t p = 0; p < num_probes_; ++p)
+                add_bucket(t, sig ^ (uint64_t{1} << order[p]), candidates);
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                         candidates.end());
+
+        std::vector<neighbor> scored;
+        scored.reserve(candidates.size());
+        for (auto idx : candidates)
+            scored.emplace_back(idx, simd::dot(query, vectors_[idx]));
+        return top_k(std::move(scored));
+    }
+
+    /**
+     * @return the exact k most similar training instances, found by
+     * scoring every training instance
+     */
+    std::vector<neighbor>
+    exact_neighbors(const meta::learn::feature_vector& instance) const
+    {
+        auto query = normalize(instance);
+        std::vector<neighbor> scored;
+        scored.reserve(vectors_.size());
+        for (std::size_t i = 0; i < vectors_.size(); ++i)
+            scored.emplace_back(i, simd::dot(query, vectors_[i]));
+        return top_k(std::move(scored));
+    }
+
+    /**
+     * @return the fraction of the exact k nearest neighbors of the query
+     * that the approximate search also found
+     */
+    double recall(const meta::learn::feature_vector& instance) const
+    {
+        auto exact = exact_neighbors(instance);
+        if (exact.empty())
+            return 1.0;
+
+        auto approx = neighbors(instance);
+        std::vector<std::size_t> found;
+        found.reserve(approx.size());
+        for (const auto& nb : approx)
+            found.push_back(nb.first);
+        std::sort(found.begin(), found.end());
+
+        std::size_t hits = 0;
+        for (const auto& nb : exact)
+            hits += std::binary_search(found.begin(), found.end(), nb.first);
+        return static_cast<double>(hits) / exact.size();
+    }
+
+    /**
+     * @return the label chosen by the exact k nearest neighbors
+     */
+    meta::class_label
+    classify_exact(const meta::learn::feature_vector& instance) const
+    {
+        return vote(exact_neighbors(instance));
+    }
+
+    const meta::class_label& label(std::size_t idx) const
+    {
+        return labels_.at(idx);
+    }
+
+    std::size_t k() const
+    {
+        return k_;
+    }
+
+    void save(std::ostream& /* os */) const override
+    {
+        throw_unsaveable("approximate k-NN classifiers",
+                         "rebuild them from the training data instead");
+    }
+
+  private:
+    static uint64_t mix(uint64_t x)
+    {
+        // splitmix64 finalizer
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * Hashes an instance for one table.
+     * @param projections Receives the projection onto each hyperplane
+     */
+    uint64_t signature(const meta::learn::feature_vector& vec,
+                       std::size_t table, double* projections) const
+    {
+        std::fill(projections, projections + num_bits_, 0.0);
+        auto table_seed = mix(seed_ ^ mix(table));
+        for (const auto& pr : vec)
+        {
+            auto bits = mix(table_seed ^ static_cast<uint64_t>(pr.first));
+            for (std::size_t b = 0; b < num_bits_; ++b)
+            {
+                // one random sign per (table, bit, feature); reuse the
+                // bits of one hash for up to 64 hyperplanes
+                auto sign = (bits >> b) & 1 ? 1.0 : -1.0;
+                projections[b] += sign * pr.second;
+            }
+        }
+
+        uint64_t sig = 0;
+        for (std::size_t b = 0; b < num_bits_; ++b)
+            if (projections[b] > 0)
+                sig |= uint64_t{1} << b;
+        return sig;
+    }
+
+    void add_bucket(std::size_t table, uint64_t sig,
+                    std::vector<uint32_t>& candidates) const
+    {
+        auto it = tables_[table].find(sig);
+        if (it != tables_[table].end())
+            candidates.insert(candidates.end(), it->second.begin(),
+                              it->second.end());
+    }
+
+    static meta::learn::feature_vector
+    normalize(const meta::learn::feature_vector& vec)
+    {
+        auto norm = simd::l2norm(vec);
+        meta::learn::feature_vector result{vec};
+        if (norm > 0)
+            for (auto& pr : result)
+                pr.second /= norm;
+        return result;
+    }
+
+    std::vector<neighbor> top_k(std::vector<neighbor> scored) const
+    {
+        auto cmp = [](const neighbor& a, const neighbor& b) {
+            return a.second > b.second
+                   || (a.second == b.second && a.first < b.first);
+        };
+        auto k = std::min(k_, scored.size());
+        std::partial_sort(scored.begin(), scored.begin() + k, scored.end(),
+                          cmp);
+        scored.resize(k);
+        return scored;
+    }
+
+    meta::class_label vote(const std::vector<neighbor>& neighbors) const
+    {
+        if (neighbors.empty())
+            return meta::class_label{"[none]"};
+
+        // ties go to the label that reached the winning count first
+        std::unordered_map<std::string, double> votes;
+        std::string best;
+        double best_votes = -1;
+        for (const auto& nb : neighbors)
+        {
+            auto lbl = static_cast<std::string>(labels_[nb.first]);
+            auto& v = votes[lbl];
+            v += weighted_ ? nb.second : 1.0;
+            if (v > best_votes)
+            {
+                best_votes = v;
+                best = lbl;
+            }
+        }
+        return meta::class_label{best};
+    }
+
+    std::size_t k_;
+    std::size_t num_tables_;
+    std::size_t num_bits_;
+    std::size_t num_probes_;
+    bool weighted_;
+    uint64_t seed_;
+
+    std::vector<meta::learn::feature_vector> vectors_;
+    std::vector<meta::class_label> labels_;
+    std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> tables_;
+};
+
+#endif
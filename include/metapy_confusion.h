@@ -0,0 +1,301 @@
+/**
+ * @file metapy_confusion.h
+ * @author Chase Geigle
+ *
+ * A confusion matrix over label ids, stored as a dense table of counts.
+ */
+
+#ifndef METAPY_CONFUSION_H_
+#define METAPY_CONFUSION_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "meta/classify/confusion_matrix.h"
+#include "metapy_parallel.h"
+
+/**
+ * A confusion matrix for a fixed set of labels, identified by their index
+ * into labels(). Unlike classify::confusion_matrix, which keys its counts
+ * by pairs of label strings, this keeps a num_labels x num_labels table of
+ * counts (rows are actual labels, columns predicted ones), so adding a
+ * prediction is a single increment and the metrics are computed directly
+ * from the table.
+ *
+ * Matrices over the same labels can be added together, so predictions
+ * may be counted into separate matrices (e.g. one per thread) and merged.
+ */
+class dense_confusion_matrix
+{
+  public:
+    explicit dense_confusion_matrix(std::vector<std::string> labels)
+        : labels_(std::move(labels)),
+          counts_(labels_.size() * labels_.size())
+    {
+        // nothing
+    }
+
+    /**
+     * Counts a single prediction.
+     */
+    void add(uint64_t predicted, uint64_t actual, uint64_t times = 1)
+    {
+        check_label(predicted);
+        check_label(actual);
+        counts_[actual * num_labels() + predicted] += times;
+    }
+
+    /**
+     * Counts size predictions, given as parallel arrays of ids of this
+     * matrix's labels. The arrays are split across num_threads threads,
+     * each counting into its own table; the tables are then summed. The
+     * ids are all validated before anything is counted.
+     */
+    void add_batch(const uint64_t* predicted, const uint64_t* actual,
+                   std::size_t size, std::size_t num_threads)
+    {
+        auto n = num_labels();
+        auto out_of_range = [&](uint64_t id) { return id >= n; };
+        if (std::any_of(predicted, predicted + size, out_of_range)
+            || std::any_of(actual, actual + size, out_of_range))
+            throw std::out_of_range{"label id out of range"};
+
+        num_threads = std::max<std::size_t>(
+            1, std::min<std::size_t>(num_threads, size));
+        if (num_threads == 1)
+        {
+            for (std::size_t i = 0; i < size; ++i)
+                ++counts_[actual[i] * n + predicted[i]];
+            return;
+        }
+
+        std::vector<std::vector<uint64_t>> partial(num_threads);
+        auto block_size = (size + num_threads - 1) / num_threads;
+        parallel_for_blocks(size, num_threads, [&](std::size_t start,
+                                                   std::size_t end) {
+            auto& counts = partial[start / block_size];
+            counts.resize(counts_.size());
+            for (auto i = start; i < end; ++i)
+                ++counts[actual[i] * n + predicted[i]];
+        });
+
+        for (const auto& counts : partial)
+            for (std::size_t i = 0; i < counts.size(); ++i)
+                counts_[i] += counts[i];
+    }
+
+    /**
+     * Counts size predictions whose ids index other lists of labels
+     * rather than labels() (e.g. the labels returned with the ids by
+     * classify_batch, which differ from batch to batch). The ids are
+     * remapped to this matrix's ids first; every label they refer to must
+     * be one of labels().
+     */
+    void add_batch(const uint64_t* predicted,
+                   const std::vector<std::string>& predicted_labels,
+                   const uint64_t* actual,
+                   const std::vector<std::string>& actual_labels,
+                   std::size_t size, std::size_t num_threads)
+    {
+        auto predicted_ids = remap(predicted, predicted_labels, size);
+        auto actual_ids = remap(actual, actual_labels, size);
+        add_batch(predicted_ids.data(), actual_ids.data(), size,
+                  num_threads);
+    }
+
+    dense_confusion_matrix& operator+=(const dense_confusion_matrix& other)
+    {
+        if (other.labels_ != labels_)
+            throw std::invalid_argument{
+                "cannot add confusion matrices over different labels"};
+        for (std::size_t i = 0; i < counts_.size(); ++i)
+            counts_[i] += other.counts_[i];
+        return *this;
+    }
+
+    friend dense_confusion_matrix operator+(dense_confusion_matrix lhs,
+                                            const dense_confusion_matrix& rhs)
+    {
+        lhs += rhs;
+        return lhs;
+    }
+
+    /**
+     * @return the number of times actual was predicted as predicted
+     */
+    uint64_t count(uint64_t predicted, uint64_t actual) const
+    {
+        check_label(predicted);
+        check_label(actual);
+        return counts_[actual * num_labels() + predicted];
+    }
+
+    /**
+     * @return the counts, row-major with one row per actual label
+     */
+    const std::vector<uint64_t>& counts() const
+    {
+        return counts_;
+    }
+
+    const std::vector<std::string>& labels() const
+    {
+        return labels_;
+    }
+
+    std::size_t num_labels() const
+    {
+        return labels_.size();
+    }
+
+    /**
+     * @return the number of predictions counted
+     */
+    uint64_t predictions() const
+    {
+        uint64_t total = 0;
+        for (auto c : counts_)
+            total += c;
+        return total;
+    }
+
+    double accuracy() const
+    {
+        auto total = predictions();
+        if (total == 0)
+            return 0;
+
+        uint64_t correct = 0;
+        for (std::size_t l = 0; l < num_labels(); ++l)
+            correct += counts_[l * num_labels() + l];
+        return static_cast<double>(correct) / total;
+    }
+
+    double precision(uint64_t label) const
+    {
+        check_label(label);
+        uint64_t predicted = 0;
+        for (std::size_t a = 0; a < num_labels(); ++a)
+            predicted += counts_[a * num_labels() + label];
+        return ratio(counts_[label * num_labels() + label], predicted);
+    }
+
+    double recall(uint64_t label) const
+    {
+        check_label(label);
+        return ratio(counts_[label * num_labels() + label],
+                     actual_count(label));
+    }
+
+    double f1_score(uint64_t label) const
+    {
+        auto p = precision(label);
+        auto r = recall(label);
+        return p + r == 0 ? 0.0 : 2 * p * r / (p + r);
+    }
+
+    /**
+     * The overall metrics average the per-label ones, weighting each label
+     * by how often it is the actual label, like classify::confusion_matrix.
+     */
+    double precision() const
+    {
+        return weighted_average(
+            [&](uint64_t label) { return precision(label); });
+    }
+
+    double recall() const
+    {
+        return weighted_average([&](uint64_t label) { return recall(label); });
+    }
+
+    double f1_score() const
+    {
+        return weighted_average(
+            [&](uint64_t label) { return f1_score(label); });
+    }
+
+    /**
+     * Copies the counts into a classify::confusion_matrix, which can
+     * print them and test them for significance.
+     */
+    meta::classify::confusion_matrix to_confusion_matrix() const
+    {
+        meta::classify::confusion_matrix matrix;
+        for (std::size_t a = 0; a < num_labels(); ++a)
+            for (std::size_t p = 0; p < num_labels(); ++p)
+                if (auto c = counts_[a * num_labels() + p])
+                    matrix.add(meta::predicted_label{labels_[p]},
+                               meta::class_label{labels_[a]}, c);
+        return matrix;
+    }
+
+  private:
+    void check_label(uint64_t label) const
+    {
+        if (label >= num_labels())
+            throw std::out_of_range{"label id out of range"};
+    }
+
+    /**
+     * Translates ids that index names into ids of this matrix's labels.
+     */
+    std::vector<uint64_t> remap(const uint64_t* ids,
+                                const std::vector<std::string>& names,
+                                std::size_t size) const
+    {
+        std::vector<uint64_t> to_label(names.size());
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            auto it = std::find(labels_.begin(), labels_.end(), names[i]);
+            if (it == labels_.end())
+                throw std::out_of_range{"unknown label: " + names[i]};
+            to_label[i] = static_cast<uint64_t>(it - labels_.begin());
+        }
+
+        std::vector<uint64_t> result(size);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (ids[i] >= to_label.size())
+                throw std::out_of_range{"label id out of range"};
+            result[i] = to_label[ids[i]];
+        }
+        return result;
+    }
+
+    uint64_t actual_count(uint64_t label) const
+    {
+        uint64_t total = 0;
+        for (std::size_t p = 0; p < num_labels(); ++p)
+            total += counts_[label * num_labels() + p];
+        return total;
+    }
+
+    template <class Metric>
+    double weighted_average(Metric&& metric) const
+    {
+        auto total = predictions();
+        if (total == 0)
+            return 0;
+
+        double result = 0;
+        for (uint64_t l = 0; l < num_labels(); ++l)
+            if (auto count = actual_count(l))
+                result += metric(l) * count / total;
+        return result;
+    }
+
+    static double ratio(uint64_t num, uint64_t denom)
+    {
+        return denom == 0 ? 0.0 : static_cast<double>(num) / denom;
+    }
+
+    std::vector<std::string> labels_;
+    std::vector<uint64_t> counts_;
+};
+
+#endif
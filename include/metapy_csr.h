@@ -0,0 +1,716 @@
+/**
+ * @file metapy_csr.h
+ * @author Chase Geigle
+ *
+ * A compact, compressed sparse row (CSR) representation for datasets.
+ * Rather than giving every instance its own feature_vector allocation,
+ * all instances share one offsets array, one feature id array, and one
+ * value array.
+ */
+
+#ifndef METAPY_CSR_H_
+#define METAPY_CSR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "meta/classify/binary_dataset.h"
+#include "meta/classify/multiclass_dataset.h"
+#include "meta/learn/dataset.h"
+
+/**
+ * A dataset stored in CSR format. FeatureId and Value may be narrower
+ * than MeTA's (uint64_t, double) feature_vector types to save space; e.g.
+ * csr_dataset<uint32_t, float> uses 8 bytes per non-zero instead of 16.
+ *
+ * Instances may optionally carry a label id, with the label ids mapping
+ * to label names; binary datasets use label ids 0 (false) and 1 (true).
+ *
+ * The storage is immutable and shared between copies, so copying a
+ * csr_dataset is cheap.
+ */
+template <class FeatureId, class Value>
+class csr_dataset
+{
+  public:
+    using feature_id_type = FeatureId;
+    using value_type = Value;
+
+    /**
+     * A non-owning view of a single row.
+     */
+    class row_type
+    {
+      public:
+        class iterator
+        {
+          public:
+            iterator(const FeatureId* id, const Value* value)
+                : id_{id}, value_{value}
+            {
+                // nothing
+            }
+
+            std::pair<uint64_t, double> operator*() const
+            {
+                return {static_cast<uint64_t>(*id_),
+                        static_cast<double>(*value_)};
+            }
+
+            iterator& operator++()
+            {
+                ++id_;
+                ++value_;
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const
+            {
+                return id_ == other.id_;
+            }
+
+            bool operator!=(const iterator& other) const
+            {
+                return !(*this == other);
+            }
+
+          private:
+            const FeatureId* id_;
+            const Value* value_;
+        };
+
+        row_type(const FeatureId* ids, const Value* values, std::size_t size)
+            : ids_{ids}, values_{values}, size_{size}
+        {
+            // nothing
+        }
+
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        const FeatureId* ids() const
+        {
+            return ids_;
+        }
+
+        const Value* values() const
+        {
+            return values_;
+        }
+
+        iterator begin() const
+        {
+            return {ids_, values_};
+        }
+
+        iterator end() const
+        {
+            return {ids_ + size_, values_ + size_};
+        }
+
+      private:
+        const FeatureId* ids_;
+        const Value* values_;
+        std::size_t size_;
+    };
+
+    /**
+     * Creates a dataset from CSR arrays.
+     * @param offsets The offset of each row in ids/values, plus one more
+     * entry for the total number of non-zeros; starts at 0 and never
+     * decreases
+     * @param ids The feature ids of every row, each row sorted by id; all
+     * less than total_features
+     * @param values The feature values of every row
+     * @param total_features The number of features
+     */
+    csr_dataset(std::vector<uint64_t> offsets, std::vector<FeatureId> ids,
+                std::vector<Value> values, uint64_t total_features)
+    {
+        if (offsets.empty() || offsets.front() != 0
+            || offsets.back() != ids.size() || ids.size() != values.size()
+            || !std::is_sorted(offsets.begin(), offsets.end()))
+            throw std::invalid_argument{"malformed CSR arrays"};
+        check_total_features(total_features);
+        for (auto id : ids)
+            if (static_cast<uint64_t>(id) >= total_features)
+                throw std::invalid_argument{"feature id out of range"};
+
+        auto storage = std::make_shared<owned_storage>();
+        storage->offsets = std::move(offsets);
+        storage->ids = std::move(ids);
+        storage->values = std::move(values);
+        set_storage(std::move(storage), total_features);
+    }
+
+    /**
+     * Compacts an existing dataset.
+     */
+    explicit csr_dataset(const meta::learn::dataset& dset)
+        : csr_dataset(compact(dset.begin(), dset.end(), dset.total_features()))
+    {
+        // nothing
+    }
+
+    /**
+     * Compacts an existing binary dataset, keeping its labels.
+     */
+    explicit csr_dataset(const meta::classify::binary_dataset& dset)
+        : csr_dataset(static_cast<const meta::learn::dataset&>(dset))
+    {
+        std::vector<uint32_t> labels;
+        labels.reserve(dset.size());
+        for (const auto& inst : dset)
+            labels.push_back(dset.label(inst) ? 1 : 0);
+        set_labels(std::move(labels), {"false", "true"});
+    }
+
+    /**
+     * Compacts an existing multiclass dataset, keeping its labels.
+     */
+    explicit csr_dataset(const meta::classify::multiclass_dataset& dset)
+        : csr_dataset(static_cast<const meta::learn::dataset&>(dset))
+    {
+        std::unordered_map<std::string, uint32_t> ids;
+        std::vector<std::string> names;
+        std::vector<uint32_t> labels;
+        labels.reserve(dset.size());
+        for (const auto& inst : dset)
+        {
+            auto name = static_cast<std::string>(dset.label(inst));
+            auto it = ids.find(name);
+            if (it == ids.end())
+            {
+                it = ids.emplace(name, static_cast<uint32_t>(names.size()))
+                         .first;
+                names.push_back(name);
+            }
+            labels.push_back(it->second);
+        }
+        set_labels(std::move(labels), std::move(names));
+    }
+
+    /**
+     * Attaches labels to the instances.
+     * @param labels The label id of each instance
+     * @param names The name of each label id
+     */
+    void set_labels(std::vector<uint32_t> labels,
+                    std::vector<std::string> names)
+    {
+        if (labels.size() != size())
+            throw std::invalid_argument{
+                "there must be exactly one label per instance"};
+        for (auto lbl : labels)
+            if (lbl >= names.size())
+                throw std::invalid_argument{"label id out of range"};
+
+        auto lbls = std::make_shared<label_storage>();
+        lbls->ids = std::move(labels);
+        lbls->names = std::move(names);
+        labels_ = std::move(lbls);
+        label_ids_ = labels_->ids.data();
+        cache_ = std::make_shared<materialized_cache>();
+    }
+
+    std::size_t size() const
+    {
+        return num_rows_;
+    }
+
+    uint64_t total_features() const
+    {
+        return total_features_;
+    }
+
+    uint64_t nnz() const
+    {
+        return offsets_[num_rows_];
+    }
+
+    /**
+     * @return the number of bytes used to store the rows
+     */
+    uint64_t bytes() const
+    {
+        return sizeof(uint64_t) * (num_rows_ + 1)
+               + (sizeof(FeatureId) + sizeof(Value)) * nnz()
+               + (labels_ ? sizeof(uint32_t) * num_rows_ : 0);
+    }
+
+    row_type operator[](std::size_t row) const
+    {
+        auto begin = offsets_[row];
+        return {ids_ + begin, values_ + begin,
+                static_cast<std::size_t>(offsets_[row + 1] - begin)};
+    }
+
+    const uint64_t* offsets() const
+    {
+        return offsets_;
+    }
+
+    const FeatureId* ids() const
+    {
+        return ids_;
+    }
+
+    const Value* values() const
+    {
+        return values_;
+    }
+
+    bool has_labels() const
+    {
+        return labels_ != nullptr;
+    }
+
+    uint32_t label_id(std::size_t row) const
+    {
+        return label_ids_[row];
+    }
+
+    const std::string& label_name(uint32_t lbl) const
+    {
+        return labels_->names.at(lbl);
+    }
+
+    const std::vector<std::string>& label_names() const
+    {
+        return labels_->names;
+    }
+
+    std::size_t total_labels() const
+    {
+        return labels_ ? labels_->names.size() : 0;
+    }
+
+    /**
+     * @return the id of the positive label when the dataset is used as a
+     * binary dataset: there must be exactly two labels, and the one whose
+     * name sorts last is the positive one (see to_binary_dataset())
+     */
+    uint32_t positive_label_id() const
+    {
+        require_labels();
+        const auto& names = labels_->names;
+        if (names.size() != 2)
+            throw std::invalid_argument{
+                "a binary dataset needs exactly two labels"};
+        return names[0] < names[1] ? 1 : 0;
+    }
+
+    /**
+     * Creates a feature_vector for a single row.
+     */
+    meta::learn::feature_vector feature_vector(std::size_t row) const
+    {
+        auto r = (*this)[row];
+        meta::learn::feature_vector fv;
+        fv.reserve(r.size());
+        for (std::size_t i = 0; i < r.size(); ++i)
+            fv.emplace_back(meta::learn::feature_id{r.ids()[i]},
+                            static_cast<double>(r.values()[i]));
+        return fv;
+    }
+
+    /**
+     * Expands the rows into a learn::dataset.
+     */
+    meta::learn::dataset to_dataset() const
+    {
+        auto rows = row_indices();
+        return meta::learn::dataset(
+            rows.begin(), rows.end(), total_features_,
+            [&](std::size_t row) { return feature_vector(row); });
+    }
+
+    /**
+     * Expands the rows into a classify::binary_dataset. There must be
+     * exactly two labels; the one whose name sorts last is the positive
+     * one (so "true" for {"false", "true"}, "1" for {"0", "1"}, and "pos"
+     * for {"neg", "pos"}), whatever its label id.
+     */
+    meta::classify::binary_dataset to_binary_dataset() const
+    {
+        auto positive = positive_label_id();
+        auto rows = row_indices();
+        return meta::classify::binary_dataset(
+            rows.begin(), rows.end(), total_features_,
+            [&](std::size_t row) { return feature_vector(row); },
+            [&](std::size_t row) { return label_ids_[row] == positive; });
+    }
+
+    /**
+     * Expands the rows into a classify::multiclass_dataset.
+     */
+    meta::classify::multiclass_dataset to_multiclass_dataset() const
+    {
+        require_labels();
+        auto rows = row_indices();
+        return meta::classify::multiclass_dataset(
+            rows.begin(), rows.end(), total_features_,
+            [&](std::size_t row) { return feature_vector(row); },
+            [&](std::size_t row) {
+                return meta::class_label{labels_->names[label_ids_[row]]};
+            });
+    }
+
+    /**
+     * Creates a dataset with the same rows and labels as this one but
+     * with new values. The offsets, feature ids, and labels are shared
+     * with this dataset rather than copied.
+     * @param values The new value of every non-zero, in row order
+     */
+    csr_dataset with_values(std::vector<Value> values) const
+    {
+        if (values.size() != nnz())
+            throw std::invalid_argument{
+                "there must be exactly one value per non-zero"};
+
+        auto storage = std::make_shared<revalued_storage>();
+        storage->base = owner_;
+        storage->values = std::move(values);
+        auto new_values = storage->values.data();
+
+        csr_dataset result;
+        result.set_storage(std::move(storage), offsets_, num_rows_, ids_,
+                           new_values, total_features_);
+        result.labels_ = labels_;
+        result.label_ids_ = label_ids_;
+        return result;
+    }
+
+    /**
+     * MeTA's classifiers and views need a dataset of learn::instances, and
+     * its views refer to the dataset rather than owning it. These return
+     * an expanded copy of this dataset, which costs as much memory as
+     * to_dataset() (a feature_vector per row, at 16 bytes per non-zero):
+     * it is created on first use and then kept, and shared by every copy
+     * of this csr_dataset, until the last of those copies is destroyed, so
+     * that views of it stay valid. They are only used when a MeTA view is
+     * explicitly created from a CSR dataset; code that can read the CSR
+     * rows directly should do so instead.
+     */
+    const meta::learn::dataset& materialized_dataset() const
+    {
+        return materialize(cache_->dataset, [&]() { return to_dataset(); });
+    }
+
+    const meta::classify::binary_dataset& materialized_binary_dataset() const
+    {
+        return materialize(cache_->binary,
+                           [&]() { return to_binary_dataset(); });
+    }
+
+    const meta::classify::multiclass_dataset&
+    materialized_multiclass_dataset() const
+    {
+        return materialize(cache_->multiclass,
+                           [&]() { return to_multiclass_dataset(); });
+    }
+
+  protected:
+    /**
+     * Used by subclasses to supply storage that they manage themselves
+     * (e.g. a memory mapped file).
+     */
+    csr_dataset() = default;
+
+    /**
+     * Points this dataset at externally managed arrays.
+     * @param owner Keeps the arrays alive
+     */
+    void set_storage(std::shared_ptr<const void> owner,
+                     const uint64_t* offsets, std::size_t num_rows,
+                     const FeatureId* ids, const Value* values,
+                     uint64_t total_features)
+    {
+        check_total_features(total_features);
+        owner_ = std::move(owner);
+        offsets_ = offsets;
+        num_rows_ = num_rows;
+        ids_ = ids;
+        values_ = values;
+        total_features_ = total_features;
+        cache_ = std::make_shared<materialized_cache>();
+    }
+
+    /**
+     * Attaches labels stored in externally managed memory.
+     */
+    void set_labels(const uint32_t* label_ids, std::vector<std::string> names)
+    {
+        auto lbls = std::make_shared<label_storage>();
+        lbls->names = std::move(names);
+        labels_ = std::move(lbls);
+        label_ids_ = label_ids;
+        cache_ = std::make_shared<materialized_cache>();
+    }
+
+  private:
+    struct owned_storage
+    {
+        std::vector<uint64_t> offsets;
+        std::vector<FeatureId> ids;
+        std::vector<Value> values;
+    };
+
+    struct revalued_storage
+    {
+        /// keeps the shared offsets, ids, and label ids alive
+        std::shared_ptr<const void> base;
+        std::vector<Value> values;
+    };
+
+    struct label_storage
+    {
+        std::vector<uint32_t> ids;
+        std::vector<std::string> names;
+    };
+
+    struct materialized_cache
+    {
+        std::mutex mutex;
+        std::unique_ptr<meta::learn::dataset> dataset;
+        std::unique_ptr<meta::classify::binary_dataset> binary;
+        std::unique_ptr<meta::classify::multiclass_dataset> multiclass;
+    };
+
+    template <class Dataset, class Creator>
+    const Dataset& materialize(std::unique_ptr<Dataset>& slot,
+                               Creator&& creator) const
+    {
+        std::lock_guard<std::mutex> lock{cache_->mutex};
+        if (!slot)
+            slot = meta::make_unique<Dataset>(creator());
+        return *slot;
+    }
+
+    template <class Iterator>
+    static csr_dataset compact(Iterator first, Iterator last,
+                               uint64_t total_features)
+    {
+        std::vector<uint64_t> offsets{0};
+        std::vector<FeatureId> ids;
+        std::vector<Value> values;
+        for (; first != last; ++first)
+        {
+            for (const auto& pr : first->weights)
+            {
+                ids.push_back(static_cast<FeatureId>(pr.first));
+                values.push_back(static_cast<Value>(pr.second));
+            }
+            offsets.push_back(ids.size());
+        }
+        return {std::move(offsets), std::move(ids), std::move(values),
+                total_features};
+    }
+
+    static void check_total_features(uint64_t total_features)
+    {
+        const auto bits = std::numeric_limits<FeatureId>::digits;
+        if (bits < 64 && total_features > (uint64_t{1} << (bits % 64)))
+            throw std::invalid_argument{
+                "too many features for the feature id type"};
+    }
+
+    void set_storage(std::shared_ptr<owned_storage> storage,
+                     uint64_t total_features)
+    {
+        auto offsets = storage->offsets.data();
+        auto num_rows = storage->offsets.size() - 1;
+        auto ids = storage->ids.data();
+        auto values = storage->values.data();
+        set_storage(std::move(storage), offsets, num_rows, ids, values,
+                    total_features);
+    }
+
+    void require_labels() const
+    {
+        if (!labels_)
+            throw std::invalid_argument{"dataset has no labels"};
+    }
+
+    std::vector<std::size_t> row_indices() const
+    {
+        std::vector<std::size_t> rows(num_rows_);
+        for (std::size_t i = 0; i < num_rows_; ++i)
+            rows[i] = i;
+        return rows;
+    }
+
+    std::shared_ptr<const void> owner_;
+    const uint64_t* offsets_ = nullptr;
+    std::size_t num_rows_ = 0;
+    const FeatureId* ids_ = nullptr;
+    const Value* values_ = nullptr;
+    uint64_t total_features_ = 0;
+
+    std::shared_ptr<const label_storage> labels_;
+    const uint32_t* label_ids_ = nullptr;
+
+    std::shared_ptr<materialized_cache> cache_;
+};
+
+/// The default CSR layout, which loses no precision
+using csr_dataset64 = csr_dataset<uint64_t, double>;
+/// A compact CSR layout with 32-bit feature ids and values
+using csr_dataset32 = csr_dataset<uint32_t, float>;
+
+/**
+ * A lazily evaluated selection of the rows of a csr_dataset. Contiguous
+ * and strided selections are stored as (start, step, size), so slicing a
+ * view (or a slice of a view) takes constant time and space. Only
+ * orderings that are not strided, such as shuffles and rotations, are
+ * stored as an explicit array of row indices; slices of those stride over
+ * the shared array without copying it.
+ *
+ * This laziness ends where MeTA's own views begin: converting a
+ * csr_dataset_view to one of them copies its row indices.
+ */
+template <class FeatureId, class Value>
+class csr_dataset_view
+{
+  public:
+    using dataset_type = csr_dataset<FeatureId, Value>;
+
+    /**
+     * Creates a view of every row of a dataset.
+     */
+    explicit csr_dataset_view(dataset_type dset)
+        : dset_{std::move(dset)}, size_{dset_.size()}
+    {
+        // nothing
+    }
+
+    /**
+     * @param start The first position (in this view) to select
+     * @param step The distance between selected positions; may be negative
+     * @param size The number of positions to select
+     * @return a view of the selected positions of this view
+     */
+    csr_dataset_view slice(std::size_t start, int64_t step,
+                           std::size_t size) const
+    {
+        csr_dataset_view result{*this};
+        result.start_ = size > 0 ? position(start) : 0;
+        result.step_ = step_ * step;
+        result.size_ = size;
+        return result;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    uint64_t total_features() const
+    {
+        return dset_.total_features();
+    }
+
+    /**
+     * @return the row of the dataset at the given position in this view
+     */
+    std::size_t row(std::size_t idx) const
+    {
+        auto pos = position(idx);
+        return indices_ ? (*indices_)[pos] : pos;
+    }
+
+    typename dataset_type::row_type operator[](std::size_t idx) const
+    {
+        return dset_[row(idx)];
+    }
+
+    meta::learn::feature_vector feature_vector(std::size_t idx) const
+    {
+        return dset_.feature_vector(row(idx));
+    }
+
+    uint32_t label_id(std::size_t idx) const
+    {
+        return dset_.label_id(row(idx));
+    }
+
+    const dataset_type& dataset() const
+    {
+        return dset_;
+    }
+
+    /**
+     * @return whether this view is still a strided range of rows
+     */
+    bool is_strided() const
+    {
+        return !indices_;
+    }
+
+    /**
+     * @return the rows selected by this view, in order
+     */
+    std::vector<std::size_t> rows() const
+    {
+        std::vector<std::size_t> result(size_);
+        for (std::size_t i = 0; i < size_; ++i)
+            result[i] = row(i);
+        return result;
+    }
+
+    template <class RandomEngine>
+    void shuffle(RandomEngine&& rng)
+    {
+        auto indices = rows();
+        std::shuffle(indices.begin(), indices.end(), rng);
+        set_indices(std::move(indices));
+    }
+
+    /**
+     * Rotates the view so that the given position becomes the first.
+     */
+    void rotate(std::size_t pos)
+    {
+        if (size_ == 0)
+            return;
+        auto indices = rows();
+        std::rotate(indices.begin(), indices.begin() + pos % size_,
+                    indices.end());
+        set_indices(std::move(indices));
+    }
+
+  private:
+    std::size_t position(std::size_t idx) const
+    {
+        return static_cast<std::size_t>(static_cast<int64_t>(start_)
+                                        + static_cast<int64_t>(idx) * step_);
+    }
+
+    void set_indices(std::vector<std::size_t>&& indices)
+    {
+        indices_ = std::make_shared<const std::vector<std::size_t>>(
+            std::move(indices));
+        start_ = 0;
+        step_ = 1;
+    }
+
+    dataset_type dset_;
+    std::shared_ptr<const std::vector<std::size_t>> indices_;
+    std::size_t start_ = 0;
+    int64_t step_ = 1;
+    std::size_t size_;
+};
+
+using csr_dataset_view64 = csr_dataset_view<uint64_t, double>;
+using csr_dataset_view32 = csr_dataset_view<uint32_t, float>;
+
+#endif
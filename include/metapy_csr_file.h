@@ -0,0 +1,477 @@
+/**
+ * @file metapy_csr_file.h
+ * @author Chase Geigle
+ *
+ * An on-disk format for csr_datasets that can be memory mapped, so that
+ * a dataset can be written once and then paged in by the operating system
+ * as its rows are read.
+ */
+
+#ifndef METAPY_CSR_FILE_H_
+#define METAPY_CSR_FILE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "meta/index/forward_index.h"
+#include "meta/io/mmap_file.h"
+#include "metapy_csr.h"
+
+/**
+ * Exception thrown for malformed or unreadable CSR files.
+ */
+class csr_file_exception : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * The fixed-size header at the start of every CSR file. The file is
+ * written in the machine's native byte order; every section starts on an
+ * 8-byte boundary. The sections, in order, are: feature ids, values, row
+ * offsets (num_rows + 1 uint64_ts), label ids (num_rows uint32_ts, if
+ * there are labels), and label names (each a uint64_t length followed by
+ * that many bytes).
+ */
+struct csr_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t id_bytes;
+    uint32_t value_bytes;
+    uint32_t has_labels;
+    uint64_t num_rows;
+    uint64_t nnz;
+    uint64_t total_features;
+    uint64_t num_labels;
+    uint64_t ids_offset;
+    uint64_t values_offset;
+    uint64_t offsets_offset;
+    uint64_t labels_offset;
+    uint64_t names_offset;
+
+    static constexpr const char* magic_string = "METACSR";
+    static constexpr uint32_t current_version = 1;
+};
+
+/**
+ * Reads the header of a CSR file without mapping it.
+ */
+inline csr_file_header read_csr_file_header(const std::string& path)
+{
+    std::ifstream in{path, std::ios::binary};
+    csr_file_header hdr;
+    if (!in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)))
+        throw csr_file_exception{"cannot read CSR file header: " + path};
+    if (std::memcmp(hdr.magic, csr_file_header::magic_string, 8) != 0)
+        throw csr_file_exception{"not a CSR file: " + path};
+    if (hdr.version != csr_file_header::current_version)
+        throw csr_file_exception{"unsupported CSR file version: " + path};
+    return hdr;
+}
+
+/**
+ * Writes a CSR file one row at a time. Only the row offsets and label ids
+ * are kept in memory; feature ids are streamed to the file itself and
+ * values to a temporary file next to it that is appended on finish().
+ */
+template <class FeatureId, class Value>
+class csr_file_writer
+{
+  public:
+    /**
+     * @param path The file to create
+     * @param total_features The number of features
+     * @param labeled Whether each row will be given a label
+     */
+    csr_file_writer(std::string path, uint64_t total_features,
+                    bool labeled = false)
+        : path_{std::move(path)},
+          values_path_{path_ + ".values.tmp"},
+          ids_{path_, std::ios::binary | std::ios::trunc},
+          values_{values_path_, std::ios::binary | std::ios::trunc},
+          total_features_{total_features},
+          labeled_{labeled},
+          offsets_{0}
+    {
+        if (!ids_ || !values_)
+            throw csr_file_exception{"cannot create CSR file: " + path_};
+
+        const auto bits = std::numeric_limits<FeatureId>::digits;
+        if (bits < 64 && total_features > (uint64_t{1} << (bits % 64)))
+            throw csr_file_exception{
+                "too many features for the feature id type"};
+
+        csr_file_header hdr{};
+        ids_.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    }
+
+    ~csr_file_writer()
+    {
+        if (!finished_)
+        {
+            values_.close();
+            std::remove(values_path_.c_str());
+        }
+    }
+
+    /**
+     * Appends an unlabeled row. The row must be sorted by feature id.
+     */
+    template <class Row>
+    void add_row(const Row& row)
+    {
+        if (labeled_)
+            throw csr_file_exception{"rows of a labeled file need labels"};
+        write_row(row);
+    }
+
+    /**
+     * Appends a labeled row. The row must be sorted by feature id.
+     */
+    template <class Row>
+    void add_row(const Row& row, const std::string& label)
+    {
+        if (!labeled_)
+            throw csr_file_exception{"rows of an unlabeled file have no "
+                                     "labels"};
+        write_row(row);
+
+        auto it = label_ids_.find(label);
+        if (it == label_ids_.end())
+        {
+            it = label_ids_
+                     .emplace(label, static_cast<uint32_t>(names_.size()))
+                     .first;
+            names_.push_back(label);
+        }
+        labels_.push_back(it->second);
+    }
+
+    /**
+     * Writes the remaining sections and the header.
+     */
+    void finish()
+    {
+        csr_file_header hdr{};
+        std::memcpy(hdr.magic, csr_file_header::magic_string, 8);
+        hdr.version = csr_file_header::current_version;
+        hdr.id_bytes = sizeof(FeatureId);
+        hdr.value_bytes = sizeof(Value);
+        hdr.has_labels = labeled_;
+        hdr.num_rows = offsets_.size() - 1;
+        hdr.nnz = offsets_.back();
+        hdr.total_features = total_features_;
+        hdr.num_labels = names_.size();
+
+        hdr.ids_offset = sizeof(hdr);
+        pad();
+
+        values_.close();
+        hdr.values_offset = position();
+        {
+            std::ifstream values{values_path_, std::ios::binary};
+            if (hdr.nnz > 0)
+                ids_ << values.rdbuf();
+        }
+        std::remove(values_path_.c_str());
+        pad();
+
+        hdr.offsets_offset = position();
+        write_array(offsets_);
+        hdr.labels_offset = position();
+        write_array(labels_);
+        pad();
+
+        hdr.names_offset = position();
+        for (const auto& name : names_)
+        {
+            uint64_t len = name.size();
+            ids_.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            ids_.write(name.data(), static_cast<std::streamsize>(len));
+        }
+
+        ids_.seekp(0);
+        ids_.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        ids_.close();
+        finished_ = true;
+        if (!ids_)
+            throw csr_file_exception{"failed writing CSR file: " + path_};
+    }
+
+  private:
+    template <class Row>
+    void write_row(const Row& row)
+    {
+        for (const auto& pr : row)
+        {
+            if (static_cast<uint64_t>(pr.first) >= total_features_)
+                throw csr_file_exception{"feature id out of range"};
+            auto id = static_cast<FeatureId>(pr.first);
+            auto val = static_cast<Value>(pr.second);
+            ids_.write(reinterpret_cast<const char*>(&id), sizeof(id));
+            values_.write(reinterpret_cast<const char*>(&val), sizeof(val));
+            ++nnz_;
+        }
+        offsets_.push_back(nnz_);
+    }
+
+    template <class T>
+    void write_array(const std::vector<T>& vec)
+    {
+        ids_.write(reinterpret_cast<const char*>(vec.data()),
+                   static_cast<std::streamsize>(sizeof(T) * vec.size()));
+    }
+
+    uint64_t position()
+    {
+        return static_cast<uint64_t>(ids_.tellp());
+    }
+
+    void pad()
+    {
+        static const char zeros[8] = {};
+        if (auto rem = position() % 8)
+            ids_.write(zeros, static_cast<std::streamsize>(8 - rem));
+    }
+
+    std::string path_;
+    std::string values_path_;
+    std::ofstream ids_;
+    std::ofstream values_;
+    uint64_t total_features_;
+    bool labeled_;
+    bool finished_ = false;
+    uint64_t nnz_ = 0;
+    std::vector<uint64_t> offsets_;
+    std::vector<uint32_t> labels_;
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, uint32_t> label_ids_;
+};
+
+/**
+ * Writes an in-memory csr_dataset to a CSR file.
+ */
+template <class FeatureId, class Value>
+void write_csr_file(const std::string& path,
+                    const csr_dataset<FeatureId, Value>& dset)
+{
+    csr_file_writer<FeatureId, Value> writer{path, dset.total_features(),
+                                             dset.has_labels()};
+    for (std::size_t i = 0; i < dset.size(); ++i)
+    {
+        if (dset.has_labels())
+            writer.add_row(dset[i], dset.label_name(dset.label_id(i)));
+        else
+            writer.add_row(dset[i]);
+    }
+    writer.finish();
+}
+
+/**
+ * Writes the given documents of a forward index to a CSR file, reading
+ * one document at a time.
+ * @param labeled Whether to store the documents' class labels
+ */
+template <class FeatureId, class Value>
+void write_csr_file(const std::string& path,
+                    meta::index::forward_index& fidx,
+                    const std::vector<meta::doc_id>& docs, bool labeled)
+{
+    csr_file_writer<FeatureId, Value> writer{path, fidx.unique_terms(),
+                                             labeled};
+    for (const auto& d_id : docs)
+    {
+        auto counts = fidx.search_primary(d_id)->counts();
+        if (labeled)
+            writer.add_row(counts,
+                           static_cast<std::string>(fidx.label(d_id)));
+        else
+            writer.add_row(counts);
+    }
+    writer.finish();
+}
+
+/**
+ * A csr_dataset whose arrays live in a memory mapped CSR file. Pages are
+ * only read from disk when they are touched, so code that reads the CSR
+ * rows directly (CSR views and their shuffling and slicing, batch
+ * similarity, the SGD batch methods, and linear_sgd and
+ * linear_one_vs_all trained on a CSR view) need not hold the whole
+ * dataset in memory.
+ *
+ * MeTA's datasets, views, and learners cannot read a CSR file, though:
+ * using this dataset as one of them creates a materialized copy of every
+ * row in memory (see csr_dataset::materialized_dataset()), so training a
+ * MeTA learner on it needs as much memory as an in-memory dataset does.
+ */
+template <class FeatureId, class Value>
+class mapped_csr_dataset : public csr_dataset<FeatureId, Value>
+{
+  public:
+    /**
+     * How the dataset is expected to be accessed; this is passed on to
+     * the operating system as a paging hint.
+     */
+    enum class access_pattern
+    {
+        normal,
+        sequential,
+        random,
+        will_need
+    };
+
+    explicit mapped_csr_dataset(const std::string& path)
+        : file_{std::make_shared<meta::io::mmap_file>(path)}
+    {
+        if (file_->size() < sizeof(csr_file_header))
+            throw csr_file_exception{"not a CSR file: " + path};
+
+        csr_file_header hdr;
+        std::memcpy(&hdr, file_->begin(), sizeof(hdr));
+        if (std::memcmp(hdr.magic, csr_file_header::magic_string, 8) != 0)
+            throw csr_file_exception{"not a CSR file: " + path};
+        if (hdr.version != csr_file_header::current_version)
+            throw csr_file_exception{"unsupported CSR file version: " + path};
+        if (hdr.id_bytes != sizeof(FeatureId)
+            || hdr.value_bytes != sizeof(Value))
+            throw csr_file_exception{
+                "CSR file has a different id or value width: " + path};
+
+        const auto bits = std::numeric_limits<FeatureId>::digits;
+        if (bits < 64 && hdr.total_features > (uint64_t{1} << (bits % 64)))
+            throw csr_file_exception{
+                "too many features for the feature id type: " + path};
+
+        uint64_t end = file_->size();
+        if (hdr.num_rows >= end / sizeof(uint64_t)
+            || !fits(hdr.ids_offset, hdr.nnz, sizeof(FeatureId), end)
+            || !fits(hdr.values_offset, hdr.nnz, sizeof(Value), end)
+            || !fits(hdr.offsets_offset, hdr.num_rows + 1, sizeof(uint64_t),
+                     end)
+            || (hdr.has_labels
+                && !fits(hdr.labels_offset, hdr.num_rows, sizeof(uint32_t),
+                         end))
+            || hdr.names_offset > end)
+            throw csr_file_exception{"truncated CSR file: " + path};
+        if (hdr.ids_offset % 8 != 0 || hdr.values_offset % 8 != 0
+            || hdr.offsets_offset % 8 != 0 || hdr.labels_offset % 8 != 0)
+            throw csr_file_exception{"misaligned CSR file: " + path};
+
+        auto offsets = at<uint64_t>(hdr.offsets_offset);
+        if (offsets[0] != 0 || offsets[hdr.num_rows] != hdr.nnz
+            || !std::is_sorted(offsets, offsets + hdr.num_rows + 1))
+            throw csr_file_exception{"corrupt CSR file: " + path};
+
+        auto ids = at<FeatureId>(hdr.ids_offset);
+        if (std::any_of(ids, ids + hdr.nnz, [&](FeatureId id) {
+                return static_cast<uint64_t>(id) >= hdr.total_features;
+            }))
+            throw csr_file_exception{"feature id out of range: " + path};
+
+        this->set_storage(file_, offsets, hdr.num_rows, ids,
+                          at<Value>(hdr.values_offset), hdr.total_features);
+
+        if (hdr.has_labels)
+        {
+            // every name takes at least its 8-byte length
+            if (hdr.num_labels > (end - hdr.names_offset) / sizeof(uint64_t))
+                throw csr_file_exception{"truncated CSR file: " + path};
+
+            std::vector<std::string> names;
+            names.reserve(hdr.num_labels);
+            auto pos = hdr.names_offset;
+            for (uint64_t i = 0; i < hdr.num_labels; ++i)
+            {
+                uint64_t len;
+                if (end - pos < sizeof(len))
+                    throw csr_file_exception{"truncated CSR file: " + path};
+                std::memcpy(&len, file_->begin() + pos, sizeof(len));
+                pos += sizeof(len);
+                if (len > end - pos)
+                    throw csr_file_exception{"truncated CSR file: " + path};
+                names.emplace_back(file_->begin() + pos, len);
+                pos += len;
+            }
+
+            auto labels = at<uint32_t>(hdr.labels_offset);
+            if (std::any_of(labels, labels + hdr.num_rows, [&](uint32_t lbl) {
+                    return lbl >= hdr.num_labels;
+                }))
+                throw csr_file_exception{"label id out of range: " + path};
+            this->set_labels(labels, std::move(names));
+        }
+    }
+
+    std::string path() const
+    {
+        return file_->path();
+    }
+
+    /**
+     * Advises the operating system of the expected access pattern for
+     * the mapped file. This is a no-op where madvise is not available.
+     */
+    void advise(access_pattern pattern) const
+    {
+#ifndef _WIN32
+        int advice = MADV_NORMAL;
+        switch (pattern)
+        {
+            case access_pattern::normal:
+                advice = MADV_NORMAL;
+                break;
+            case access_pattern::sequential:
+                advice = MADV_SEQUENTIAL;
+                break;
+            case access_pattern::random:
+                advice = MADV_RANDOM;
+                break;
+            case access_pattern::will_need:
+                advice = MADV_WILLNEED;
+                break;
+        }
+        ::madvise(const_cast<char*>(file_->begin()), file_->size(), advice);
+#else
+        (void)pattern;
+#endif
+    }
+
+  private:
+    /**
+     * @return whether count elements of the given size, starting at
+     * offset, end by end (without overflowing)
+     */
+    static bool fits(uint64_t offset, uint64_t count, uint64_t size,
+                     uint64_t end)
+    {
+        return offset <= end && count <= (end - offset) / size;
+    }
+
+    template <class T>
+    const T* at(uint64_t offset) const
+    {
+        return reinterpret_cast<const T*>(file_->begin() + offset);
+    }
+
+    std::shared_ptr<meta::io::mmap_file> file_;
+};
+
+using mapped_csr_dataset64 = mapped_csr_dataset<uint64_t, double>;
+using mapped_csr_dataset32 = mapped_csr_dataset<uint32_t, float>;
+
+#endif
@@ -0,0 +1,575 @@
+/**
+ * @file metapy_kernel.h
+ * @author Chase Geigle
+ *
+ * A multiclass kernel perceptron that caches kernel evaluations between
+ * training instances and can train on several threads.
+ */
+
+#ifndef METAPY_KERNEL_H_
+#define METAPY_KERNEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "meta/classify/classifier/classifier.h"
+#include "meta/classify/kernel/kernel.h"
+#include "meta/classify/kernel/polynomial.h"
+#include "meta/classify/kernel/sigmoid.h"
+#include "meta/classify/multiclass_dataset_view.h"
+#include "metapy_parallel.h"
+#include "metapy_progress.h"
+#include "metapy_save.h"
+#include "metapy_simd.h"
+
+/**
+ * MeTA's polynomial kernel, (x . y + c)^power, with the dot product taken
+ * by the vectorized sparse kernel. It is saved exactly as MeTA's is.
+ */
+class simd_polynomial : public meta::classify::kernel::polynomial
+{
+  public:
+    simd_polynomial(uint8_t power, double c)
+        : polynomial{power, c}, power_{power}, c_{c}
+    {
+        // nothing
+    }
+
+    double operator()(const meta::learn::feature_vector& first,
+                      const meta::learn::feature_vector& second) const override
+    {
+        return std::pow(simd::dot(first, second) + c_, power_);
+    }
+
+  private:
+    uint8_t power_;
+    double c_;
+};
+
+/**
+ * MeTA's sigmoid kernel, tanh(alpha * x . y + c), with the dot product
+ * taken by the vectorized sparse kernel. It is saved exactly as MeTA's
+ * is.
+ */
+class simd_sigmoid : public meta::classify::kernel::sigmoid
+{
+  public:
+    simd_sigmoid(double alpha, double c)
+        : sigmoid{alpha, c}, alpha_{alpha}, c_{c}
+    {
+        // nothing
+    }
+
+    double operator()(const meta::learn::feature_vector& first,
+                      const meta::learn::feature_vector& second) const override
+    {
+        return std::tanh(alpha_ * simd::dot(first, second) + c_);
+    }
+
+  private:
+    double alpha_;
+    double c_;
+};
+
+/**
+ * Evaluates a kernel between one instance and every instance of a fixed
+ * set of documents. Evaluating a whole row at once lets kernels written
+ * in Python be called once per row rather than once per pair.
+ */
+class batch_kernel
+{
+  public:
+    virtual ~batch_kernel() = default;
+
+    /**
+     * Sets the documents that evaluate() compares against. The documents
+     * must outlive any calls to evaluate().
+     */
+    virtual void reset(const std::vector<meta::learn::feature_vector>& docs)
+        = 0;
+
+    /**
+     * @param out Receives the kernel value between x and each document
+     */
+    virtual void evaluate(const meta::learn::feature_vector& x,
+                          double* out) const = 0;
+};
+
+/**
+ * A batch_kernel that evaluates one of MeTA's kernels pair by pair.
+ */
+class native_batch_kernel : public batch_kernel
+{
+  public:
+    native_batch_kernel(std::unique_ptr<meta::classify::kernel::kernel> kernel)
+        : kernel_{std::move(kernel)}
+    {
+        // nothing
+    }
+
+    void reset(const std::vector<meta::learn::feature_vector>& docs) override
+    {
+        docs_ = &docs;
+    }
+
+    void evaluate(const meta::learn::feature_vector& x,
+                  double* out) const override
+    {
+        for (std::size_t j = 0; j < docs_->size(); ++j)
+            out[j] = (*kernel_)(x, (*docs_)[j]);
+    }
+
+  private:
+    std::unique_ptr<meta::classify::kernel::kernel> kernel_;
+    const std::vector<meta::learn::feature_vector>* docs_ = nullptr;
+};
+
+/**
+ * A bounded cache of rows of the Gram matrix of a set of documents,
+ * evicted in least recently used order. When every row fits, the whole
+ * matrix can be computed up front instead. Safe to use from several
+ * threads.
+ */
+class kernel_row_cache
+{
+  public:
+    using row_ptr = std::shared_ptr<const std::vector<double>>;
+
+    /**
+     * @param max_bytes The memory budget for cached rows (at least one
+     * row is always kept)
+     */
+    kernel_row_cache(const batch_kernel& kernel, std::size_t num_docs,
+                     std::size_t max_bytes)
+        : kernel_(kernel),
+          num_docs_{num_docs},
+          capacity_{std::max<std::size_t>(
+              1, max_bytes / std::max<std::size_t>(
+                                 1, num_docs * sizeof(double)))}
+    {
+        // nothing
+    }
+
+    /**
+     * @return whether the whole Gram matrix fits in the budget
+     */
+    bool fits_all() const
+    {
+        return capacity_ >= num_docs_;
+    }
+
+    /**
+     * Computes every row of the Gram matrix on num_threads threads.
+     */
+    void fill(const std::vector<meta::learn::feature_vector>& docs,
+              std::size_t num_threads)
+    {
+        std::vector<row_ptr> rows(docs.size());
+        parallel_for_blocks(docs.size(), num_threads,
+                            [&](std::size_t start, std::size_t end) {
+                                for (auto i = start; i < end; ++i)
+                                    rows[i] = compute(docs[i]);
+                            });
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (std::size_t i = 0; i < rows.size(); ++i)
+            insert(i, std::move(rows[i]));
+        misses_ += rows.size();
+    }
+
+    /**
+     * @return row i of the Gram matrix, computing it if needed
+     */
+    row_ptr row(std::size_t i, const meta::learn::feature_vector& doc)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            auto it = rows_.find(i);
+            if (it != rows_.end())
+            {
+                lru_.splice(lru_.begin(), lru_, it->second.second);
+                ++hits_;
+                return it->second.first;
+            }
+            ++misses_;
+        }
+
+        auto result = compute(doc);
+        std::lock_guard<std::mutex> lock{mutex_};
+        insert(i, result);
+        return result;
+    }
+
+    uint64_t hits() const
+    {
+        return hits_;
+    }
+
+    uint64_t misses() const
+    {
+        return misses_;
+    }
+
+  private:
+    row_ptr compute(const meta::learn::feature_vector& doc) const
+    {
+        auto result = std::make_shared<std::vector<double>>(num_docs_);
+        kernel_.evaluate(doc, result->data());
+        return result;
+    }
+
+    void insert(std::size_t i, row_ptr row)
+    {
+        if (rows_.find(i) != rows_.end())
+            return;
+        if (rows_.size() >= capacity_)
+        {
+            rows_.erase(lru_.back());
+            lru_.pop_back();
+        }
+        lru_.push_front(i);
+        rows_.emplace(i, std::make_pair(std::move(row), lru_.begin()));
+    }
+
+    const batch_kernel& kernel_;
+    std::size_t num_docs_;
+    std::size_t capacity_;
+
+    std::mutex mutex_;
+    std::list<std::size_t> lru_;
+    std::unordered_map<std::size_t,
+                       std::pair<row_ptr, std::list<std::size_t>::iterator>>
+        rows_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+/**
+ * A multiclass perceptron in dual form, trained like MeTA's
+ * dual_perceptron: every mistake on a training instance moves rate alpha
+ * of that instance's kernel function toward its true label and away from
+ * the guessed one, and training stops after max_iter passes or once the
+ * fraction of mistakes in a pass falls below gamma.
+ *
+ * The kernel values between training instances are read from a
+ * kernel_row_cache, so each is computed once per cached row rather than
+ * once per pass.
+ *
+ * With several threads, each pass is split into one shard per thread.
+ * The shards are trained independently against the weights from the
+ * start of the pass, and their updates are averaged at its end
+ * (iterative parameter mixing; McDonald et al., 2010). With one thread
+ * this is the usual sequential perceptron.
+ */
+class kernel_perceptron : public meta::classify::classifier
+{
+  public:
+    constexpr static double default_alpha = 0.1;
+    constexpr static double default_gamma = 0.05;
+    constexpr static double default_bias = 0;
+    constexpr static uint64_t default_max_iter = 100;
+    constexpr static std::size_t default_cache_size = 256;
+
+    /**
+     * @param cache_size The kernel cache budget, in megabytes
+     * @param monitor If not null, receives the progress of training (the
+     * loss of an epoch is its error rate, and the weight norm is that of
+     * the dual weights)
+     * @param holdout If not null (and there is a monitor), the held-out
+     * instances used for early stopping
+     */
+    kernel_perceptron(
+        meta::classify::multiclass_dataset_view docs,
+        std::unique_ptr<batch_kernel> kernel, double alpha, double gamma,
+        double bias, uint64_t max_iter, std::size_t cache_size,
+        std::size_t num_threads, uint64_t seed,
+        training_monitor* monitor = nullptr,
+        const meta::classify::multiclass_dataset_view* holdout = nullptr)
+        : kernel_{std::move(kernel)}, alpha_{alpha}, bias_{bias}
+    {
+        std::vector<uint32_t> labels;
+        vectors_.reserve(docs.size());
+        labels.reserve(docs.size());
+        std::unordered_map<std::string, uint32_t> label_ids;
+        for (const auto& inst : docs)
+        {
+            vectors_.push_back(inst.weights);
+            auto lbl = static_cast<std::string>(docs.label(inst));
+            auto it = label_ids.find(lbl);
+            if (it == label_ids.end())
+            {
+                it = label_ids.emplace(lbl, labels_.size()).first;
+                labels_.emplace_back(lbl);
+            }
+            labels.push_back(it->second);
+        }
+
+        kernel_->reset(vectors_);
+        kernel_row_cache cache{*kernel_, vectors_.size(),
+                               cache_size * 1024 * 1024};
+        if (cache.fits_all())
+            cache.fill(vectors_, num_threads);
+
+        // the support vectors only ever grow, so the dual weights alone
+        // checkpoint the model
+        std::vector<double> best;
+        if (monitor && holdout)
+            monitor->set_evaluator(
+                [&]() {
+                    return holdout_accuracy(
+                        holdout->size(),
+                        [&](std::size_t i) {
+                            const auto& inst = *(holdout->begin() + i);
+                            return classify(inst.weights)
+                                   == holdout->label(inst);
+                        },
+                        num_threads);
+                },
+                [&]() { best = weights_; });
+        train(labels, cache, gamma, max_iter, num_threads, seed, monitor);
+        if (monitor)
+        {
+            monitor->set_evaluator({});
+            if (!best.empty() && monitor->past_best())
+                weights_ = std::move(best);
+        }
+        cache_hits_ = cache.hits();
+        cache_misses_ = cache.misses();
+        compact();
+        kernel_->reset(vectors_);
+    }
+
+    meta::class_label
+    classify(const meta::learn::feature_vector& instance) const override
+    {
+        if (labels_.empty())
+            return meta::class_label{"[none]"};
+
+        std::vector<double> row(vectors_.size());
+        kernel_->evaluate(instance, row.data());
+
+        std::vector<double> scores(labels_.size(), 0.0);
+        for (std::size_t j = 0; j < vectors_.size(); ++j)
+            add_scores(j, row[j], scores.data());
+        return labels_[best_label(scores)];
+    }
+
+    /**
+     * @return the number of training instances kept as support vectors
+     */
+    std::size_t num_support_vectors() const
+    {
+        return vectors_.size();
+    }
+
+    /**
+     * @return the fraction of training instances misclassified in each
+     * pass
+     */
+    const std::vector<double>& epoch_errors() const
+    {
+        return epoch_errors_;
+    }
+
+    uint64_t cache_hits() const
+    {
+        return cache_hits_;
+    }
+
+    uint64_t cache_misses() const
+    {
+        return cache_misses_;
+    }
+
+    void save(std::ostream& /* os */) const override
+    {
+        throw_unsaveable("kernel perceptrons", "retrain them instead");
+    }
+
+  private:
+    struct mistake
+    {
+        uint32_t doc;
+        uint32_t guess;
+        uint32_t actual;
+    };
+
+    void train(const std::vector<uint32_t>& labels, kernel_row_cache& cache,
+               double gamma, uint64_t max_iter, std::size_t num_threads,
+               uint64_t seed, training_monitor* monitor)
+    {
+        auto num_labels = labels_.size();
+        auto num_docs = vectors_.size();
+        weights_.assign(num_docs * num_labels, 0.0);
+        std::vector<bool> is_support(num_docs, false);
+
+        num_threads = std::max<std::size_t>(
+            1, std::min<std::size_t>(num_threads, num_docs));
+        std::vector<std::vector<mistake>> mistakes(num_threads);
+
+        std::vector<std::size_t> order(num_docs);
+        std::iota(order.begin(), order.end(), 0);
+        std::mt19937_64 rng{seed};
+
+        for (uint64_t iter = 0; iter < max_iter && num_docs > 0; ++iter)
+        {
+            epoch_timer timer;
+            std::shuffle(order.begin(), order.end(), rng);
+
+            auto shard_size = (num_docs + num_threads - 1) / num_threads;
+            parallel_for_blocks(
+                num_threads, num_threads,
+                [&](std::size_t first_shard, std::size_t last_shard) {
+                    for (auto s = first_shard; s < last_shard; ++s)
+                    {
+                        auto start = std::min(s * shard_size, num_docs);
+                        auto end = std::min(start + shard_size, num_docs);
+                        train_shard(order, start, end, labels, cache,
+                                    mistakes[s]);
+                    }
+                });
+
+            std::size_t errors = 0;
+            auto rate = alpha_ / num_threads;
+            for (auto& shard : mistakes)
+            {
+                errors += shard.size();
+                for (const auto& m : shard)
+                {
+                    weights_[m.doc * num_labels + m.actual] += rate;
+                    weights_[m.doc * num_labels + m.guess] -= rate;
+                    if (!is_support[m.doc])
+                    {
+                        is_support[m.doc] = true;
+                        support_.push_back(m.doc);
+                    }
+                }
+                shard.clear();
+            }
+
+            auto error_rate = static_cast<double>(errors) / num_docs;
+            epoch_errors_.push_back(error_rate);
+            if (monitor)
+            {
+                epoch_stats stats;
+                stats.epoch = iter + 1;
+                stats.loss = error_rate;
+                timer.finish(stats, num_docs);
+                double norm = 0;
+                for (auto w : weights_)
+                    norm += w * w;
+                stats.weight_norm = std::sqrt(norm);
+                if (!monitor->record(stats))
+                    break;
+            }
+
+            if (error_rate < gamma)
+                break;
+        }
+
+        if (monitor)
+            monitor->finish();
+    }
+
+    /**
+     * Trains on the instances order[start, end) against the weights from
+     * the start of the pass, recording this shard's mistakes (which are
+     * also counted in its own later predictions).
+     */
+    void train_shard(const std::vector<std::size_t>& order, std::size_t start,
+                     std::size_t end, const std::vector<uint32_t>& labels,
+                     kernel_row_cache& cache,
+                     std::vector<mistake>& mistakes) const
+    {
+        std::vector<double> scores(labels_.size());
+        for (auto pos = start; pos < end; ++pos)
+        {
+            auto i = order[pos];
+            auto row = cache.row(i, vectors_[i]);
+            const auto& k = *row;
+
+            std::fill(scores.begin(), scores.end(), 0.0);
+            for (auto j : support_)
+                add_scores(j, k[j], scores.data());
+            for (const auto& m : mistakes)
+            {
+                auto value = alpha_ * (k[m.doc] + bias_);
+                scores[m.actual] += value;
+                scores[m.guess] -= value;
+            }
+
+            auto guess = best_label(scores);
+            if (guess != labels[i])
+                mistakes.push_back(mistake{static_cast<uint32_t>(i), guess,
+                                           labels[i]});
+        }
+    }
+
+    void add_scores(std::size_t doc, double kernel_value, double* scores) const
+    {
+        auto value = kernel_value + bias_;
+        const auto* w = &weights_[doc * labels_.size()];
+        for (std::size_t l = 0; l < labels_.size(); ++l)
+            scores[l] += w[l] * value;
+    }
+
+    static uint32_t best_label(const std::vector<double>& scores)
+    {
+        auto best = std::max_element(scores.begin(), scores.end());
+        return static_cast<uint32_t>(best - scores.begin());
+    }
+
+    /**
+     * Keeps only the training instances with nonzero weights.
+     */
+    void compact()
+    {
+        auto num_labels = labels_.size();
+        std::sort(support_.begin(), support_.end());
+
+        std::vector<meta::learn::feature_vector> vectors;
+        std::vector<double> weights;
+        for (auto j : support_)
+        {
+            auto first = weights_.begin() + j * num_labels;
+            if (std::all_of(first, first + num_labels,
+                            [](double w) { return w == 0; }))
+                continue;
+            vectors.push_back(std::move(vectors_[j]));
+            weights.insert(weights.end(), first, first + num_labels);
+        }
+
+        vectors_ = std::move(vectors);
+        weights_ = std::move(weights);
+        support_.clear();
+    }
+
+    std::unique_ptr<batch_kernel> kernel_;
+    double alpha_;
+    double bias_;
+
+    std::vector<meta::learn::feature_vector> vectors_;
+    std::vector<meta::class_label> labels_;
+    /// weights_[j * labels_.size() + l]: the weight of instance j for label l
+    std::vector<double> weights_;
+    /// the training instances with nonzero weights (during training)
+    std::vector<std::size_t> support_;
+
+    std::vector<double> epoch_errors_;
+    uint64_t cache_hits_ = 0;
+    uint64_t cache_misses_ = 0;
+};
+
+#endif
@@ -7,8 +7,23 @@
 #define METAPY_LEARN_H_
 
 #include <cmath>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
+#include <algorithm>
+#include <numeric>
+
+#include "meta/learn/dataset_view.h"
+#include "meta/learn/instance.h"
+#include "metapy_csr.h"
+
+/**
+ * Slices one of MeTA's dataset views. This is not lazy: MeTA's views
+ * always hold an array of instance ids, so every slice costs O(slice
+ * length) time and memory. Contiguous slices copy the selected range of
+ * the array directly; other strides gather the selected ids. Only views of
+ * CSR datasets (see make_sliced_csr_view) slice in constant time.
+ */
 template <class DatasetView>
 DatasetView make_sliced_dataset_view(const DatasetView& dv,
                                      pybind11::slice slice)
@@ -17,6 +32,10 @@ DatasetView make_sliced_dataset_view(const DatasetView& dv,
     if (!slice.compute(dv.size(), &start, &stop, &step, &slicelength))
         throw pybind11::error_already_set{};
 
+    if (step == 1)
+        return DatasetView{dv, dv.begin() + start,
+                           dv.begin() + start + slicelength};
+
     std::vector<std::size_t> indices(slicelength);
     auto it = dv.begin() + start;
     for (std::size_t i = 0; i < slicelength; ++i)
@@ -28,6 +47,234 @@ DatasetView make_sliced_dataset_view(const DatasetView& dv,
     return DatasetView{dv, std::move(indices)};
 }
 
+/**
+ * Slices a lazy CSR dataset view in constant time.
+ */
+template <class CSRView>
+CSRView make_sliced_csr_view(const CSRView& view, pybind11::slice slice)
+{
+    std::size_t start, stop, step, slicelength;
+    if (!slice.compute(view.size(), &start, &stop, &step, &slicelength))
+        throw pybind11::error_already_set{};
+    return view.slice(start, static_cast<int64_t>(step), slicelength);
+}
+
+/**
+ * Builds a feature_vector from parallel arrays of feature ids and values.
+ * The ids need not be sorted; duplicate ids have their values summed (as
+ * in scipy.sparse). The ids are not range checked here: csr_arrays checks
+ * every index once, when it is constructed.
+ */
+inline meta::learn::feature_vector
+make_feature_vector(const uint64_t* ids, const double* values, std::size_t size)
+{
+    meta::learn::feature_vector fv;
+    fv.reserve(size);
+
+    if (std::is_sorted(ids, ids + size))
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (i > 0 && ids[i] == ids[i - 1])
+                (fv.end() - 1)->second += values[i];
+            else
+                fv.emplace_back(meta::learn::feature_id{ids[i]}, values[i]);
+        }
+        return fv;
+    }
+
+    std::vector<std::size_t> order(size);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return ids[a] < ids[b];
+    });
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        auto idx = order[i];
+        if (i > 0 && ids[idx] == ids[order[i - 1]])
+            (fv.end() - 1)->second += values[idx];
+        else
+            fv.emplace_back(meta::learn::feature_id{ids[idx]}, values[idx]);
+    }
+    return fv;
+}
+
+using py_id_array
+    = pybind11::array_t<uint64_t, pybind11::array::c_style
+                                      | pybind11::array::forcecast>;
+using py_value_array
+    = pybind11::array_t<double, pybind11::array::c_style
+                                    | pybind11::array::forcecast>;
+
+/**
+ * A non-owning view of a matrix in compressed sparse row format, backed
+ * by numpy arrays (e.g. those of a scipy.sparse.csr_matrix). The arrays
+ * must outlive the view.
+ *
+ * The arrays are read in place only if they are already C-contiguous
+ * uint64 (indptr, indices) and float64 (data) arrays; anything else, such
+ * as scipy's default int32 indices, is converted to a copy first.
+ */
+struct csr_arrays
+{
+    const uint64_t* indptr;
+    const uint64_t* indices;
+    const double* data;
+    std::size_t rows;
+    uint64_t num_columns;
+
+    /**
+     * Validates the arrays and creates a view of them. This must be
+     * called with the GIL held.
+     * @param columns The number of columns (features); every index must
+     * be less than it
+     */
+    csr_arrays(const py_id_array& indptr_arr, const py_id_array& indices_arr,
+               const py_value_array& data_arr, uint64_t columns)
+        : indptr{indptr_arr.data()},
+          indices{indices_arr.data()},
+          data{data_arr.data()},
+          rows{indptr_arr.size() > 0
+                   ? static_cast<std::size_t>(indptr_arr.size()) - 1
+                   : 0},
+          num_columns{columns}
+    {
+        if (indptr_arr.size() == 0)
+            throw pybind11::value_error{"indptr must not be empty"};
+        if (indices_arr.size() != data_arr.size())
+            throw pybind11::value_error{
+                "indices and data must have the same length"};
+        if (indptr[0] != 0
+            || indptr[rows] != static_cast<uint64_t>(indices_arr.size())
+            || !std::is_sorted(indptr, indptr + rows + 1))
+            throw pybind11::value_error{"malformed indptr"};
+        // negative indices were converted to huge unsigned ones
+        if (std::any_of(indices, indices + indices_arr.size(),
+                        [&](uint64_t id) { return id >= num_columns; }))
+            throw pybind11::value_error{
+                "indices must be in [0, number of columns)"};
+    }
+
+    std::size_t size() const
+    {
+        return rows;
+    }
+
+    uint64_t total_features() const
+    {
+        return num_columns;
+    }
+
+    std::size_t row_size(std::size_t row) const
+    {
+        return indptr[row + 1] - indptr[row];
+    }
+
+    meta::learn::feature_vector row(std::size_t row) const
+    {
+        return make_feature_vector(indices + indptr[row], data + indptr[row],
+                                   row_size(row));
+    }
+};
+
+/**
+ * Batch operations accept any of the dataset views below; these give
+ * uniform access to the features of the instance at a position.
+ */
+inline const meta::learn::feature_vector&
+instance_features(const meta::learn::dataset_view& dv, std::size_t idx)
+{
+    return (dv.begin() + idx)->weights;
+}
+
+template <class FeatureId, class Value>
+meta::learn::feature_vector
+instance_features(const csr_dataset_view<FeatureId, Value>& dv,
+                  std::size_t idx)
+{
+    return dv.feature_vector(idx);
+}
+
+inline meta::learn::feature_vector
+instance_features(const csr_arrays& csr, std::size_t idx)
+{
+    return csr.row(idx);
+}
+
+/**
+ * Creates a dataset (or a binary or multiclass dataset, if a labeling
+ * function is provided) with one instance per row of a CSR matrix, and
+ * one feature per column. This does not touch any Python objects, so it may
+ * be called without the GIL.
+ */
+template <class Dataset, class... LabelFunction>
+Dataset make_csr_dataset(const csr_arrays& csr, LabelFunction&&... labeler)
+{
+    std::vector<std::size_t> rows(csr.rows);
+    std::iota(rows.begin(), rows.end(), 0);
+    return Dataset(rows.begin(), rows.end(), csr.num_columns,
+                   [&](std::size_t row) { return csr.row(row); },
+                   std::forward<LabelFunction>(labeler)...);
+}
+
+/**
+ * Extracts the arrays of a scipy.sparse matrix (converting it to CSR
+ * format if needed) and invokes fn(indptr, indices, data, num_columns).
+ */
+template <class Function>
+auto with_scipy_csr(pybind11::object matrix, Function&& fn)
+    -> decltype(fn(std::declval<py_id_array>(), std::declval<py_id_array>(),
+                   std::declval<py_value_array>(), std::size_t{}))
+{
+    if (pybind11::hasattr(matrix, "tocsr"))
+        matrix = matrix.attr("tocsr")();
+
+    auto shape = matrix.attr("shape").cast<pybind11::tuple>();
+    return fn(matrix.attr("indptr").cast<py_id_array>(),
+              matrix.attr("indices").cast<py_id_array>(),
+              matrix.attr("data").cast<py_value_array>(),
+              shape[1].cast<std::size_t>());
+}
+
+/**
+ * Lets a view of one of MeTA's dataset types be created from a CSR
+ * dataset. The view refers to the CSR dataset's materialized copy (a
+ * feature_vector per row), so the CSR dataset is kept alive with the
+ * view. The conversion is deliberately not implicit: it gives up the
+ * memory savings of the CSR storage, so callers have to ask for it.
+ */
+template <class View, class CSRDataset, class Dataset>
+void bind_csr_view_init(pybind11::class_<View>& view,
+                        const Dataset& (CSRDataset::*materialize)() const)
+{
+    view.def("__init__",
+             [=](View& dv, const CSRDataset& dset) {
+                 pybind11::gil_scoped_release release;
+                 new (&dv) View((dset.*materialize)());
+             },
+             pybind11::keep_alive<1, 2>());
+}
+
+/**
+ * Lets a view of one of MeTA's dataset types be created from a lazy view
+ * of a CSR dataset. The conversion is O(view size): the selected instance
+ * ids are copied into the MeTA view, and the instances come from the CSR
+ * dataset's materialized copy. Like the conversion above, it is not
+ * implicit.
+ */
+template <class CSRView, class View, class CSRDataset, class Dataset>
+void bind_csr_view_init(pybind11::class_<View>& view,
+                        const Dataset& (CSRDataset::*materialize)() const)
+{
+    view.def("__init__",
+             [=](View& dv, const CSRView& csr_view) {
+                 pybind11::gil_scoped_release release;
+                 View all{(csr_view.dataset().*materialize)()};
+                 new (&dv) View(all, csr_view.rows());
+             },
+             pybind11::keep_alive<1, 2>());
+}
+
 void metapy_bind_learn(pybind11::module& m);
 
 #endif
@@ -0,0 +1,890 @@
+/**
+ * @file metapy_linear.h
+ * @author Chase Geigle
+ *
+ * A multi-output linear model trained with stochastic gradient descent,
+ * and a one-vs-all classifier built on top of it.
+ */
+
+#ifndef METAPY_LINEAR_H_
+#define METAPY_LINEAR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "meta/classify/binary_dataset_view.h"
+#include "meta/classify/classifier/binary_classifier.h"
+#include "meta/classify/classifier/classifier.h"
+#include "meta/classify/multiclass_dataset_view.h"
+#include "meta/learn/loss/loss_function.h"
+#include "meta/learn/sgd.h"
+#include "metapy_csr.h"
+#include "metapy_parallel.h"
+#include "metapy_progress.h"
+#include "metapy_save.h"
+#include "metapy_simd.h"
+
+/**
+ * A linear model with one weight vector per output. The weights are
+ * stored feature-major (all outputs' weights for a feature are adjacent),
+ * so the margins of every output for a sparse instance are computed in a
+ * single pass over its features.
+ *
+ * Each output's weights are kept as scale * w so that L2 regularization
+ * costs O(outputs) per update instead of O(features * outputs).
+ *
+ * fit() can train with several threads at once in the style of Hogwild!
+ * (Niu et al., 2011): every thread updates the shared weights without any
+ * locking. Sparse instances rarely touch the same weights, so the lost
+ * updates barely affect convergence. In that mode L2 regularization is
+ * applied lazily to the weights of the features an update touches, since
+ * the shared scale factors cannot be updated without synchronization.
+ */
+class linear_model
+{
+  public:
+    using options_type = meta::learn::sgd_model::options_type;
+
+    struct fit_options
+    {
+        /// Training stops once the average loss changes by less than this
+        double gamma = 1e-3;
+        /// The maximum number of epochs
+        std::size_t max_iter = 5;
+        /// The number of threads updating the weights concurrently
+        std::size_t num_threads = 1;
+        /// Whether to train reproducibly: a seeded shuffle and a single
+        /// thread, regardless of num_threads
+        bool deterministic = false;
+        /// The shuffling seed used when training deterministically
+        uint64_t seed = 0;
+    };
+
+    linear_model(uint64_t num_features, std::size_t num_outputs,
+                 options_type options)
+        : num_features_{num_features},
+          num_outputs_{num_outputs},
+          options_(options),
+          weights_(num_features * num_outputs, 0.0),
+          scale_(num_outputs, 1.0),
+          bias_(num_outputs, 0.0)
+    {
+        if (num_outputs == 0)
+            throw std::invalid_argument{"linear model needs an output"};
+    }
+
+    uint64_t num_features() const
+    {
+        return num_features_;
+    }
+
+    std::size_t num_outputs() const
+    {
+        return num_outputs_;
+    }
+
+    const options_type& options() const
+    {
+        return options_;
+    }
+
+    /**
+     * Computes the margin of every output for an instance.
+     * @param out Receives num_outputs() margins
+     */
+    void margins(const meta::learn::feature_vector& x, double* out) const
+    {
+        if (num_outputs_ == 1)
+        {
+            // feature-major storage of a single output is a dense vector
+            out[0] = simd::dot(x, weights_.data(), num_features_) * scale_[0]
+                     + bias_[0];
+            return;
+        }
+
+        std::fill(out, out + num_outputs_, 0.0);
+        for (const auto& pr : x)
+        {
+            if (pr.first >= num_features_)
+                continue;
+            const auto* row = &weights_[pr.first * num_outputs_];
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+                out[o] += row[o] * pr.second;
+        }
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+            out[o] = out[o] * scale_[o] + bias_[o];
+    }
+
+    /**
+     * Computes the margins of an instance given as any other range of
+     * (feature id, value) pairs, such as a row of a csr_dataset.
+     */
+    template <class Row>
+    void margins(const Row& x, double* out) const
+    {
+        std::fill(out, out + num_outputs_, 0.0);
+        for (const auto& pr : x)
+        {
+            if (pr.first >= num_features_)
+                continue;
+            const auto* row = &weights_[pr.first * num_outputs_];
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+                out[o] += row[o] * pr.second;
+        }
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+            out[o] = out[o] * scale_[o] + bias_[o];
+    }
+
+    template <class Row>
+    std::vector<double> margins(const Row& x) const
+    {
+        std::vector<double> out(num_outputs_);
+        margins(x, out.data());
+        return out;
+    }
+
+    /**
+     * Copies the model into snapshot, reusing its storage if it already
+     * holds a copy. Learners use this to checkpoint their best epoch.
+     */
+    void save_to(std::unique_ptr<linear_model>& snapshot) const
+    {
+        if (snapshot)
+            *snapshot = *this;
+        else
+            snapshot = meta::make_unique<linear_model>(*this);
+    }
+
+    /**
+     * Performs one SGD update of every output.
+     * @param x The instance: a feature_vector or a csr_dataset row
+     * @param expected The target of every output (e.g. +1 or -1)
+     * @return the summed loss over the outputs before the update
+     */
+    template <class Row>
+    double train_one(const Row& x, const double* expected,
+                     const meta::learn::loss::loss_function& loss)
+    {
+        gradient_.resize(num_outputs_);
+        auto eta = learning_rate(num_updates_);
+        auto total_loss = gradients(x, expected, loss, eta, gradient_.data());
+
+        if (options_.l2_regularizer > 0)
+        {
+            auto decay = 1 - eta * options_.l2_regularizer;
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+            {
+                scale_[o] *= decay;
+                if (scale_[o] < rescale_threshold)
+                    rescale(o);
+            }
+        }
+
+        apply(x, gradient_.data(), eta);
+        ++num_updates_;
+        return total_loss;
+    }
+
+    /**
+     * Trains the model for up to fit_options::max_iter epochs over a
+     * dataset, visiting the instances in a new random order each epoch.
+     *
+     * @param size The number of training instances
+     * @param features features(i) returns the feature_vector (or the
+     * csr_dataset row) of instance i
+     * @param targets targets(i, out) writes the num_outputs() targets of
+     * instance i to out
+     * @param monitor If not null, receives the stats of every epoch and
+     * may stop training early
+     * @return the average loss of each epoch
+     */
+    template <class Features, class Targets>
+    std::vector<double> fit(std::size_t size, Features&& features,
+                            Targets&& targets,
+                            const meta::learn::loss::loss_function& loss,
+                            const fit_options& fopts,
+                            training_monitor* monitor = nullptr)
+    {
+        std::vector<std::size_t> order(size);
+        std::iota(order.begin(), order.end(), 0);
+        std::mt19937_64 rng{fopts.deterministic ? fopts.seed
+                                                : std::random_device{}()};
+
+        auto num_threads = fopts.deterministic ? 1 : fopts.num_threads;
+        std::unique_ptr<shared_weights> shared;
+        if (num_threads > 1)
+        {
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+                rescale(o);
+            shared = meta::make_unique<shared_weights>(weights_);
+        }
+
+        std::vector<double> epoch_losses;
+        for (std::size_t iter = 0; iter < fopts.max_iter; ++iter)
+        {
+            epoch_timer timer;
+            std::shuffle(order.begin(), order.end(), rng);
+
+            double epoch_loss = 0;
+            if (num_threads > 1)
+            {
+                // the biases, which every update touches, are kept per
+                // thread and merged once the epoch is done
+                std::mutex merge_mutex;
+                std::vector<double> bias_delta(num_outputs_, 0.0);
+                auto base = num_updates_;
+                parallel_for_blocks(size, num_threads, [&](std::size_t start,
+                                                           std::size_t end) {
+                    std::vector<double> expected(num_outputs_);
+                    std::vector<double> gradient(num_outputs_);
+                    std::vector<double> delta(num_outputs_, 0.0);
+                    double block_loss = 0;
+                    for (auto k = start; k < end; ++k)
+                    {
+                        targets(order[k], expected.data());
+                        block_loss += hogwild_step(
+                            *shared, features(order[k]), expected.data(),
+                            loss, learning_rate(base + k), delta.data(),
+                            gradient.data());
+                    }
+                    std::lock_guard<std::mutex> lock{merge_mutex};
+                    epoch_loss += block_loss;
+                    for (std::size_t o = 0; o < num_outputs_; ++o)
+                        bias_delta[o] += delta[o];
+                });
+                for (std::size_t o = 0; o < num_outputs_; ++o)
+                    bias_[o] += bias_delta[o];
+                shared->copy_to(weights_);
+                num_updates_ += size;
+            }
+            else
+            {
+                std::vector<double> expected(num_outputs_);
+                for (auto idx : order)
+                {
+                    targets(idx, expected.data());
+                    epoch_loss += train_one(features(idx), expected.data(),
+                                            loss);
+                }
+            }
+
+            epoch_loss /= static_cast<double>(std::max<std::size_t>(1, size));
+            epoch_losses.push_back(epoch_loss);
+            if (monitor)
+            {
+                epoch_stats stats;
+                stats.epoch = iter + 1;
+                stats.loss = epoch_loss;
+                timer.finish(stats, size);
+                stats.weight_norm = weight_norm();
+                if (!monitor->record(stats))
+                    break;
+            }
+
+            if (epoch_losses.size() > 1
+                && std::abs(epoch_losses[epoch_losses.size() - 2]
+                            - epoch_loss)
+                       < fopts.gamma)
+                break;
+        }
+
+        if (monitor)
+            monitor->finish();
+        return epoch_losses;
+    }
+
+    /**
+     * Like fit(), but also has the monitor (if any) run evaluator, which
+     * computes the held-out accuracy of the model, after every epoch. The
+     * model is left with the weights of the epoch with the best held-out
+     * accuracy.
+     */
+    template <class Features, class Targets>
+    std::vector<double> fit(std::size_t size, Features&& features,
+                            Targets&& targets,
+                            const meta::learn::loss::loss_function& loss,
+                            const fit_options& fopts,
+                            training_monitor* monitor,
+                            training_monitor::evaluator_type evaluator)
+    {
+        if (!monitor || !evaluator)
+            return fit(size, features, targets, loss, fopts, monitor);
+
+        std::unique_ptr<linear_model> best;
+        monitor->set_evaluator(std::move(evaluator),
+                               [&]() { save_to(best); });
+        auto epoch_losses = fit(size, features, targets, loss, fopts, monitor);
+        monitor->set_evaluator({});
+        if (best && monitor->past_best())
+            *this = std::move(*best);
+        return epoch_losses;
+    }
+
+    /**
+     * @return the L2 norm of the weights of every output together
+     */
+    double weight_norm() const
+    {
+        double total = 0;
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+        {
+            double sum = 0;
+            for (uint64_t f = 0; f < num_features_; ++f)
+            {
+                auto w = weights_[f * num_outputs_ + o];
+                sum += w * w;
+            }
+            total += sum * scale_[o] * scale_[o];
+        }
+        return std::sqrt(total);
+    }
+
+    /**
+     * @return the effective weight of a feature for an output
+     */
+    double weight(uint64_t feature, std::size_t output) const
+    {
+        return weights_[feature * num_outputs_ + output] * scale_[output];
+    }
+
+    double bias(std::size_t output) const
+    {
+        return bias_[output];
+    }
+
+  private:
+    constexpr static double rescale_threshold = 1e-9;
+
+    /**
+     * The weights shared by the threads of a Hogwild epoch. They are read
+     * and written with relaxed atomic operations: a concurrent update of
+     * the same weight may be lost, as Hogwild allows, but no access is a
+     * data race.
+     */
+    class shared_weights
+    {
+      public:
+        explicit shared_weights(const std::vector<double>& weights)
+            : size_{weights.size()},
+              weights_{new std::atomic<double>[weights.size()]}
+        {
+            for (std::size_t i = 0; i < size_; ++i)
+                store(i, weights[i]);
+        }
+
+        double load(std::size_t i) const
+        {
+            return weights_[i].load(std::memory_order_relaxed);
+        }
+
+        void store(std::size_t i, double w)
+        {
+            weights_[i].store(w, std::memory_order_relaxed);
+        }
+
+        void copy_to(std::vector<double>& weights) const
+        {
+            for (std::size_t i = 0; i < size_; ++i)
+                weights[i] = load(i);
+        }
+
+      private:
+        std::size_t size_;
+        std::unique_ptr<std::atomic<double>[]> weights_;
+    };
+
+    /**
+     * The learning rate decays as eta / (1 + eta * lambda * t) when L2
+     * regularization is used, and stays constant otherwise.
+     */
+    double learning_rate(uint64_t num_updates) const
+    {
+        return options_.learning_rate
+               / (1 + options_.learning_rate * options_.l2_regularizer
+                          * static_cast<double>(num_updates));
+    }
+
+    /**
+     * Computes the (learning rate scaled) gradient of the loss with
+     * respect to every output's margin.
+     * @return the summed loss over the outputs
+     */
+    template <class Row>
+    double gradients(const Row& x, const double* expected,
+                     const meta::learn::loss::loss_function& loss, double eta,
+                     double* gradient) const
+    {
+        margins(x, gradient);
+        double total_loss = 0;
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+        {
+            total_loss += loss.loss(gradient[o], expected[o]);
+            gradient[o] = eta * loss.derivative(gradient[o], expected[o]);
+        }
+        return total_loss;
+    }
+
+    /**
+     * Applies a gradient step to the weights of the features of x and to
+     * the biases.
+     */
+    template <class Row>
+    void apply(const Row& x, const double* gradient, double eta)
+    {
+        auto shrink = eta * options_.l1_regularizer;
+        for (const auto& pr : x)
+        {
+            if (pr.first >= num_features_)
+                continue;
+            auto* row = &weights_[pr.first * num_outputs_];
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+            {
+                auto w = row[o] - gradient[o] * pr.second / scale_[o];
+                if (shrink > 0)
+                    w = truncate(w, shrink / scale_[o]);
+                row[o] = w;
+            }
+        }
+
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+            bias_[o] -= gradient[o];
+    }
+
+    /**
+     * Performs one Hogwild update of every output: like train_one(), but
+     * reading and writing the shared weights, applying L2 decay to the
+     * touched weights directly (the scale factors stay 1), and adding the
+     * bias change to this thread's bias_delta rather than to the biases.
+     * @param gradient Scratch space for num_outputs() gradients
+     * @return the summed loss over the outputs before the update
+     */
+    template <class Row>
+    double hogwild_step(shared_weights& weights, const Row& x,
+                        const double* expected,
+                        const meta::learn::loss::loss_function& loss,
+                        double eta, double* bias_delta,
+                        double* gradient) const
+    {
+        std::fill(gradient, gradient + num_outputs_, 0.0);
+        for (const auto& pr : x)
+        {
+            if (pr.first >= num_features_)
+                continue;
+            auto row = pr.first * num_outputs_;
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+                gradient[o] += weights.load(row + o) * pr.second;
+        }
+
+        double total_loss = 0;
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+        {
+            auto margin = gradient[o] + bias_[o] + bias_delta[o];
+            total_loss += loss.loss(margin, expected[o]);
+            gradient[o] = eta * loss.derivative(margin, expected[o]);
+        }
+
+        auto decay = 1 - eta * options_.l2_regularizer;
+        auto shrink = eta * options_.l1_regularizer;
+        for (const auto& pr : x)
+        {
+            if (pr.first >= num_features_)
+                continue;
+            auto row = pr.first * num_outputs_;
+            for (std::size_t o = 0; o < num_outputs_; ++o)
+            {
+                auto w = weights.load(row + o) * decay
+                         - gradient[o] * pr.second;
+                if (shrink > 0)
+                    w = truncate(w, shrink);
+                weights.store(row + o, w);
+            }
+        }
+
+        for (std::size_t o = 0; o < num_outputs_; ++o)
+            bias_delta[o] -= gradient[o];
+        return total_loss;
+    }
+
+    void rescale(std::size_t output)
+    {
+        for (uint64_t f = 0; f < num_features_; ++f)
+            weights_[f * num_outputs_ + output] *= scale_[output];
+        scale_[output] = 1.0;
+    }
+
+    static double truncate(double w, double amount)
+    {
+        if (w > 0)
+            return std::max(0.0, w - amount);
+        return std::min(0.0, w + amount);
+    }
+
+    uint64_t num_features_;
+    std::size_t num_outputs_;
+    options_type options_;
+    std::vector<double> weights_;
+    std::vector<double> scale_;
+    std::vector<double> bias_;
+    uint64_t num_updates_ = 0;
+    std::vector<double> gradient_;
+};
+
+/**
+ * A one-vs-all classifier whose binary subclassifiers are linear models
+ * trained with SGD. All of the subclassifiers share one feature-major
+ * linear_model, so they are trained together and a prediction is a
+ * single pass over the instance's features.
+ */
+class linear_one_vs_all : public meta::classify::classifier
+{
+  public:
+    constexpr static double default_gamma = 1e-3;
+    constexpr static std::size_t default_max_iter = 5;
+
+    /**
+     * @param docs The training data
+     * @param loss The loss function of every binary subclassifier
+     * @param options The SGD options
+     * @param fopts The number of epochs, convergence threshold, and
+     * threading of training
+     * @param monitor If not null, receives the progress of training
+     * @param holdout If not null (and there is a monitor), the held-out
+     * instances used for early stopping
+     */
+    linear_one_vs_all(
+        meta::classify::multiclass_dataset_view docs,
+        std::unique_ptr<meta::learn::loss::loss_function> loss,
+        linear_model::options_type options,
+        const linear_model::fit_options& fopts,
+        training_monitor* monitor = nullptr,
+        const meta::classify::multiclass_dataset_view* holdout = nullptr)
+        : labels_{collect_labels(docs)},
+          model_{docs.total_features(), labels_.size(), options}
+    {
+        std::unordered_map<std::string, std::size_t> ids;
+        for (std::size_t i = 0; i < labels_.size(); ++i)
+            ids[static_cast<std::string>(labels_[i])] = i;
+
+        std::vector<std::size_t> targets;
+        targets.reserve(docs.size());
+        for (const auto& inst : docs)
+            targets.push_back(
+                ids[static_cast<std::string>(docs.label(inst))]);
+
+        training_monitor::evaluator_type evaluator;
+        if (holdout)
+            evaluator = [=]() {
+                return holdout_accuracy(
+                    holdout->size(),
+                    [&](std::size_t i) {
+                        const auto& inst = *(holdout->begin() + i);
+                        return classify(inst.weights) == holdout->label(inst);
+                    },
+                    fopts.num_threads);
+            };
+
+        train(docs.size(),
+              [&](std::size_t idx) -> const meta::learn::feature_vector& {
+                  return (docs.begin() + idx)->weights;
+              },
+              targets, *loss, fopts, monitor, std::move(evaluator));
+    }
+
+    /**
+     * Trains on the rows of a labeled CSR dataset view (such as one of a
+     * memory mapped CSR file), reading each row directly from the CSR
+     * arrays rather than from a feature_vector copy.
+     */
+    template <class FeatureId, class Value>
+    linear_one_vs_all(
+        const csr_dataset_view<FeatureId, Value>& docs,
+        std::unique_ptr<meta::learn::loss::loss_function> loss,
+        linear_model::options_type options,
+        const linear_model::fit_options& fopts,
+        training_monitor* monitor = nullptr,
+        const csr_dataset_view<FeatureId, Value>* holdout = nullptr)
+        : labels_{collect_labels(docs)},
+          model_{docs.total_features(), labels_.size(), options}
+    {
+        std::unordered_map<std::string, std::size_t> ids;
+        for (std::size_t i = 0; i < labels_.size(); ++i)
+            ids[static_cast<std::string>(labels_[i])] = i;
+
+        // the position in labels_ of every label id of the dataset
+        const auto& dset = docs.dataset();
+        std::vector<std::size_t> label_pos(dset.total_labels());
+        for (uint32_t lbl = 0; lbl < label_pos.size(); ++lbl)
+        {
+            auto it = ids.find(dset.label_name(lbl));
+            label_pos[lbl] = it == ids.end() ? labels_.size() : it->second;
+        }
+
+        std::vector<std::size_t> targets(docs.size());
+        for (std::size_t i = 0; i < docs.size(); ++i)
+            targets[i] = label_pos[docs.label_id(i)];
+
+        training_monitor::evaluator_type evaluator;
+        if (holdout)
+            evaluator = [=]() {
+                const auto& held = holdout->dataset();
+                return holdout_accuracy(
+                    holdout->size(),
+                    [&](std::size_t i) {
+                        auto margins = model_.margins((*holdout)[i]);
+                        auto best = std::max_element(margins.begin(),
+                                                     margins.end());
+                        const auto& predicted = static_cast<std::string>(
+                            labels_[best - margins.begin()]);
+                        return predicted
+                               == held.label_name(holdout->label_id(i));
+                    },
+                    fopts.num_threads);
+            };
+
+        train(docs.size(), [&](std::size_t idx) { return docs[idx]; },
+              targets, *loss, fopts, monitor, std::move(evaluator));
+    }
+
+    meta::class_label
+    classify(const meta::learn::feature_vector& instance) const override
+    {
+        auto margins = model_.margins(instance);
+        auto best = std::max_element(margins.begin(), margins.end());
+        return labels_[static_cast<std::size_t>(best - margins.begin())];
+    }
+
+    /**
+     * @return the margin of each label's subclassifier, in the order of
+     * labels()
+     */
+    std::vector<double>
+    margins(const meta::learn::feature_vector& instance) const
+    {
+        return model_.margins(instance);
+    }
+
+    const std::vector<meta::class_label>& labels() const
+    {
+        return labels_;
+    }
+
+    const linear_model& model() const
+    {
+        return model_;
+    }
+
+    /**
+     * @return the average training loss of each epoch
+     */
+    const std::vector<double>& epoch_losses() const
+    {
+        return epoch_losses_;
+    }
+
+    /**
+     * This is saved as a model file (see metapy_model_file.h) rather than
+     * to a stream.
+     */
+    void save(std::ostream& /* os */) const override
+    {
+        throw_unsaveable("one-vs-all linear classifiers",
+                         "save a mapped model file instead");
+    }
+
+  private:
+    static std::vector<meta::class_label>
+    collect_labels(const meta::classify::multiclass_dataset_view& docs)
+    {
+        std::vector<meta::class_label> labels;
+        for (const auto& inst : docs)
+            labels.push_back(docs.label(inst));
+        std::sort(labels.begin(), labels.end());
+        labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+        return labels;
+    }
+
+    template <class FeatureId, class Value>
+    static std::vector<meta::class_label>
+    collect_labels(const csr_dataset_view<FeatureId, Value>& docs)
+    {
+        const auto& dset = docs.dataset();
+        if (!dset.has_labels())
+            throw std::invalid_argument{"dataset has no labels"};
+
+        std::vector<bool> present(dset.total_labels(), false);
+        for (std::size_t i = 0; i < docs.size(); ++i)
+            present[docs.label_id(i)] = true;
+
+        std::vector<meta::class_label> labels;
+        for (uint32_t lbl = 0; lbl < present.size(); ++lbl)
+            if (present[lbl])
+                labels.emplace_back(dset.label_name(lbl));
+        std::sort(labels.begin(), labels.end());
+        return labels;
+    }
+
+    /**
+     * Trains the model on size instances, where features(i) is instance
+     * i and targets[i] the position of its label in labels_.
+     */
+    template <class Features>
+    void train(std::size_t size, Features&& features,
+               const std::vector<std::size_t>& targets,
+               const meta::learn::loss::loss_function& loss,
+               const linear_model::fit_options& fopts,
+               training_monitor* monitor,
+               training_monitor::evaluator_type evaluator)
+    {
+        auto num_labels = labels_.size();
+        epoch_losses_ = model_.fit(
+            size, features,
+            [&](std::size_t idx, double* expected) {
+                std::fill(expected, expected + num_labels, -1.0);
+                expected[targets[idx]] = 1.0;
+            },
+            loss, fopts, monitor, std::move(evaluator));
+    }
+
+    std::vector<meta::class_label> labels_;
+    linear_model model_;
+    std::vector<double> epoch_losses_;
+};
+
+/**
+ * A binary classifier that is a single-output linear_model trained with
+ * SGD; unlike classify::sgd, it can be trained with several threads.
+ */
+class linear_sgd : public meta::classify::binary_classifier
+{
+  public:
+    /**
+     * @param docs The training data
+     * @param loss The loss function
+     * @param options The SGD options
+     * @param fopts The number of epochs, convergence threshold, and
+     * threading of training
+     * @param monitor If not null, receives the progress of training
+     * @param holdout If not null (and there is a monitor), the held-out
+     * instances used for early stopping
+     */
+    linear_sgd(meta::classify::binary_dataset_view docs,
+               std::unique_ptr<meta::learn::loss::loss_function> loss,
+               linear_model::options_type options,
+               const linear_model::fit_options& fopts,
+               training_monitor* monitor = nullptr,
+               const meta::classify::binary_dataset_view* holdout = nullptr)
+        : model_{docs.total_features(), 1, options}
+    {
+        training_monitor::evaluator_type evaluator;
+        if (holdout)
+            evaluator = [=]() {
+                return holdout_accuracy(
+                    holdout->size(),
+                    [&](std::size_t i) {
+                        const auto& inst = *(holdout->begin() + i);
+                        return (predict(inst.weights) > 0)
+                               == holdout->label(inst);
+                    },
+                    fopts.num_threads);
+            };
+
+        epoch_losses_ = model_.fit(
+            docs.size(),
+            [&](std::size_t idx) -> const meta::learn::feature_vector& {
+                return (docs.begin() + idx)->weights;
+            },
+            [&](std::size_t idx, double* expected) {
+                *expected = docs.label(*(docs.begin() + idx)) ? 1.0 : -1.0;
+            },
+            *loss, fopts, monitor, std::move(evaluator));
+    }
+
+    /**
+     * Trains on the rows of a CSR dataset view with exactly two labels
+     * (such as one of a memory mapped CSR file), reading each row
+     * directly from the CSR arrays rather than from a feature_vector
+     * copy. The label whose name sorts last is the positive one, as in
+     * csr_dataset::to_binary_dataset().
+     */
+    template <class FeatureId, class Value>
+    linear_sgd(const csr_dataset_view<FeatureId, Value>& docs,
+               std::unique_ptr<meta::learn::loss::loss_function> loss,
+               linear_model::options_type options,
+               const linear_model::fit_options& fopts,
+               training_monitor* monitor = nullptr,
+               const csr_dataset_view<FeatureId, Value>* holdout = nullptr)
+        : model_{docs.total_features(), 1, options}
+    {
+        auto positive = docs.dataset().positive_label_id();
+
+        training_monitor::evaluator_type evaluator;
+        if (holdout)
+        {
+            auto held_positive = holdout->dataset().positive_label_id();
+            evaluator = [=]() {
+                return holdout_accuracy(
+                    holdout->size(),
+                    [&](std::size_t i) {
+                        double margin;
+                        model_.margins((*holdout)[i], &margin);
+                        return (margin > 0)
+                               == (holdout->label_id(i) == held_positive);
+                    },
+                    fopts.num_threads);
+            };
+        }
+
+        epoch_losses_ = model_.fit(
+            docs.size(), [&](std::size_t idx) { return docs[idx]; },
+            [&](std::size_t idx, double* expected) {
+                *expected = docs.label_id(idx) == positive ? 1.0 : -1.0;
+            },
+            *loss, fopts, monitor, std::move(evaluator));
+    }
+
+    double predict(const meta::learn::feature_vector& instance) const override
+    {
+        double margin;
+        model_.margins(instance, &margin);
+        return margin;
+    }
+
+    const linear_model& model() const
+    {
+        return model_;
+    }
+
+    /**
+     * @return the average training loss of each epoch
+     */
+    const std::vector<double>& epoch_losses() const
+    {
+        return epoch_losses_;
+    }
+
+    /**
+     * Like linear_one_vs_all, this is saved as a model file rather than
+     * to a stream.
+     */
+    void save(std::ostream& /* os */) const override
+    {
+        throw_unsaveable("linear SGD classifiers",
+                         "save a mapped model file instead");
+    }
+
+  private:
+    linear_model model_;
+    std::vector<double> epoch_losses_;
+};
+
+#endif
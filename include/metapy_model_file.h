@@ -0,0 +1,381 @@
+/**
+ * @file metapy_model_file.h
+ * @author Chase Geigle
+ *
+ * A binary format for linear classifiers whose weights are stored as one
+ * contiguous table, so that a model can be memory mapped and used
+ * directly instead of being parsed. Processes that map the same file
+ * share a single copy of the weights through the page cache.
+ */
+
+#ifndef METAPY_MODEL_FILE_H_
+#define METAPY_MODEL_FILE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "meta/classify/classifier/binary_classifier.h"
+#include "meta/classify/classifier/classifier.h"
+#include "meta/io/mmap_file.h"
+
+/**
+ * Exception thrown for malformed or unreadable model files.
+ */
+class model_file_exception : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * The fixed-size header at the start of every model file. The file is
+ * written in the machine's native byte order; every section starts on an
+ * 8-byte boundary. The sections, in order, are: the weight table
+ * (num_features * num_outputs values, feature-major), the bias of each
+ * output (doubles), the weight of each output for features past the end
+ * of the table (doubles), and the label of each output (each a uint64_t
+ * length followed by that many bytes).
+ *
+ * A model scores an instance x for output o as
+ *     bias[o] + sum over (f, v) in x of v * weight(f, o),
+ * and classifies it as the label of the best output (or, for a binary
+ * model with a single output, as positive if the score is positive).
+ */
+struct model_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t value_bytes;
+    uint32_t binary;
+    uint32_t padding;
+    uint64_t num_features;
+    uint64_t num_outputs;
+    uint64_t weights_offset;
+    uint64_t bias_offset;
+    uint64_t unseen_offset;
+    uint64_t names_offset;
+
+    static constexpr const char* magic_string = "METAMDL";
+    static constexpr uint32_t current_version = 1;
+};
+
+/**
+ * The contents of a linear model to be written to a model file.
+ */
+struct model_file_contents
+{
+    uint64_t num_features = 0;
+    std::vector<double> bias;
+    /// the weight of each output for features >= num_features
+    std::vector<double> unseen;
+    std::vector<std::string> labels;
+    bool binary = false;
+};
+
+/**
+ * Writes a model file, storing weights as Value (float or double).
+ * @param weight weight(f, out) fills out with the weights of feature f
+ * for every output
+ */
+template <class Value, class WeightFunction>
+void write_model_file(const std::string& path,
+                      const model_file_contents& contents,
+                      WeightFunction&& weight)
+{
+    auto num_outputs = contents.bias.size();
+    if (num_outputs == 0)
+        throw model_file_exception{"cannot save a model with no outputs"};
+    if (contents.unseen.size() != num_outputs
+        || contents.labels.size() != num_outputs
+        || (contents.binary && num_outputs != 1))
+        throw model_file_exception{"inconsistent model contents"};
+
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (!out)
+        throw model_file_exception{"cannot create model file: " + path};
+
+    auto pad = [&]() {
+        static const char zeros[8] = {};
+        if (auto rem = static_cast<uint64_t>(out.tellp()) % 8)
+            out.write(zeros, static_cast<std::streamsize>(8 - rem));
+    };
+    auto write_array = [&](const void* data, std::size_t bytes) {
+        out.write(reinterpret_cast<const char*>(data),
+                  static_cast<std::streamsize>(bytes));
+    };
+
+    model_file_header hdr{};
+    std::memcpy(hdr.magic, model_file_header::magic_string, 8);
+    hdr.version = model_file_header::current_version;
+    hdr.value_bytes = sizeof(Value);
+    hdr.binary = contents.binary;
+    hdr.num_features = contents.num_features;
+    hdr.num_outputs = num_outputs;
+    write_array(&hdr, sizeof(hdr));
+
+    hdr.weights_offset = static_cast<uint64_t>(out.tellp());
+    std::vector<double> row(num_outputs);
+    std::vector<Value> converted(num_outputs);
+    for (uint64_t f = 0; f < contents.num_features; ++f)
+    {
+        weight(f, row.data());
+        std::copy(row.begin(), row.end(), converted.begin());
+        write_array(converted.data(), sizeof(Value) * num_outputs);
+    }
+    pad();
+
+    hdr.bias_offset = static_cast<uint64_t>(out.tellp());
+    write_array(contents.bias.data(), sizeof(double) * num_outputs);
+    hdr.unseen_offset = static_cast<uint64_t>(out.tellp());
+    write_array(contents.unseen.data(), sizeof(double) * num_outputs);
+
+    hdr.names_offset = static_cast<uint64_t>(out.tellp());
+    for (const auto& name : contents.labels)
+    {
+        uint64_t len = name.size();
+        write_array(&len, sizeof(len));
+        write_array(name.data(), len);
+    }
+
+    out.seekp(0);
+    write_array(&hdr, sizeof(hdr));
+    out.close();
+    if (!out)
+        throw model_file_exception{"failed writing model file: " + path};
+}
+
+/**
+ * A linear model read from a memory-mapped model file. Only the labels
+ * are copied out of the file; the weights are read in place.
+ */
+class mapped_linear_model
+{
+  public:
+    explicit mapped_linear_model(const std::string& path)
+        : file_{std::make_shared<meta::io::mmap_file>(path)}
+    {
+        if (file_->size() < sizeof(model_file_header))
+            throw model_file_exception{"not a model file: " + path};
+
+        std::memcpy(&hdr_, file_->begin(), sizeof(hdr_));
+        if (std::memcmp(hdr_.magic, model_file_header::magic_string, 8) != 0)
+            throw model_file_exception{"not a model file: " + path};
+        if (hdr_.version != model_file_header::current_version)
+            throw model_file_exception{"unsupported model file version: "
+                                       + path};
+        if (hdr_.value_bytes != sizeof(float)
+            && hdr_.value_bytes != sizeof(double))
+            throw model_file_exception{"corrupt model file: " + path};
+
+        if (hdr_.num_outputs == 0 || (hdr_.binary && hdr_.num_outputs != 1))
+            throw model_file_exception{"corrupt model file: " + path};
+        if (hdr_.weights_offset % 8 != 0 || hdr_.bias_offset % 8 != 0
+            || hdr_.unseen_offset % 8 != 0)
+            throw model_file_exception{"misaligned model file: " + path};
+
+        // the bias and unseen sections bound num_outputs by the file size
+        // (whatever num_features is), and every label takes at least its
+        // 8-byte length, so nothing below is sized by an unchecked count
+        uint64_t end = file_->size();
+        if (!fits(hdr_.bias_offset, hdr_.num_outputs, sizeof(double), end)
+            || !fits(hdr_.unseen_offset, hdr_.num_outputs, sizeof(double),
+                     end)
+            || !fits(hdr_.names_offset, hdr_.num_outputs, sizeof(uint64_t),
+                     end)
+            || !fits(hdr_.weights_offset, hdr_.num_features,
+                     hdr_.num_outputs * hdr_.value_bytes, end))
+            throw model_file_exception{"truncated model file: " + path};
+
+        labels_.reserve(hdr_.num_outputs);
+        auto pos = hdr_.names_offset;
+        for (uint64_t i = 0; i < hdr_.num_outputs; ++i)
+        {
+            uint64_t len;
+            if (end - pos < sizeof(len))
+                throw model_file_exception{"truncated model file: " + path};
+            std::memcpy(&len, file_->begin() + pos, sizeof(len));
+            pos += sizeof(len);
+            if (len > end - pos)
+                throw model_file_exception{"truncated model file: " + path};
+            labels_.emplace_back(file_->begin() + pos, len);
+            pos += len;
+        }
+    }
+
+    /**
+     * Computes the score of every output for an instance.
+     * @param out Receives num_outputs() scores
+     */
+    void margins(const meta::learn::feature_vector& x, double* out) const
+    {
+        if (hdr_.value_bytes == sizeof(float))
+            margins(x, at<float>(hdr_.weights_offset), out);
+        else
+            margins(x, at<double>(hdr_.weights_offset), out);
+    }
+
+    std::vector<double> margins(const meta::learn::feature_vector& x) const
+    {
+        std::vector<double> out(num_outputs());
+        margins(x, out.data());
+        return out;
+    }
+
+    uint64_t num_features() const
+    {
+        return hdr_.num_features;
+    }
+
+    std::size_t num_outputs() const
+    {
+        return hdr_.num_outputs;
+    }
+
+    bool binary() const
+    {
+        return hdr_.binary != 0;
+    }
+
+    /**
+     * @return whether the weights are stored in single precision
+     */
+    bool single_precision() const
+    {
+        return hdr_.value_bytes == sizeof(float);
+    }
+
+    const std::vector<std::string>& labels() const
+    {
+        return labels_;
+    }
+
+    std::string path() const
+    {
+        return file_->path();
+    }
+
+  private:
+    /**
+     * @return whether count elements of the given size, starting at
+     * offset, end by end (without overflowing)
+     */
+    static bool fits(uint64_t offset, uint64_t count, uint64_t size,
+                     uint64_t end)
+    {
+        return offset <= end && count <= (end - offset) / size;
+    }
+
+    template <class Value>
+    void margins(const meta::learn::feature_vector& x, const Value* weights,
+                 double* out) const
+    {
+        auto num_outputs = hdr_.num_outputs;
+        const auto* bias = at<double>(hdr_.bias_offset);
+        const auto* unseen = at<double>(hdr_.unseen_offset);
+        std::copy(bias, bias + num_outputs, out);
+        for (const auto& pr : x)
+        {
+            if (pr.first >= hdr_.num_features)
+            {
+                for (std::size_t o = 0; o < num_outputs; ++o)
+                    out[o] += unseen[o] * pr.second;
+                continue;
+            }
+            const auto* row = weights + pr.first * num_outputs;
+            for (std::size_t o = 0; o < num_outputs; ++o)
+                out[o] += row[o] * pr.second;
+        }
+    }
+
+    template <class T>
+    const T* at(uint64_t offset) const
+    {
+        return reinterpret_cast<const T*>(file_->begin() + offset);
+    }
+
+    std::shared_ptr<meta::io::mmap_file> file_;
+    model_file_header hdr_;
+    std::vector<std::string> labels_;
+};
+
+/**
+ * A multiclass classifier backed by a mapped model file: an instance gets
+ * the label of its highest scoring output.
+ */
+class mapped_linear_classifier : public meta::classify::classifier
+{
+  public:
+    explicit mapped_linear_classifier(mapped_linear_model model)
+        : model_{std::move(model)}
+    {
+        // nothing
+    }
+
+    meta::class_label
+    classify(const meta::learn::feature_vector& instance) const override
+    {
+        auto margins = model_.margins(instance);
+        auto best = std::max_element(margins.begin(), margins.end());
+        return meta::class_label{
+            model_.labels()[static_cast<std::size_t>(best - margins.begin())]};
+    }
+
+    const mapped_linear_model& model() const
+    {
+        return model_;
+    }
+
+    void save(std::ostream& /* os */) const override
+    {
+        throw model_file_exception{
+            "mapped models are already saved; copy the model file instead"};
+    }
+
+  private:
+    mapped_linear_model model_;
+};
+
+/**
+ * A binary classifier backed by a mapped model file with a single output.
+ */
+class mapped_linear_binary_classifier
+    : public meta::classify::binary_classifier
+{
+  public:
+    explicit mapped_linear_binary_classifier(mapped_linear_model model)
+        : model_{std::move(model)}
+    {
+        if (!model_.binary())
+            throw model_file_exception{"not a binary model: "
+                                       + model_.path()};
+    }
+
+    double predict(const meta::learn::feature_vector& instance) const override
+    {
+        double margin;
+        model_.margins(instance, &margin);
+        return margin;
+    }
+
+    const mapped_linear_model& model() const
+    {
+        return model_;
+    }
+
+    void save(std::ostream& /* os */) const override
+    {
+        throw model_file_exception{
+            "mapped models are already saved; copy the model file instead"};
+    }
+
+  private:
+    mapped_linear_model model_;
+};
+
+#endif
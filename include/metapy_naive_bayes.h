@@ -0,0 +1,303 @@
+/**
+ * @file metapy_naive_bayes.h
+ * @author Chase Geigle
+ *
+ * A multinomial naive Bayes classifier that can be trained incrementally
+ * and merged with models trained elsewhere.
+ */
+
+#ifndef METAPY_NAIVE_BAYES_H_
+#define METAPY_NAIVE_BAYES_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "meta/classify/classifier/naive_bayes.h"
+#include "meta/classify/classifier/online_classifier.h"
+#include "meta/classify/multiclass_dataset_view.h"
+#include "meta/io/packed.h"
+#include "meta/util/string_view.h"
+#include "metapy_parallel.h"
+
+/**
+ * Multinomial naive Bayes with the same additive smoothing as MeTA's
+ * naive_bayes: alpha for the term distribution of each class and beta
+ * for the class distribution.
+ *
+ * The model is nothing but counts, so training on new instances simply
+ * adds to them, and two models trained on different instances can be
+ * combined by adding their counts together with merge(). Training on a
+ * view with several threads builds one set of counts per thread and
+ * merges them.
+ *
+ * Saving writes every count, so a loaded model can keep training or be
+ * merged just like the original; metapy registers the loader for its id
+ * with MeTA's classifier_loader.
+ */
+class online_naive_bayes : public meta::classify::online_classifier
+{
+  public:
+    constexpr static double default_alpha
+        = meta::classify::naive_bayes::default_alpha;
+    constexpr static double default_beta
+        = meta::classify::naive_bayes::default_beta;
+
+    /**
+     * The identifier for this classifier.
+     */
+    const static meta::util::string_view id;
+
+    online_naive_bayes(double alpha, double beta) : alpha_{alpha}, beta_{beta}
+    {
+        if (alpha <= 0 || beta <= 0)
+            throw std::invalid_argument{"alpha and beta must be positive"};
+    }
+
+    /**
+     * Loads a model written by save(), from just after its id.
+     */
+    explicit online_naive_bayes(std::istream& in)
+    {
+        namespace packed = meta::io::packed;
+        uint64_t num_labels;
+        packed::read(in, alpha_);
+        packed::read(in, beta_);
+        packed::read(in, total_docs_);
+        packed::read(in, total_features_);
+        packed::read(in, num_labels);
+        for (uint64_t l = 0; in && l < num_labels; ++l)
+        {
+            std::string label;
+            uint64_t num_terms;
+            packed::read(in, label);
+            auto& counts = label_counts(label);
+            packed::read(in, counts.docs);
+            packed::read(in, counts.total);
+            packed::read(in, num_terms);
+            for (uint64_t t = 0; in && t < num_terms; ++t)
+            {
+                uint64_t feature;
+                double count;
+                packed::read(in, feature);
+                packed::read(in, count);
+                counts.terms[feature] = count;
+            }
+        }
+
+        if (!in || alpha_ <= 0 || beta_ <= 0)
+            throw meta::classify::classifier_exception{
+                "malformed online naive Bayes model"};
+    }
+
+    void train(meta::classify::multiclass_dataset_view docs) override
+    {
+        train(std::move(docs), 1);
+    }
+
+    /**
+     * Adds the counts of every instance of a view, using num_threads
+     * threads.
+     */
+    void train(meta::classify::multiclass_dataset_view docs,
+               std::size_t num_threads)
+    {
+        num_threads = std::max<std::size_t>(
+            1, std::min<std::size_t>(num_threads, docs.size()));
+        std::vector<online_naive_bayes> shards(num_threads, {alpha_, beta_});
+
+        auto block_size = (docs.size() + num_threads - 1) / num_threads;
+        parallel_for_blocks(
+            num_threads, num_threads,
+            [&](std::size_t first_shard, std::size_t last_shard) {
+                for (auto s = first_shard; s < last_shard; ++s)
+                {
+                    auto start = std::min(s * block_size, docs.size());
+                    auto end = std::min(start + block_size, docs.size());
+                    for (auto it = docs.begin() + start;
+                         it != docs.begin() + end; ++it)
+                        shards[s].train_one(it->weights, docs.label(*it));
+                }
+            });
+
+        // merge in order, so labels are numbered as in sequential training
+        for (const auto& shard : shards)
+            merge(shard);
+        total_features_ = std::max(total_features_, docs.total_features());
+    }
+
+    void train_one(const meta::learn::feature_vector& doc,
+                   const meta::class_label& label) override
+    {
+        auto& counts = label_counts(static_cast<std::string>(label));
+        counts.docs += 1;
+        for (const auto& pr : doc)
+        {
+            counts.terms[pr.first] += pr.second;
+            counts.total += pr.second;
+            total_features_ = std::max<uint64_t>(total_features_,
+                                                 pr.first + 1);
+        }
+        total_docs_ += 1;
+    }
+
+    /**
+     * Adds the counts of another model to this one. Both models must use
+     * the same smoothing parameters.
+     */
+    void merge(const online_naive_bayes& other)
+    {
+        if (other.alpha_ != alpha_ || other.beta_ != beta_)
+            throw std::invalid_argument{
+                "cannot merge models with different smoothing parameters"};
+
+        for (std::size_t l = 0; l < other.labels_.size(); ++l)
+        {
+            const auto& theirs = other.counts_[l];
+            auto& ours = label_counts(other.labels_[l]);
+            ours.docs += theirs.docs;
+            ours.total += theirs.total;
+            for (const auto& pr : theirs.terms)
+                ours.terms[pr.first] += pr.second;
+        }
+        total_docs_ += other.total_docs_;
+        total_features_ = std::max(total_features_, other.total_features_);
+    }
+
+    meta::class_label
+    classify(const meta::learn::feature_vector& doc) const override
+    {
+        if (labels_.empty())
+            return meta::class_label{"[none]"};
+
+        auto best = std::numeric_limits<double>::lowest();
+        std::size_t best_label = 0;
+        for (std::size_t l = 0; l < labels_.size(); ++l)
+        {
+            auto score = log_prior(l);
+            for (const auto& pr : doc)
+                score += pr.second * log_term_probability(l, pr.first);
+
+            if (score > best)
+            {
+                best = score;
+                best_label = l;
+            }
+        }
+        return meta::class_label{labels_[best_label]};
+    }
+
+    /**
+     * @return the smoothed log probability of the label with the given
+     * index (an index into labels())
+     */
+    double log_prior(std::size_t label) const
+    {
+        return std::log((counts_[label].docs + beta_)
+                        / (total_docs_ + beta_ * labels_.size()));
+    }
+
+    /**
+     * @return the smoothed log probability of a feature given the label
+     * with the given index
+     */
+    double log_term_probability(std::size_t label, uint64_t feature) const
+    {
+        const auto& counts = counts_[label];
+        auto it = counts.terms.find(feature);
+        auto count = it == counts.terms.end() ? 0.0 : it->second;
+        return std::log((count + alpha_)
+                        / (counts.total + alpha_ * total_features_));
+    }
+
+    /**
+     * @return one more than the largest feature id seen (or the feature
+     * count of the largest training view)
+     */
+    uint64_t total_features() const
+    {
+        return total_features_;
+    }
+
+    /**
+     * @return the number of training instances seen
+     */
+    double num_docs() const
+    {
+        return total_docs_;
+    }
+
+    const std::vector<std::string>& labels() const
+    {
+        return labels_;
+    }
+
+    /**
+     * Writes the id and every count; the terms of each label are written
+     * in feature order, so equal models are saved identically.
+     */
+    void save(std::ostream& os) const override
+    {
+        namespace packed = meta::io::packed;
+        packed::write(os, id);
+        packed::write(os, alpha_);
+        packed::write(os, beta_);
+        packed::write(os, total_docs_);
+        packed::write(os, total_features_);
+        packed::write(os, static_cast<uint64_t>(labels_.size()));
+        for (std::size_t l = 0; l < labels_.size(); ++l)
+        {
+            const auto& counts = counts_[l];
+            packed::write(os, labels_[l]);
+            packed::write(os, counts.docs);
+            packed::write(os, counts.total);
+
+            std::vector<std::pair<uint64_t, double>> terms(
+                counts.terms.begin(), counts.terms.end());
+            std::sort(terms.begin(), terms.end());
+            packed::write(os, static_cast<uint64_t>(terms.size()));
+            for (const auto& pr : terms)
+            {
+                packed::write(os, pr.first);
+                packed::write(os, pr.second);
+            }
+        }
+    }
+
+  private:
+    struct class_counts
+    {
+        double docs = 0;
+        double total = 0;
+        std::unordered_map<uint64_t, double> terms;
+    };
+
+    class_counts& label_counts(const std::string& label)
+    {
+        auto it = label_ids_.find(label);
+        if (it == label_ids_.end())
+        {
+            it = label_ids_.emplace(label, labels_.size()).first;
+            labels_.push_back(label);
+            counts_.emplace_back();
+        }
+        return counts_[it->second];
+    }
+
+    double alpha_;
+    double beta_;
+    double total_docs_ = 0;
+    uint64_t total_features_ = 0;
+
+    std::vector<std::string> labels_;
+    std::unordered_map<std::string, std::size_t> label_ids_;
+    std::vector<class_counts> counts_;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ * @file metapy_parallel.h
+ * @author Chase Geigle
+ *
+ * Helpers for running native batch operations across several threads.
+ */
+
+#ifndef METAPY_PARALLEL_H_
+#define METAPY_PARALLEL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <vector>
+
+#include "meta/parallel/thread_pool.h"
+
+/**
+ * Splits [0, size) into at most num_threads contiguous blocks and invokes
+ * fn(start, end) for each block on a thread pool, returning once every
+ * block is done. Exceptions thrown by fn are rethrown here. With a single
+ * block, fn is called on the calling thread.
+ *
+ * fn must not touch Python objects unless it acquires the GIL itself, and
+ * callers should release the GIL before calling this.
+ */
+template <class Function>
+void parallel_for_blocks(std::size_t size, std::size_t num_threads,
+                         Function&& fn)
+{
+    num_threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(num_threads, size));
+    if (num_threads == 1)
+    {
+        fn(std::size_t{0}, size);
+        return;
+    }
+
+    meta::parallel::thread_pool pool{num_threads};
+    std::vector<std::future<void>> futures;
+    futures.reserve(num_threads);
+
+    auto block_size = (size + num_threads - 1) / num_threads;
+    for (std::size_t start = 0; start < size; start += block_size)
+    {
+        auto end = std::min(start + block_size, size);
+        futures.push_back(
+            pool.submit_task([&fn, start, end]() { fn(start, end); }));
+    }
+
+    for (auto& fut : futures)
+        fut.get();
+}
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * @file metapy_progress.h
+ * @author Chase Geigle
+ *
+ * Per-epoch progress reporting and early stopping for iterative learners.
+ */
+
+#ifndef METAPY_PROGRESS_H_
+#define METAPY_PROGRESS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "metapy_parallel.h"
+
+/**
+ * What a learner reports at the end of each epoch.
+ */
+struct epoch_stats
+{
+    /// the epoch number, starting at 1
+    std::size_t epoch = 0;
+    /// the learner's training objective for the epoch (e.g. average loss)
+    double loss = 0;
+    /// the time taken by the epoch, in seconds
+    double seconds = 0;
+    double examples_per_second = 0;
+    /// the L2 norm of the learner's weights
+    double weight_norm = 0;
+    /// the accuracy on the held-out set, or NaN if there is none
+    double holdout_accuracy = std::numeric_limits<double>::quiet_NaN();
+};
+
+/**
+ * Collects the epoch_stats of a training run and decides when to stop it
+ * early.
+ *
+ * Reports are buffered and handed to the sink in batches, no more often
+ * than once every min_interval seconds (and once more when training
+ * ends), so a sink that has to acquire the GIL does not slow training
+ * down. The sink is called on the training thread; it may return false to
+ * stop training.
+ *
+ * If the learner installs an evaluator (which computes the accuracy on a
+ * held-out set), it is run after every epoch, and training stops once the
+ * held-out accuracy has not improved for patience epochs in a row
+ * (patience 0 never stops). The learner may also install a checkpoint,
+ * which is called whenever the held-out accuracy improves so that it can
+ * save its weights; if past_best() is true once training ends, it
+ * restores the weights saved at best_epoch().
+ */
+class training_monitor
+{
+  public:
+    using sink_type = std::function<bool(const std::vector<epoch_stats>&)>;
+    using evaluator_type = std::function<double()>;
+    using checkpoint_type = std::function<void()>;
+
+    training_monitor() = default;
+
+    training_monitor(sink_type sink, double min_interval, std::size_t patience)
+        : sink_{std::move(sink)},
+          min_interval_{min_interval},
+          patience_{patience}
+    {
+        // nothing
+    }
+
+    /**
+     * Installs (or, given an empty function, removes) the held-out
+     * evaluator and the checkpoint that saves the learner's weights when
+     * the held-out accuracy improves. Learners install them only for the
+     * duration of training.
+     */
+    void set_evaluator(evaluator_type evaluator,
+                       checkpoint_type checkpoint = {})
+    {
+        evaluator_ = std::move(evaluator);
+        checkpoint_ = std::move(checkpoint);
+    }
+
+    /**
+     * Records the stats of an epoch, evaluating the held-out set if there
+     * is one.
+     * @return whether training should continue
+     */
+    bool record(epoch_stats stats)
+    {
+        bool proceed = true;
+        if (evaluator_)
+        {
+            stats.holdout_accuracy = evaluator_();
+            if (best_epoch_ == 0 || stats.holdout_accuracy > best_accuracy_)
+            {
+                best_accuracy_ = stats.holdout_accuracy;
+                best_epoch_ = stats.epoch;
+                if (checkpoint_)
+                    checkpoint_();
+            }
+            else if (patience_ > 0 && stats.epoch - best_epoch_ >= patience_)
+            {
+                proceed = false;
+                stopped_early_ = true;
+            }
+        }
+
+        history_.push_back(stats);
+        pending_.push_back(stats);
+
+        auto now = clock::now();
+        if (!proceed
+            || std::chrono::duration<double>(now - last_delivery_).count()
+                   >= min_interval_)
+        {
+            if (!deliver())
+            {
+                proceed = false;
+                stopped_early_ = true;
+            }
+            last_delivery_ = now;
+        }
+        return proceed;
+    }
+
+    /**
+     * Delivers any buffered reports. Learners call this when training
+     * ends.
+     */
+    void finish()
+    {
+        deliver();
+    }
+
+    const std::vector<epoch_stats>& history() const
+    {
+        return history_;
+    }
+
+    /**
+     * @return the epoch with the best held-out accuracy, or 0 if there is
+     * no held-out set
+     */
+    std::size_t best_epoch() const
+    {
+        return best_epoch_;
+    }
+
+    bool stopped_early() const
+    {
+        return stopped_early_;
+    }
+
+    /**
+     * @return whether an epoch after best_epoch() was recorded, in which
+     * case the learner should restore the weights it checkpointed then
+     */
+    bool past_best() const
+    {
+        return best_epoch_ > 0 && !history_.empty()
+               && history_.back().epoch != best_epoch_;
+    }
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    bool deliver()
+    {
+        if (pending_.empty())
+            return true;
+
+        std::vector<epoch_stats> batch;
+        batch.swap(pending_);
+        return !sink_ || sink_(batch);
+    }
+
+    sink_type sink_;
+    double min_interval_ = 0;
+    std::size_t patience_ = 0;
+    evaluator_type evaluator_;
+    checkpoint_type checkpoint_;
+
+    std::vector<epoch_stats> history_;
+    std::vector<epoch_stats> pending_;
+    clock::time_point last_delivery_ = clock::now();
+    double best_accuracy_ = 0;
+    std::size_t best_epoch_ = 0;
+    bool stopped_early_ = false;
+};
+
+/**
+ * Measures the time an epoch takes, for filling in epoch_stats.
+ */
+class epoch_timer
+{
+  public:
+    epoch_timer() : start_{std::chrono::steady_clock::now()}
+    {
+        // nothing
+    }
+
+    /**
+     * Fills in the timing of an epoch that processed num_examples
+     * instances.
+     */
+    void finish(epoch_stats& stats, std::size_t num_examples) const
+    {
+        stats.seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count();
+        stats.examples_per_second
+            = stats.seconds > 0 ? num_examples / stats.seconds : 0.0;
+    }
+
+  private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * Computes the fraction of size held-out instances for which correct(i)
+ * is true, using num_threads threads.
+ */
+template <class Predicate>
+double holdout_accuracy(std::size_t size, Predicate&& correct,
+                        std::size_t num_threads)
+{
+    if (size == 0)
+        return 0;
+
+    std::atomic<std::size_t> num_correct{0};
+    parallel_for_blocks(size, num_threads, [&](std::size_t start,
+                                               std::size_t end) {
+        std::size_t block_correct = 0;
+        for (auto i = start; i < end; ++i)
+            if (correct(i))
+                ++block_correct;
+        num_correct += block_correct;
+    });
+    return static_cast<double>(num_correct) / size;
+}
+
+#endif
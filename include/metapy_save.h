@@ -0,0 +1,30 @@
+/**
+ * @file metapy_save.h
+ * @author Chase Geigle
+ *
+ * Saving for the classifiers that metapy adds to MeTA's.
+ */
+
+#ifndef METAPY_SAVE_H_
+#define METAPY_SAVE_H_
+
+#include <stdexcept>
+#include <string>
+
+/**
+ * MeTA reads a saved classifier back through the loader registered for
+ * the id at the start of the stream. A classifier with no such loader
+ * must not write a stream that nothing can read, so its save() calls
+ * this instead.
+ *
+ * @param classifiers What the classifier is (in the plural)
+ * @param instead How such a model can be kept instead
+ */
+[[noreturn]] inline void throw_unsaveable(const std::string& classifiers,
+                                          const std::string& instead)
+{
+    throw std::runtime_error{classifiers + " cannot be saved to a stream; "
+                             + instead};
+}
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file metapy_simd.h
+ * @author Chase Geigle
+ *
+ * Vectorized kernels for sparse feature vectors, dispatched at runtime to
+ * the best instruction set the CPU supports.
+ */
+
+#ifndef METAPY_SIMD_H_
+#define METAPY_SIMD_H_
+
+#include <cstdint>
+#include <string>
+
+#include "meta/learn/instance.h"
+
+namespace simd
+{
+
+/**
+ * The instruction sets the kernels are specialized for. generic is
+ * portable C++ (which the compiler may still vectorize for the baseline
+ * target, e.g. SSE2 on x86-64).
+ */
+enum class level
+{
+    generic,
+    avx2,
+    avx512
+};
+
+/**
+ * @return the best level the running CPU supports
+ */
+level detected_level();
+
+/**
+ * @return the level the kernels currently dispatch to
+ */
+level active_level();
+
+/**
+ * Forces the kernels to dispatch to the given level (e.g. to compare
+ * against the generic kernels in a benchmark). Requesting a level the
+ * CPU does not support throws std::invalid_argument.
+ */
+void set_active_level(level lvl);
+
+std::string to_string(level lvl);
+level level_from_string(const std::string& name);
+
+/**
+ * The dot product of two sparse vectors.
+ */
+double dot(const meta::learn::feature_vector& a,
+           const meta::learn::feature_vector& b);
+
+/**
+ * The dot product of a sparse vector with a dense vector. Features of the
+ * sparse vector past the end of the dense vector contribute nothing.
+ */
+double dot(const meta::learn::feature_vector& a, const double* dense,
+           uint64_t dense_size);
+
+/**
+ * The L2 norm of a sparse vector.
+ */
+double l2norm(const meta::learn::feature_vector& a);
+
+/**
+ * The cosine similarity of two sparse vectors (0 if either is empty).
+ */
+double cosine(const meta::learn::feature_vector& a,
+              const meta::learn::feature_vector& b);
+}
+
+#endif
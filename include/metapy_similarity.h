@@ -0,0 +1,254 @@
+/**
+ * @file metapy_similarity.h
+ * @author Chase Geigle
+ *
+ * Many-to-many similarity computations between two collections of sparse
+ * vectors.
+ */
+
+#ifndef METAPY_SIMILARITY_H_
+#define METAPY_SIMILARITY_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "meta/learn/instance.h"
+#include "metapy_parallel.h"
+
+enum class similarity_metric
+{
+    dot,
+    cosine
+};
+
+inline similarity_metric similarity_metric_from_string(const std::string& name)
+{
+    if (name == "dot")
+        return similarity_metric::dot;
+    if (name == "cosine")
+        return similarity_metric::cosine;
+    throw std::invalid_argument{"unknown similarity metric: " + name};
+}
+
+/**
+ * A collection of sparse rows in compressed sparse row format, with the
+ * values already normalized as the metric requires.
+ */
+struct similarity_rows
+{
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> ids;
+    std::vector<double> values;
+
+    std::size_t size() const
+    {
+        return offsets.size() - 1;
+    }
+};
+
+/**
+ * Copies size rows, obtained from features(i), into a similarity_rows.
+ * For the cosine metric, every row is scaled to unit length (rows with no
+ * weight are left empty), so that cosine similarity becomes a dot
+ * product.
+ */
+template <class FeatureFunction>
+similarity_rows make_similarity_rows(std::size_t size,
+                                     FeatureFunction&& features,
+                                     similarity_metric metric)
+{
+    similarity_rows rows;
+    rows.offsets.reserve(size + 1);
+    rows.offsets.push_back(0);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const auto& fv = features(i);
+        double norm = 1;
+        if (metric == similarity_metric::cosine)
+        {
+            norm = 0;
+            for (const auto& pr : fv)
+                norm += pr.second * pr.second;
+            norm = std::sqrt(norm);
+        }
+
+        if (norm > 0)
+        {
+            for (const auto& pr : fv)
+            {
+                if (pr.second == 0)
+                    continue;
+                rows.ids.push_back(pr.first);
+                rows.values.push_back(pr.second / norm);
+            }
+        }
+        rows.offsets.push_back(rows.ids.size());
+    }
+    return rows;
+}
+
+/**
+ * The similarities between every row of one collection and every row of
+ * another, in compressed sparse row format. Pairs without any features
+ * in common are omitted.
+ */
+struct similarity_matrix
+{
+    std::size_t num_rows = 0;
+    std::size_t num_columns = 0;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> columns;
+    std::vector<double> values;
+};
+
+/**
+ * Computes the similarity matrix between the rows of a and the rows of b
+ * as the sparse product a * b^T.
+ *
+ * b is inverted into posting lists (one per feature, ordered by row), and
+ * each row of a accumulates its scores into a dense buffer, one block of
+ * b's rows at a time so that the buffer stays in cache. The rows of a are
+ * split across num_threads threads.
+ *
+ * @param top_k If nonzero, only the top_k highest similarities of each row
+ * are kept, in decreasing order (ties broken by column); otherwise, every
+ * nonzero similarity is kept, in column order
+ */
+inline similarity_matrix pairwise_similarity(const similarity_rows& a,
+                                             const similarity_rows& b,
+                                             std::size_t top_k,
+                                             std::size_t num_threads)
+{
+    constexpr std::size_t block_rows = 8192;
+
+    // invert b: postings for each distinct feature, ordered by row
+    std::vector<std::tuple<uint64_t, uint64_t, double>> triples;
+    triples.reserve(b.ids.size());
+    for (std::size_t row = 0; row < b.size(); ++row)
+        for (auto i = b.offsets[row]; i < b.offsets[row + 1]; ++i)
+            triples.emplace_back(b.ids[i], row, b.values[i]);
+    std::sort(triples.begin(), triples.end());
+
+    std::vector<uint64_t> features;
+    std::vector<uint64_t> posting_offsets;
+    std::vector<uint64_t> posting_rows;
+    std::vector<double> posting_values;
+    posting_rows.reserve(triples.size());
+    posting_values.reserve(triples.size());
+    for (const auto& t : triples)
+    {
+        if (features.empty() || features.back() != std::get<0>(t))
+        {
+            features.push_back(std::get<0>(t));
+            posting_offsets.push_back(posting_rows.size());
+        }
+        posting_rows.push_back(std::get<1>(t));
+        posting_values.push_back(std::get<2>(t));
+    }
+    posting_offsets.push_back(posting_rows.size());
+    triples = {};
+
+    using entry = std::pair<uint64_t, double>;
+    auto by_score = [](const entry& x, const entry& y) {
+        return x.second > y.second
+               || (x.second == y.second && x.first < y.first);
+    };
+
+    std::vector<std::vector<entry>> results(a.size());
+    parallel_for_blocks(a.size(), num_threads, [&](std::size_t start,
+                                                   std::size_t end) {
+        std::vector<double> accumulator(std::min(block_rows, b.size()));
+        std::vector<uint32_t> touched;
+        // for each feature of the current row: (next posting, last posting,
+        // value in the row)
+        std::vector<std::tuple<uint64_t, uint64_t, double>> cursors;
+
+        for (auto row = start; row < end; ++row)
+        {
+            cursors.clear();
+            for (auto i = a.offsets[row]; i < a.offsets[row + 1]; ++i)
+            {
+                auto it = std::lower_bound(features.begin(), features.end(),
+                                           a.ids[i]);
+                if (it == features.end() || *it != a.ids[i])
+                    continue;
+                auto f = static_cast<std::size_t>(it - features.begin());
+                cursors.emplace_back(posting_offsets[f],
+                                     posting_offsets[f + 1], a.values[i]);
+            }
+
+            auto& result = results[row];
+            for (std::size_t block = 0; block < b.size() && !cursors.empty();
+                 block += block_rows)
+            {
+                auto block_end = std::min(block + block_rows, b.size());
+                for (auto& cur : cursors)
+                {
+                    auto& pos = std::get<0>(cur);
+                    auto last = std::get<1>(cur);
+                    auto weight = std::get<2>(cur);
+                    for (; pos < last && posting_rows[pos] < block_end; ++pos)
+                    {
+                        auto local = static_cast<uint32_t>(posting_rows[pos]
+                                                           - block);
+                        if (accumulator[local] == 0)
+                            touched.push_back(local);
+                        accumulator[local] += weight * posting_values[pos];
+                    }
+                }
+
+                std::sort(touched.begin(), touched.end());
+                for (auto local : touched)
+                {
+                    if (accumulator[local] != 0)
+                        result.emplace_back(block + local,
+                                            accumulator[local]);
+                    accumulator[local] = 0;
+                }
+                touched.clear();
+
+                // keep the candidates bounded while scanning the blocks
+                if (top_k > 0 && result.size() > 2 * top_k)
+                {
+                    std::nth_element(result.begin(), result.begin() + top_k,
+                                     result.end(), by_score);
+                    result.resize(top_k);
+                }
+            }
+
+            if (top_k > 0)
+            {
+                auto k = std::min(top_k, result.size());
+                std::partial_sort(result.begin(), result.begin() + k,
+                                  result.end(), by_score);
+                result.resize(k);
+            }
+        }
+    });
+
+    similarity_matrix matrix;
+    matrix.num_rows = a.size();
+    matrix.num_columns = b.size();
+    matrix.offsets.reserve(a.size() + 1);
+    matrix.offsets.push_back(0);
+    for (auto& result : results)
+    {
+        for (const auto& e : result)
+        {
+            matrix.columns.push_back(e.first);
+            matrix.values.push_back(e.second);
+        }
+        matrix.offsets.push_back(matrix.columns.size());
+        result = {};
+    }
+    return matrix;
+}
+
+#endif
@@ -0,0 +1,430 @@
+/**
+ * @file metapy_transform.h
+ * @author Chase Geigle
+ *
+ * Parallel transforms over the feature vectors of a dataset.
+ */
+
+#ifndef METAPY_TRANSFORM_H_
+#define METAPY_TRANSFORM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "meta/index/inverted_index.h"
+#include "meta/learn/dataset.h"
+#include "metapy_csr.h"
+#include "metapy_parallel.h"
+
+/**
+ * Statistics gathered while hashing the features of a dataset.
+ */
+struct hashing_stats
+{
+    /// the number of distinct features present in the dataset
+    uint64_t features = 0;
+    /// the number of buckets that received at least one feature
+    uint64_t buckets_used = 0;
+    /// the number of nonzero entries before hashing
+    uint64_t nonzeros = 0;
+    /// the number of entries merged into another entry of the same instance
+    uint64_t merged_nonzeros = 0;
+
+    /**
+     * @return the fraction of distinct features that landed in a bucket
+     * already occupied by another feature
+     */
+    double collision_rate() const
+    {
+        return features == 0 ? 0.0
+                             : static_cast<double>(features - buckets_used)
+                                   / features;
+    }
+
+    /**
+     * @return the fraction of nonzero entries that were merged with
+     * another entry of the same instance
+     */
+    double instance_collision_rate() const
+    {
+        return nonzeros == 0 ? 0.0
+                             : static_cast<double>(merged_nonzeros) / nonzeros;
+    }
+};
+
+/**
+ * Maps a feature id to a bucket and a sign, the "hashing trick" of
+ * Weinberger et al. (2009). The hash is a splitmix64 finalizer over the
+ * seeded id: its low bits pick the bucket and its top bit the sign.
+ */
+class feature_hasher
+{
+  public:
+    feature_hasher(uint64_t num_buckets, uint64_t seed, bool signed_hash)
+        : num_buckets_{num_buckets}, seed_{seed}, signed_{signed_hash}
+    {
+        if (num_buckets == 0)
+            throw std::invalid_argument{"num_buckets must be positive"};
+    }
+
+    uint64_t bucket(uint64_t feature) const
+    {
+        return hash(feature) % num_buckets_;
+    }
+
+    double sign(uint64_t feature) const
+    {
+        return signed_ && (hash(feature) >> 63) ? -1.0 : 1.0;
+    }
+
+    uint64_t num_buckets() const
+    {
+        return num_buckets_;
+    }
+
+  private:
+    uint64_t hash(uint64_t feature) const
+    {
+        auto z = feature + seed_ * 0x9e3779b97f4a7c15ULL
+                 + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t num_buckets_;
+    uint64_t seed_;
+    bool signed_;
+};
+
+namespace detail
+{
+/**
+ * Rebuilds the base of a dataset to change its feature count, keeping its
+ * instances' features. Instance ids are assigned in order, exactly as they
+ * were before.
+ */
+inline void set_total_features(meta::learn::dataset& dset,
+                               uint64_t total_features)
+{
+    meta::learn::dataset rebuilt{dset.begin(), dset.end(), total_features,
+                                 [](const meta::learn::instance&) {
+                                     return meta::learn::feature_vector{};
+                                 }};
+    for (std::size_t i = 0; i < dset.size(); ++i)
+        (rebuilt.begin() + i)->weights
+            = std::move((dset.begin() + i)->weights);
+    dset = std::move(rebuilt);
+}
+}
+
+/**
+ * Replaces the features of every instance of a dataset with their hashed
+ * buckets, summing the (signed) values of features that share a bucket
+ * within an instance and dropping entries that cancel out. Afterwards the
+ * dataset has exactly num_buckets features, so models trained on it are
+ * sized by the bucket count rather than the vocabulary.
+ *
+ * The instances are split across num_threads threads. Only the features
+ * (and the feature count) are replaced, so the labels of a binary or
+ * multiclass dataset, and any views of it, remain valid.
+ */
+inline hashing_stats hashing_transform(meta::learn::dataset& dset,
+                                       const feature_hasher& hasher,
+                                       std::size_t num_threads)
+{
+    if (dset.size() == 0)
+    {
+        detail::set_total_features(dset, hasher.num_buckets());
+        return {};
+    }
+
+    auto total_features = dset.total_features();
+    num_threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(num_threads, dset.size()));
+
+    // one record of seen features per block, or-ed together afterwards
+    std::vector<std::vector<bool>> seen(num_threads);
+    std::vector<hashing_stats> partial(num_threads);
+    auto block_size = (dset.size() + num_threads - 1) / num_threads;
+
+    using entry = std::pair<uint64_t, double>;
+    parallel_for_blocks(
+        dset.size(), num_threads, [&](std::size_t start, std::size_t end) {
+            auto block = start / block_size;
+            auto& block_seen = seen[block];
+            auto& stats = partial[block];
+            block_seen.resize(total_features);
+
+            std::vector<entry> hashed;
+            for (auto it = dset.begin() + start; it != dset.begin() + end;
+                 ++it)
+            {
+                auto& fv = it->weights;
+                hashed.clear();
+                for (const auto& pr : fv)
+                {
+                    uint64_t id = pr.first;
+                    if (id < total_features)
+                        block_seen[id] = true;
+                    hashed.emplace_back(hasher.bucket(id),
+                                        hasher.sign(id) * pr.second);
+                }
+                stats.nonzeros += hashed.size();
+                std::sort(hashed.begin(), hashed.end(),
+                          [](const entry& a, const entry& b) {
+                              return a.first < b.first;
+                          });
+
+                fv.clear();
+                fv.reserve(hashed.size());
+                for (std::size_t i = 0; i < hashed.size();)
+                {
+                    auto bucket = hashed[i].first;
+                    auto value = hashed[i].second;
+                    auto j = i + 1;
+                    for (; j < hashed.size() && hashed[j].first == bucket; ++j)
+                        value += hashed[j].second;
+                    stats.merged_nonzeros += j - i - 1;
+                    if (value != 0)
+                        fv.emplace_back(meta::learn::feature_id{bucket},
+                                        value);
+                    i = j;
+                }
+            }
+        });
+
+    hashing_stats stats;
+    std::vector<bool> occupied(hasher.num_buckets());
+    for (uint64_t id = 0; id < total_features; ++id)
+    {
+        auto present = std::any_of(
+            seen.begin(), seen.end(), [&](const std::vector<bool>& s) {
+                return !s.empty() && s[id];
+            });
+        if (!present)
+            continue;
+
+        stats.features += 1;
+        auto bucket = hasher.bucket(id);
+        if (!occupied[bucket])
+        {
+            occupied[bucket] = true;
+            stats.buckets_used += 1;
+        }
+    }
+    for (const auto& p : partial)
+    {
+        stats.nonzeros += p.nonzeros;
+        stats.merged_nonzeros += p.merged_nonzeros;
+    }
+
+    detail::set_total_features(dset, hasher.num_buckets());
+    return stats;
+}
+
+/**
+ * Options for the fused TF-IDF and L2 normalization transform.
+ */
+struct tfidf_options
+{
+    /// replace each term frequency tf with 1 + log(tf)
+    bool sublinear_tf = false;
+    /// scale every instance to unit L2 norm afterwards
+    bool normalize = true;
+};
+
+/**
+ * The inverse document frequency of every feature, stored densely so that
+ * transforms can look weights up without consulting an index. A feature
+ * occurring in df of num_docs documents has weight
+ *     log((num_docs + 1) / (df + 1)) + 1,
+ * which is positive even for features that occur everywhere. Features
+ * past the end of the table are treated as never seen (df = 0).
+ */
+class idf_table
+{
+  public:
+    idf_table(const std::vector<uint64_t>& doc_freqs, uint64_t num_docs)
+        : weights_(doc_freqs.size()), unseen_{weight(0, num_docs)}
+    {
+        for (std::size_t f = 0; f < doc_freqs.size(); ++f)
+            weights_[f] = weight(doc_freqs[f], num_docs);
+    }
+
+    double operator[](uint64_t feature) const
+    {
+        return feature < weights_.size() ? weights_[feature] : unseen_;
+    }
+
+    std::size_t size() const
+    {
+        return weights_.size();
+    }
+
+  private:
+    static double weight(uint64_t df, uint64_t num_docs)
+    {
+        return std::log((num_docs + 1.0) / (df + 1.0)) + 1;
+    }
+
+    std::vector<double> weights_;
+    double unseen_;
+};
+
+/**
+ * Reads the document frequencies of the first total_features terms from
+ * an inverted index, whose term ids are assumed to be the feature ids.
+ */
+inline idf_table make_idf_table(const meta::index::inverted_index& idx,
+                                uint64_t total_features)
+{
+    std::vector<uint64_t> doc_freqs(total_features);
+    for (uint64_t t = 0; t < total_features; ++t)
+        doc_freqs[t] = idx.doc_freq(meta::term_id{t});
+    return {doc_freqs, idx.num_docs()};
+}
+
+namespace detail
+{
+template <class Function>
+void for_each_nonzero(const meta::learn::dataset& dset, std::size_t row,
+                      Function&& fn)
+{
+    for (const auto& pr : (dset.begin() + row)->weights)
+        if (pr.second != 0)
+            fn(static_cast<uint64_t>(pr.first));
+}
+
+template <class FeatureId, class Value, class Function>
+void for_each_nonzero(const csr_dataset<FeatureId, Value>& dset,
+                      std::size_t row, Function&& fn)
+{
+    auto r = dset[row];
+    for (std::size_t i = 0; i < r.size(); ++i)
+        if (r.values()[i] != 0)
+            fn(static_cast<uint64_t>(r.ids()[i]));
+}
+
+inline double tf_weight(double tf, const tfidf_options& options)
+{
+    if (!options.sublinear_tf)
+        return tf;
+    return tf > 0 ? 1 + std::log(tf) : 0.0;
+}
+}
+
+/**
+ * Counts the document frequency of every feature of a learn::dataset or a
+ * csr_dataset, treating each instance as a document, and returns the
+ * resulting IDF weights. The instances are split across num_threads
+ * threads, each counting into its own table.
+ */
+template <class Dataset>
+idf_table make_idf_table(const Dataset& dset, std::size_t num_threads)
+{
+    auto total_features = dset.total_features();
+    // with no documents, every feature is unseen
+    if (dset.size() == 0)
+        return {std::vector<uint64_t>(total_features), 0};
+
+    num_threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(num_threads, dset.size()));
+    std::vector<std::vector<uint64_t>> counts(num_threads);
+    auto block_size = (dset.size() + num_threads - 1) / num_threads;
+
+    parallel_for_blocks(dset.size(), num_threads, [&](std::size_t start,
+                                                      std::size_t end) {
+        auto& block_counts = counts[start / block_size];
+        block_counts.resize(total_features);
+        for (auto row = start; row < end; ++row)
+            detail::for_each_nonzero(dset, row, [&](uint64_t id) {
+                if (id < total_features)
+                    ++block_counts[id];
+            });
+    });
+
+    std::vector<uint64_t> doc_freqs(total_features);
+    for (const auto& block_counts : counts)
+        for (std::size_t f = 0; f < block_counts.size(); ++f)
+            doc_freqs[f] += block_counts[f];
+    return {doc_freqs, dset.size()};
+}
+
+/**
+ * Reweights every instance of a dataset by TF-IDF and (optionally) scales
+ * it to unit length, in one pass over the instances split across
+ * num_threads threads. The values are replaced in place.
+ */
+inline void tfidf_l2norm_transform(meta::learn::dataset& dset,
+                                   const idf_table& idf,
+                                   const tfidf_options& options,
+                                   std::size_t num_threads)
+{
+    parallel_for_blocks(
+        dset.size(), num_threads, [&](std::size_t start, std::size_t end) {
+            for (auto it = dset.begin() + start; it != dset.begin() + end;
+                 ++it)
+            {
+                double norm = 0;
+                for (auto& pr : it->weights)
+                {
+                    pr.second = detail::tf_weight(pr.second, options)
+                                * idf[pr.first];
+                    norm += pr.second * pr.second;
+                }
+
+                if (!options.normalize || norm == 0)
+                    continue;
+                norm = std::sqrt(norm);
+                for (auto& pr : it->weights)
+                    pr.second /= norm;
+            }
+        });
+}
+
+/**
+ * Reweights every row of a CSR dataset by TF-IDF and (optionally) scales
+ * it to unit length, in one pass over the rows split across num_threads
+ * threads. CSR storage is immutable, so the result is a new dataset that
+ * shares its offsets, feature ids, and labels with dset.
+ */
+template <class FeatureId, class Value>
+csr_dataset<FeatureId, Value>
+tfidf_l2norm_transform(const csr_dataset<FeatureId, Value>& dset,
+                       const idf_table& idf, const tfidf_options& options,
+                       std::size_t num_threads)
+{
+    std::vector<Value> values(dset.nnz());
+    parallel_for_blocks(
+        dset.size(), num_threads, [&](std::size_t start, std::size_t end) {
+            for (auto row = start; row < end; ++row)
+            {
+                auto first = dset.offsets()[row];
+                auto last = dset.offsets()[row + 1];
+
+                double norm = 0;
+                for (auto i = first; i < last; ++i)
+                {
+                    auto weight
+                        = detail::tf_weight(dset.values()[i], options)
+                          * idf[dset.ids()[i]];
+                    values[i] = static_cast<Value>(weight);
+                    norm += weight * weight;
+                }
+
+                if (!options.normalize || norm == 0)
+                    continue;
+                norm = std::sqrt(norm);
+                for (auto i = first; i < last; ++i)
+                    values[i] = static_cast<Value>(values[i] / norm);
+            }
+        });
+    return dset.with_values(std::move(values));
+}
+
+#endif
@@ -11,10 +11,18 @@
 #include <pybind11/stl.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <list>
 #include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include "metapy_analyzers.h"
 #include "metapy_identifiers.h"
+#include "metapy_parallel.h"
 #include "metapy_probe_map.h"
 
 #include "cpptoml.h"
@@ -24,10 +32,10 @@
 #include "meta/analyzers/tokenizers/character_tokenizer.h"
 #include "meta/analyzers/tokenizers/icu_tokenizer.h"
 #include "meta/corpus/document.h"
-#include "meta/parallel/thread_pool.h"
 #include "meta/parser/analyzers/featurizers/all.h"
 #include "meta/parser/analyzers/tree_analyzer.h"
 #include "meta/sequence/analyzers/ngram_pos_analyzer.h"
+#include "meta/utf/utf.h"
 #include "meta/util/algorithm.h"
 
 namespace py = pybind11;
@@ -208,107 +216,1578 @@ void make_token_stream(TokenStream& next, const analyzers::token_stream& prev,
     new (&next) TokenStream(prev.clone(), args...);
 }
 
+template <class NGramAnalyzer, class T>
+py::object ngram_to_py(const NGramAnalyzer& ana,
+                       const analyzers::feature_map<T>& ngrams)
+{
+    if (ana.n_value() == 1)
+        return py::cast(ngrams);
+
+    py::dict ret;
+    for (const auto& kv : ngrams)
+    {
+        const auto& key = kv.key();
+
+        using iterator = decltype(key.begin());
+
+        py::tuple newkey{ana.n_value()};
+        uint64_t idx = 0;
+        util::for_each_token(key.begin(), key.end(), "_",
+                             [&](iterator first, iterator last) {
+                                 if (first != last)
+                                     newkey[idx++] = py::str({first, last});
+                             });
+        ret[newkey] = py::cast(kv.value());
+    }
+
+    return ret;
+}
+
 template <class NGramAnalyzer, class T>
 py::object ngram_analyze(NGramAnalyzer& ana, const corpus::document& doc)
 {
-    if (ana.n_value() == 1)
-        return py::cast(ana.template analyze<T>(doc));
+    return ngram_to_py(ana, ana.template analyze<T>(doc));
+}
+
+/**
+ * Analyzes a batch of documents in parallel. Each worker thread analyzes
+ * a contiguous block of the documents with its own clone of the analyzer;
+ * clones share any immutable models (like the tagger and parser of a
+ * tree_analyzer), so only the per-document state is duplicated.
+ *
+ * Analyzers defined in Python are run sequentially on the calling thread
+ * instead, since every call into them needs the GIL anyway.
+ */
+template <class T>
+std::vector<analyzers::feature_map<T>>
+analyze_batch(analyzers::analyzer& ana,
+              const std::vector<corpus::document>& docs,
+              std::size_t num_threads)
+{
+    std::vector<analyzers::feature_map<T>> results(docs.size());
+    if (dynamic_cast<py_analyzer*>(&ana))
+    {
+        for (std::size_t i = 0; i < docs.size(); ++i)
+            results[i] = ana.template analyze<T>(docs[i]);
+        return results;
+    }
+
+    py::gil_scoped_release rel;
+    parallel_for_blocks(docs.size(), num_threads,
+                        [&](std::size_t start, std::size_t end) {
+                            auto local = ana.clone();
+                            for (auto i = start; i < end; ++i)
+                                results[i]
+                                    = local->template analyze<T>(docs[i]);
+                        });
+    return results;
+}
+
+template <class NGramAnalyzer, class T>
+py::list ngram_analyze_batch(NGramAnalyzer& ana,
+                             const std::vector<corpus::document>& docs,
+                             std::size_t num_threads)
+{
+    auto batch = analyze_batch<T>(ana, docs, num_threads);
+
+    py::list ret;
+    for (const auto& ngrams : batch)
+        ret.append(ngram_to_py(ana, ngrams));
+    return ret;
+}
+
+/**
+ * A visitor class for converting a TOML configuration group to a Python
+ * dictionary. We use this to convert TOML tables to keyword arguments for
+ * token_streams defined in Python.
+ */
+class py_toml_visitor
+{
+  public:
+    template <class T>
+    void visit(const cpptoml::value<T>& v, py::object& obj)
+    {
+        obj = py::cast(v.get());
+    }
+
+    void visit(const cpptoml::table& table, py::object& obj)
+    {
+        obj = py::dict();
+        auto dict = obj.cast<py::dict>();
+
+        for (const auto& pr : table)
+        {
+            auto key = py::cast(pr.first);
+            py::object value;
+            pr.second->accept(*this, value);
+            dict[key] = value;
+        }
+    }
+
+    void visit(const cpptoml::array& arr, py::object& obj)
+    {
+        obj = py::list();
+        auto lst = obj.cast<py::list>();
+        for (const auto& val : arr)
+        {
+            py::object value;
+            val->accept(*this, value);
+            lst.append(value);
+        }
+    }
+
+    void visit(const cpptoml::table_array& tarr, py::object& obj)
+    {
+        obj = py::list();
+        auto lst = obj.cast<py::list>();
+        for (const auto& table : tarr)
+        {
+            py::object value;
+            table->accept(*this, value);
+            lst.append(value);
+        }
+    }
+};
+
+class py_token_stream_iterator
+{
+    analyzers::token_stream& stream_;
+    py::object ref_;
+
+  public:
+    py_token_stream_iterator(analyzers::token_stream& stream, py::object ref)
+        : stream_(stream), ref_(ref)
+    {
+        // nothing
+    }
+
+    std::string next()
+    {
+        if (!stream_)
+            throw py::stop_iteration();
+        return stream_.next();
+    }
+};
+
+/**
+ * A token_stream that yields exactly one token: whatever content it was
+ * most recently given via set_content(). This is used as the source of the
+ * filter wrapped by a memoized_filter so that the wrapped filter can be
+ * run on a single token at a time.
+ */
+class single_token_stream
+    : public util::clonable<analyzers::token_stream, single_token_stream>
+{
+  public:
+    virtual std::string next() override
+    {
+        if (!has_token_)
+            throw analyzers::token_stream_exception{
+                "next() called on empty single token stream"};
+        has_token_ = false;
+        return std::move(token_);
+    }
+
+    virtual operator bool() const override
+    {
+        return has_token_;
+    }
+
+    virtual void set_content(std::string&& content) override
+    {
+        token_ = std::move(content);
+        has_token_ = true;
+    }
+
+  private:
+    std::string token_;
+    bool has_token_ = false;
+};
+
+/**
+ * A filter that memoizes the output of another (expensive) filter, like
+ * porter2_filter or icu_filter, on a per-token basis.
+ *
+ * Each token read from the source is looked up in a bounded LRU cache.
+ * On a miss, the token is fed through the wrapped filter (whose source is
+ * a single_token_stream) and whatever that filter emits---zero, one, or
+ * many tokens---is cached. This is only correct for filters whose output
+ * for a token depends on that token alone; filters that carry state
+ * across tokens (like sentence_boundary) must not be wrapped.
+ *
+ * The cache is owned by each filter instance and is not shared between
+ * clones, so the analyzer replicas that are created for each indexing
+ * thread each get their own cache and never need to synchronize.
+ */
+class memoized_filter
+    : public util::clonable<analyzers::token_stream, memoized_filter>
+{
+  public:
+    /// The identifier for this filter in a configuration file
+    const static util::string_view id;
+
+    /// The default maximum number of distinct tokens to cache
+    const static uint64_t default_capacity = 65536;
+
+    /**
+     * @param source Where to read tokens from
+     * @param filter The filter to memoize, which must be reading from a
+     * single_token_stream
+     * @param capacity The maximum number of distinct tokens to cache
+     */
+    memoized_filter(std::unique_ptr<analyzers::token_stream> source,
+                    std::unique_ptr<analyzers::token_stream> filter,
+                    uint64_t capacity = default_capacity)
+        : source_{std::move(source)},
+          filter_{std::move(filter)},
+          capacity_{std::max<uint64_t>(capacity, 1)}
+    {
+        next_output();
+    }
+
+    /**
+     * Copies are given an empty cache: they are typically handed to a
+     * different thread and will see different text anyway.
+     */
+    memoized_filter(const memoized_filter& other)
+        : source_{other.source_->clone()},
+          filter_{other.filter_->clone()},
+          capacity_{other.capacity_}
+    {
+        next_output();
+    }
+
+    virtual std::string next() override
+    {
+        if (!*this)
+            throw analyzers::token_stream_exception{
+                "next() called with no tokens left"};
+        auto tok = (*current_)[pos_++];
+        next_output();
+        return tok;
+    }
+
+    virtual operator bool() const override
+    {
+        return current_ && pos_ < current_->size();
+    }
+
+    virtual void set_content(std::string&& content) override
+    {
+        source_->set_content(std::move(content));
+        current_ = nullptr;
+        next_output();
+    }
+
+    uint64_t hits() const
+    {
+        return hits_;
+    }
+
+    uint64_t misses() const
+    {
+        return misses_;
+    }
+
+    uint64_t evictions() const
+    {
+        return evictions_;
+    }
+
+    double hit_rate() const
+    {
+        auto total = hits_ + misses_;
+        return total == 0 ? 0.0 : static_cast<double>(hits_) / total;
+    }
+
+    uint64_t size() const
+    {
+        return cache_.size();
+    }
+
+    uint64_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /**
+     * Empties the cache and resets the counters.
+     */
+    void clear()
+    {
+        current_ = nullptr;
+        cache_.clear();
+        lru_.clear();
+        hits_ = misses_ = evictions_ = 0;
+    }
+
+  private:
+    using lru_list = std::list<const std::string*>;
+
+    struct cache_entry
+    {
+        std::vector<std::string> tokens;
+        lru_list::iterator lru_pos;
+    };
+
+    /**
+     * Advances to the next source token that produces at least one output
+     * token (or the end of the source).
+     */
+    void next_output()
+    {
+        if (current_ && pos_ < current_->size())
+            return;
+
+        current_ = nullptr;
+        pos_ = 0;
+        while (*source_)
+        {
+            const auto& tokens = lookup(source_->next());
+            if (!tokens.empty())
+            {
+                current_ = &tokens;
+                return;
+            }
+        }
+    }
+
+    const std::vector<std::string>& lookup(std::string&& token)
+    {
+        auto it = cache_.find(token);
+        if (it != cache_.end())
+        {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+            return it->second.tokens;
+        }
+
+        ++misses_;
+        if (cache_.size() == capacity_)
+        {
+            // unordered_map nodes are stable (unlike its iterators, which a
+            // rehash invalidates), so the LRU list points at the keys; the
+            // victim is erased by iterator, since erasing by a key that
+            // lives in the node being erased is not safe
+            auto victim = cache_.find(*lru_.back());
+            lru_.pop_back();
+            cache_.erase(victim);
+            ++evictions_;
+        }
+
+        std::vector<std::string> tokens;
+        filter_->set_content(std::string{token});
+        while (*filter_)
+            tokens.push_back(filter_->next());
+
+        auto res = cache_.emplace(std::move(token),
+                                  cache_entry{std::move(tokens), lru_.end()});
+        lru_.push_front(&res.first->first);
+        res.first->second.lru_pos = lru_.begin();
+        return res.first->second.tokens;
+    }
+
+    std::unique_ptr<analyzers::token_stream> source_;
+    std::unique_ptr<analyzers::token_stream> filter_;
+    uint64_t capacity_;
+
+    std::unordered_map<std::string, cache_entry> cache_;
+    lru_list lru_;
+
+    const std::vector<std::string>* current_ = nullptr;
+    std::size_t pos_ = 0;
+
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+};
+
+const util::string_view memoized_filter::id = "memoize-filter";
+const uint64_t memoized_filter::default_capacity;
+
+namespace ascii
+{
+/**
+ * Determines whether the range [first, last) contains only 7-bit ASCII.
+ * Eight bytes are tested at a time so that the compiler can vectorize the
+ * loop.
+ */
+inline bool is_ascii(const char* first, const char* last)
+{
+    uint64_t high_bits = 0;
+    for (; last - first >= 8; first += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, first, sizeof(word));
+        high_bits |= word;
+    }
+    for (; first != last; ++first)
+        high_bits |= static_cast<unsigned char>(*first);
+    return (high_bits & 0x8080808080808080ULL) == 0;
+}
+
+/**
+ * Lowercases an ASCII string in place without branching on each byte.
+ */
+inline void to_lower(std::string& str)
+{
+    for (auto& c : str)
+        c = static_cast<char>(
+            c + ((static_cast<unsigned char>(c - 'A') < 26) << 5));
+}
+
+/**
+ * The ASCII subset of the character classes used by ICU's word and
+ * sentence boundary rules, which are those of UAX #29 with ICU's
+ * tailorings (notably, ICU removes ':' from MidLetter, so it never joins
+ * the letters around it into one word). Characters marked as
+ * "unsupported" are ones whose handling could depend on ICU's notion of
+ * whitespace (control characters other than the usual ones), and force a
+ * fallback to ICU.
+ */
+enum class char_class : uint8_t
+{
+    unsupported,
+    cr,
+    lf,
+    newline,    // \v and \f: Newline for words, Sp for sentences
+    space,      // ' ' and \t
+    upper,      // A-Z
+    lower,      // a-z
+    numeric,    // 0-9
+    colon,      // : (SContinue; not MidLetter in ICU's word rules)
+    mid_num,    // , ;
+    period,     // . (MidNumLet/ATerm)
+    quote,      // ' (Single_Quote/Close)
+    underscore, // _ (ExtendNumLet)
+    sterm,      // ! ?
+    close,      // " ( ) [ ] { }
+    hyphen,     // - (SContinue)
+    other
+};
+
+inline char_class classify(char ch)
+{
+    auto c = static_cast<unsigned char>(ch);
+    if (c >= 'a' && c <= 'z')
+        return char_class::lower;
+    if (c >= 'A' && c <= 'Z')
+        return char_class::upper;
+    if (c >= '0' && c <= '9')
+        return char_class::numeric;
+    switch (c)
+    {
+        case '\r':
+            return char_class::cr;
+        case '\n':
+            return char_class::lf;
+        case '\v':
+        case '\f':
+            return char_class::newline;
+        case ' ':
+        case '\t':
+            return char_class::space;
+        case ':':
+            return char_class::colon;
+        case ',':
+        case ';':
+            return char_class::mid_num;
+        case '.':
+            return char_class::period;
+        case '\'':
+            return char_class::quote;
+        case '_':
+            return char_class::underscore;
+        case '!':
+        case '?':
+            return char_class::sterm;
+        case '"':
+        case '(':
+        case ')':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+            return char_class::close;
+        case '-':
+            return char_class::hyphen;
+        default:
+            return c < 0x20 || c == 0x7f ? char_class::unsupported
+                                         : char_class::other;
+    }
+}
+
+inline bool is_para_sep(char_class cc)
+{
+    return cc == char_class::cr || cc == char_class::lf;
+}
+
+inline bool is_sentence_space(char_class cc)
+{
+    return cc == char_class::space || cc == char_class::newline;
+}
+
+inline bool is_sentence_close(char_class cc)
+{
+    return cc == char_class::close || cc == char_class::quote;
+}
+
+inline bool is_sentence_terminator(char_class cc)
+{
+    return cc == char_class::period || cc == char_class::sterm;
+}
+
+inline bool is_letter(char_class cc)
+{
+    return cc == char_class::upper || cc == char_class::lower;
+}
+
+/**
+ * Finds the end of the sentence beginning at first, following the UAX
+ * #29 sentence boundary rules restricted to ASCII. [first, last) must be a
+ * single paragraph.
+ */
+inline const char* sentence_end(const char* first, const char* last)
+{
+    auto cls = [&](const char* it) {
+        return it == last ? char_class::other : classify(*it);
+    };
+
+    for (auto it = first; it != last;)
+    {
+        auto cc = classify(*it);
+        if (is_para_sep(cc))
+        {
+            // SB3, SB4: CR x LF, then break after the paragraph separator
+            if (cc == char_class::cr && cls(it + 1) == char_class::lf)
+                ++it;
+            return it + 1;
+        }
+
+        if (!is_sentence_terminator(cc))
+        {
+            ++it;
+            continue;
+        }
+
+        auto term = it++;
+        if (cc == char_class::period && it != last)
+        {
+            auto next = classify(*it);
+            // SB6: ATerm x Numeric
+            if (next == char_class::numeric)
+                continue;
+            // SB7: (Upper | Lower) ATerm x Upper
+            if (term != first && is_letter(classify(*(term - 1)))
+                && next == char_class::upper)
+                continue;
+        }
+
+        // SB9, SB10: SATerm Close* Sp* absorbs trailing closes/spaces
+        while (it != last && is_sentence_close(classify(*it)))
+            ++it;
+        while (it != last && is_sentence_space(classify(*it)))
+            ++it;
+
+        if (it == last)
+            return last;
+
+        auto next = classify(*it);
+        if (is_para_sep(next))
+        {
+            // SB11 with a trailing paragraph separator
+            if (next == char_class::cr && cls(it + 1) == char_class::lf)
+                ++it;
+            return it + 1;
+        }
+
+        // SB8: ATerm Close* Sp* x (not(Upper | Lower | ParaSep |
+        // SATerm))* Lower
+        if (cc == char_class::period)
+        {
+            auto look = it;
+            auto lc = next;
+            while (look != last && !is_letter(lc) && !is_para_sep(lc)
+                   && !is_sentence_terminator(lc))
+                lc = cls(++look);
+            if (lc == char_class::lower)
+                continue;
+        }
+
+        // SB8a: SATerm Close* Sp* x (SContinue | SATerm)
+        if (next == char_class::mid_num && *it == ',')
+            continue;
+        if (next == char_class::colon || next == char_class::hyphen
+            || is_sentence_terminator(next))
+            continue;
+
+        // SB11: SATerm Close* Sp* ParaSep? /
+        return it;
+    }
+    return last;
+}
+
+inline bool is_hard_break(char_class cc)
+{
+    return cc == char_class::cr || cc == char_class::lf
+           || cc == char_class::newline;
+}
+
+/**
+ * Determines whether there is a word boundary before position i of the
+ * sentence occupying positions [first, last) of cls, following ICU's word
+ * boundary rules restricted to ASCII. Like ICU, which segments the words
+ * of each sentence separately, the rules do not look outside the
+ * sentence.
+ */
+inline bool word_break(const std::vector<char_class>& cls, std::size_t first,
+                       std::size_t last, std::size_t i)
+{
+    auto at = [&](std::size_t j) {
+        return j >= first && j < last ? cls[j] : char_class::other;
+    };
+    auto prev = cls[i - 1];
+    auto cur = cls[i];
+
+    // WB3, WB3a, WB3b
+    if (prev == char_class::cr && cur == char_class::lf)
+        return false;
+    if (is_hard_break(prev) || is_hard_break(cur))
+        return true;
+
+    // WB3d: keep horizontal whitespace together
+    if (prev == char_class::space && cur == char_class::space)
+        return false;
+
+    auto alnum = [](char_class cc) {
+        return is_letter(cc) || cc == char_class::numeric;
+    };
+
+    // WB5, WB8, WB9, WB10
+    if (alnum(prev) && alnum(cur))
+        return false;
+
+    // MidLetter has no ASCII members left after ICU's tailoring, so only
+    // MidNumLet and Single_Quote join letters
+    auto mid_letter = [](char_class cc) {
+        return cc == char_class::period || cc == char_class::quote;
+    };
+    auto mid_num = [](char_class cc) {
+        return cc == char_class::mid_num || cc == char_class::period
+               || cc == char_class::quote;
+    };
+
+    // WB6, WB7
+    if (is_letter(prev) && mid_letter(cur) && is_letter(at(i + 1)))
+        return false;
+    if (i >= first + 2 && is_letter(at(i - 2)) && mid_letter(prev)
+        && is_letter(cur))
+        return false;
+
+    // WB11, WB12
+    if (i >= first + 2 && at(i - 2) == char_class::numeric && mid_num(prev)
+        && cur == char_class::numeric)
+        return false;
+    if (prev == char_class::numeric && mid_num(cur)
+        && at(i + 1) == char_class::numeric)
+        return false;
+
+    // WB13a, WB13b
+    if ((alnum(prev) || prev == char_class::underscore)
+        && cur == char_class::underscore)
+        return false;
+    if (prev == char_class::underscore && alnum(cur))
+        return false;
+
+    // WB999
+    return true;
+}
+
+inline bool is_whitespace(const char* first, const char* last)
+{
+    return std::all_of(first, last, [](char c) {
+        auto cc = classify(c);
+        return is_sentence_space(cc) || is_para_sep(cc);
+    });
+}
+}
+
+/**
+ * A drop-in replacement for icu_tokenizer that segments pure ASCII text
+ * with a byte-level implementation of the (ASCII subset of the) UAX #29
+ * rules, and only hands text to ICU when it contains non-ASCII characters.
+ *
+ * Text is processed one paragraph at a time: UAX #29 mandates both word
+ * and sentence boundaries after CR/LF, so tokenizing each paragraph
+ * independently yields the same tokens as tokenizing the whole string.
+ * Each paragraph that is not pure ASCII is tokenized with an
+ * icu_tokenizer instead.
+ */
+class fast_icu_tokenizer
+    : public util::clonable<analyzers::token_stream, fast_icu_tokenizer>
+{
+  public:
+    /// The identifier for this tokenizer in a configuration file
+    const static util::string_view id;
+
+    fast_icu_tokenizer(bool suppress_tags = false)
+        : suppress_tags_{suppress_tags},
+          fallback_{make_unique<analyzers::tokenizers::icu_tokenizer>(
+              suppress_tags)}
+    {
+        // nothing
+    }
+
+    fast_icu_tokenizer(const fast_icu_tokenizer& other)
+        : suppress_tags_{other.suppress_tags_},
+          fallback_{other.fallback_->clone()}
+    {
+        // nothing
+    }
+
+    virtual std::string next() override
+    {
+        if (!*this)
+            throw analyzers::token_stream_exception{
+                "next() called with no tokens left"};
+        return std::move(tokens_[idx_++]);
+    }
+
+    virtual operator bool() const override
+    {
+        return idx_ < tokens_.size();
+    }
+
+    virtual void set_content(std::string&& content) override
+    {
+        tokens_.clear();
+        idx_ = 0;
+
+        auto first = content.data();
+        auto last = first + content.size();
+        while (first != last)
+        {
+            auto para_end = std::find_if(first, last, [](char c) {
+                return c == '\n' || c == '\r';
+            });
+            if (para_end != last)
+            {
+                if (*para_end == '\r' && para_end + 1 != last
+                    && para_end[1] == '\n')
+                    ++para_end;
+                ++para_end;
+            }
+
+            if (!tokenize_ascii(first, para_end))
+            {
+                fallback_->set_content(std::string{first, para_end});
+                while (*fallback_)
+                    tokens_.push_back(fallback_->next());
+            }
+            first = para_end;
+        }
+    }
+
+  private:
+    /**
+     * Tokenizes a single paragraph if it is pure ASCII.
+     * @return whether the paragraph was tokenized
+     */
+    bool tokenize_ascii(const char* first, const char* last)
+    {
+        if (!ascii::is_ascii(first, last))
+            return false;
+
+        classes_.resize(static_cast<std::size_t>(last - first));
+        for (std::size_t i = 0; i < classes_.size(); ++i)
+        {
+            classes_[i] = ascii::classify(first[i]);
+            if (classes_[i] == ascii::char_class::unsupported)
+                return false;
+        }
+
+        for (auto sent = first; sent != last;)
+        {
+            auto sent_end = ascii::sentence_end(sent, last);
+            if (!suppress_tags_)
+                tokens_.emplace_back("<s>");
+
+            auto offset = static_cast<std::size_t>(sent - first);
+            auto end_offset = static_cast<std::size_t>(sent_end - first);
+            auto word = offset;
+            for (std::size_t i = offset + 1; i <= end_offset; ++i)
+            {
+                if (i != end_offset
+                    && !ascii::word_break(classes_, offset, end_offset, i))
+                    continue;
+                if (!ascii::is_whitespace(first + word, first + i))
+                    tokens_.emplace_back(first + word, first + i);
+                word = i;
+            }
+
+            if (!suppress_tags_)
+                tokens_.emplace_back("</s>");
+            sent = sent_end;
+        }
+        return true;
+    }
+
+    bool suppress_tags_;
+    std::unique_ptr<analyzers::token_stream> fallback_;
+    std::vector<std::string> tokens_;
+    std::size_t idx_ = 0;
+    std::vector<ascii::char_class> classes_;
+};
+
+const util::string_view fast_icu_tokenizer::id = "fast-icu-tokenizer";
+
+/**
+ * A drop-in replacement for lowercase_filter that lowercases ASCII tokens
+ * byte-by-byte and only uses full Unicode case folding on tokens that
+ * contain non-ASCII characters.
+ */
+class fast_lowercase_filter
+    : public util::clonable<analyzers::token_stream, fast_lowercase_filter>
+{
+  public:
+    /// The identifier for this filter in a configuration file
+    const static util::string_view id;
+
+    fast_lowercase_filter(std::unique_ptr<analyzers::token_stream> source)
+        : source_{std::move(source)}
+    {
+        // nothing
+    }
+
+    fast_lowercase_filter(const fast_lowercase_filter& other)
+        : source_{other.source_->clone()}
+    {
+        // nothing
+    }
+
+    virtual std::string next() override
+    {
+        auto tok = source_->next();
+        if (ascii::is_ascii(tok.data(), tok.data() + tok.size()))
+        {
+            ascii::to_lower(tok);
+            return tok;
+        }
+        return utf::foldcase(tok);
+    }
+
+    virtual operator bool() const override
+    {
+        return static_cast<bool>(*source_);
+    }
+
+    virtual void set_content(std::string&& content) override
+    {
+        source_->set_content(std::move(content));
+    }
+
+  private:
+    std::unique_ptr<analyzers::token_stream> source_;
+};
+
+const util::string_view fast_lowercase_filter::id = "fast-lowercase";
+
+/**
+ * Counts of the word n-grams in a document, stored without creating a
+ * string for each n-gram.
+ *
+ * Each distinct token is interned once and assigned an id; each n-gram is
+ * then a window of n token ids stored in one flat array, and is looked up
+ * in an open addressing table keyed on a hash of those ids. The n-grams
+ * are only turned back into strings when they are requested.
+ */
+class ngram_counts
+{
+  public:
+    ngram_counts(uint16_t n) : n_{n}, window_(n), slots_(16, 0)
+    {
+        // nothing
+    }
+
+    // terms_ points at the keys of vocab_: a move keeps the map's nodes,
+    // but a copy would leave the pointers referring to the original
+    ngram_counts(ngram_counts&&) = default;
+    ngram_counts& operator=(ngram_counts&&) = default;
+    ngram_counts(const ngram_counts&) = delete;
+    ngram_counts& operator=(const ngram_counts&) = delete;
+
+    /**
+     * Adds the next token in the document, counting the n-gram that it
+     * ends (if there are enough tokens for one).
+     */
+    void add(std::string&& token)
+    {
+        std::copy(window_.begin() + 1, window_.end(), window_.begin());
+        window_.back() = intern(std::move(token));
+        if (++seen_ >= n_)
+            increment(window_.data());
+    }
+
+    /**
+     * @return the number of distinct n-grams
+     */
+    uint64_t size() const
+    {
+        return counts_.size();
+    }
+
+    /**
+     * @return the number of distinct tokens
+     */
+    uint64_t vocab_size() const
+    {
+        return terms_.size();
+    }
+
+    uint16_t n_value() const
+    {
+        return n_;
+    }
+
+    const std::string& term(uint32_t term_id) const
+    {
+        return *terms_.at(term_id);
+    }
+
+    /**
+     * @return the count for the given n-gram, or 0 if it did not occur
+     */
+    uint64_t count(const std::vector<std::string>& ngram) const
+    {
+        if (ngram.size() != n_)
+            return 0;
+
+        std::vector<uint32_t> ids(n_);
+        for (uint16_t i = 0; i < n_; ++i)
+        {
+            auto it = vocab_.find(ngram[i]);
+            if (it == vocab_.end())
+                return 0;
+            ids[i] = it->second;
+        }
+
+        auto slot = find_slot(ids.data());
+        return slots_[slot] == 0 ? 0 : counts_[slots_[slot] - 1];
+    }
+
+    /**
+     * Invokes fn(ids, count) for each n-gram, where ids points to the n
+     * token ids that make up the n-gram.
+     */
+    template <class Function>
+    void each(Function&& fn) const
+    {
+        for (std::size_t i = 0; i < counts_.size(); ++i)
+            fn(&ngram_ids_[i * n_], counts_[i]);
+    }
+
+  private:
+    uint32_t intern(std::string&& token)
+    {
+        auto it = vocab_.find(token);
+        if (it != vocab_.end())
+            return it->second;
+
+        auto term_id = static_cast<uint32_t>(terms_.size());
+        auto res = vocab_.emplace(std::move(token), term_id);
+        terms_.push_back(&res.first->first);
+        return term_id;
+    }
+
+    uint64_t hash(const uint32_t* ids) const
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (uint16_t i = 0; i < n_; ++i)
+        {
+            h = (h ^ ids[i]) * 0x9e3779b97f4a7c15ULL;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+
+    std::size_t find_slot(const uint32_t* ids) const
+    {
+        auto mask = slots_.size() - 1;
+        auto slot = hash(ids) & mask;
+        while (slots_[slot] != 0
+               && !std::equal(ids, ids + n_,
+                              &ngram_ids_[(slots_[slot] - 1) * n_]))
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void increment(const uint32_t* ids)
+    {
+        auto slot = find_slot(ids);
+        if (slots_[slot] != 0)
+        {
+            ++counts_[slots_[slot] - 1];
+            return;
+        }
+
+        ngram_ids_.insert(ngram_ids_.end(), ids, ids + n_);
+        counts_.push_back(1);
+        slots_[slot] = static_cast<uint32_t>(counts_.size());
+
+        // keep the load factor at or below 1/2
+        if (counts_.size() * 2 > slots_.size())
+            resize(slots_.size() * 2);
+    }
+
+    void resize(std::size_t num_slots)
+    {
+        slots_.assign(num_slots, 0);
+        for (std::size_t i = 0; i < counts_.size(); ++i)
+        {
+            auto slot = find_slot(&ngram_ids_[i * n_]);
+            slots_[slot] = static_cast<uint32_t>(i + 1);
+        }
+    }
+
+    uint16_t n_;
+    std::unordered_map<std::string, uint32_t> vocab_;
+    std::vector<const std::string*> terms_;
+    std::vector<uint32_t> window_;
+    uint64_t seen_ = 0;
+    std::vector<uint32_t> ngram_ids_;
+    std::vector<uint64_t> counts_;
+    std::vector<uint32_t> slots_;
+};
+
+/**
+ * Produces the same n-grams as ngram_word_analyzer, but collects them
+ * into an ngram_counts rather than a string-keyed feature map.
+ */
+class ngram_word_counter
+{
+  public:
+    ngram_word_counter(uint16_t n,
+                       std::unique_ptr<analyzers::token_stream> stream)
+        : n_{n}, stream_{std::move(stream)}
+    {
+        if (n_ == 0)
+            throw analyzers::analyzer_exception{
+                "n-gram size must be positive"};
+    }
+
+    ngram_word_counter(const ngram_word_counter& other)
+        : n_{other.n_}, stream_{other.stream_->clone()}
+    {
+        // nothing
+    }
+
+    ngram_counts analyze(const corpus::document& doc)
+    {
+        ngram_counts counts{n_};
+        stream_->set_content(analyzers::get_content(doc));
+        while (*stream_)
+            counts.add(stream_->next());
+        return counts;
+    }
+
+    uint16_t n_value() const
+    {
+        return n_;
+    }
+
+  private:
+    uint16_t n_;
+    std::unique_ptr<analyzers::token_stream> stream_;
+};
 
-    auto ngrams = ana.template analyze<T>(doc);
+/**
+ * Converts an ngram_counts to the same dictionary that ngram_analyze
+ * produces: string keys for unigrams and tuple keys otherwise, with the
+ * counts as T. Each distinct token is converted to a Python string only
+ * once.
+ */
+template <class T>
+py::dict ngram_counts_to_dict(const ngram_counts& counts)
+{
+    std::vector<py::str> terms;
+    terms.reserve(counts.vocab_size());
+    for (uint32_t i = 0; i < counts.vocab_size(); ++i)
+        terms.emplace_back(counts.term(i));
 
     py::dict ret;
-    for (const auto& kv : ngrams)
+    auto n = counts.n_value();
+    counts.each([&](const uint32_t* ids, uint64_t count) {
+        if (n == 1)
+        {
+            ret[terms[ids[0]]] = py::cast(static_cast<T>(count));
+            return;
+        }
+
+        py::tuple key{n};
+        for (uint16_t i = 0; i < n; ++i)
+            key[i] = terms[ids[i]];
+        ret[key] = py::cast(static_cast<T>(count));
+    });
+    return ret;
+}
+
+/**
+ * The ngram_word_analyzer that NGramWordAnalyzer constructs. It can be
+ * used anywhere MeTA's can, but it also keeps an ngram_word_counter over
+ * its own copy of the token stream, which analyze() and featurize() use
+ * instead of joining every n-gram into a string and splitting the string
+ * back up into a tuple.
+ */
+class counting_ngram_word_analyzer : public analyzers::ngram_word_analyzer
+{
+  public:
+    counting_ngram_word_analyzer(uint16_t n,
+                                 const analyzers::token_stream& stream)
+        : analyzers::ngram_word_analyzer(n, stream.clone()),
+          counter_{n, stream.clone()}
     {
-        const auto& key = kv.key();
+        // nothing
+    }
 
-        using iterator = decltype(key.begin());
+    virtual std::unique_ptr<analyzers::analyzer> clone() const override
+    {
+        return make_unique<counting_ngram_word_analyzer>(*this);
+    }
 
-        py::tuple newkey{ana.n_value()};
-        uint64_t idx = 0;
-        util::for_each_token(key.begin(), key.end(), "_",
-                             [&](iterator first, iterator last) {
-                                 if (first != last)
-                                     newkey[idx++] = py::str({first, last});
-                             });
-        ret[newkey] = py::cast(kv.value());
+    ngram_counts count(const corpus::document& doc)
+    {
+        return counter_.analyze(doc);
+    }
+
+  private:
+    ngram_word_counter counter_;
+};
+
+/**
+ * Analyzes a document with an NGramWordAnalyzer, counting its n-grams
+ * directly unless the analyzer was created by MeTA (e.g. loaded from a
+ * configuration file).
+ */
+template <class T>
+py::object ngram_word_analyze(analyzers::ngram_word_analyzer& ana,
+                              const corpus::document& doc)
+{
+    if (auto counting = dynamic_cast<counting_ngram_word_analyzer*>(&ana))
+        return ngram_counts_to_dict<T>(counting->count(doc));
+    return ngram_analyze<analyzers::ngram_word_analyzer, T>(ana, doc);
+}
+
+template <class T>
+py::list ngram_word_analyze_batch(analyzers::ngram_word_analyzer& ana,
+                                  const std::vector<corpus::document>& docs,
+                                  std::size_t num_threads)
+{
+    auto counting = dynamic_cast<counting_ngram_word_analyzer*>(&ana);
+    if (!counting)
+        return ngram_analyze_batch<analyzers::ngram_word_analyzer, T>(
+            ana, docs, num_threads);
+
+    std::vector<ngram_counts> batch;
+    batch.reserve(docs.size());
+    for (std::size_t i = 0; i < docs.size(); ++i)
+        batch.emplace_back(ana.n_value());
+
+    {
+        py::gil_scoped_release rel;
+        parallel_for_blocks(docs.size(), num_threads,
+                            [&](std::size_t start, std::size_t end) {
+                                counting_ngram_word_analyzer local{*counting};
+                                for (auto i = start; i < end; ++i)
+                                    batch[i] = local.count(docs[i]);
+                            });
     }
 
+    py::list ret;
+    for (const auto& counts : batch)
+        ret.append(ngram_counts_to_dict<T>(counts));
     return ret;
 }
 
 /**
- * A visitor class for converting a TOML configuration group to a Python
- * dictionary. We use this to convert TOML tables to keyword arguments for
- * token_streams defined in Python.
+ * Counters for a single stage of an instrumented filter chain. These are
+ * shared by every clone of the stage, so they are updated atomically.
  */
-class py_toml_visitor
+struct stage_stats
+{
+    stage_stats(std::string stage_name, std::shared_ptr<stage_stats> up)
+        : name{std::move(stage_name)}, upstream{std::move(up)}
+    {
+        // nothing
+    }
+
+    /// The name of this stage in reports
+    const std::string name;
+    /// The stage this one reads its tokens from, if any
+    const std::shared_ptr<stage_stats> upstream;
+
+    std::atomic<uint64_t> documents{0};
+    std::atomic<uint64_t> tokens{0};
+    std::atomic<uint64_t> bytes{0};
+    /// Time spent in this stage *including* all upstream stages
+    std::atomic<uint64_t> nanoseconds{0};
+
+    void reset()
+    {
+        documents = 0;
+        tokens = 0;
+        bytes = 0;
+        nanoseconds = 0;
+    }
+};
+
+/**
+ * Collects the stage_stats for every stage of one or more instrumented
+ * filter chains.
+ */
+class pipeline_profile
 {
   public:
-    template <class T>
-    void visit(const cpptoml::value<T>& v, py::object& obj)
+    /**
+     * Adds a new stage to the end of the profile.
+     * @param name The name of the stage
+     * @param upstream The stage this one reads from, or nullptr if it is a
+     * tokenizer
+     */
+    std::shared_ptr<stage_stats> add_stage(std::string name,
+                                           std::shared_ptr<stage_stats> upstream)
     {
-        obj = py::cast(v.get());
+        std::lock_guard<std::mutex> lock{mutex_};
+        stages_.push_back(
+            std::make_shared<stage_stats>(std::move(name), std::move(upstream)));
+        return stages_.back();
     }
 
-    void visit(const cpptoml::table& table, py::object& obj)
+    /**
+     * @return the most recently added stage, or nullptr
+     */
+    std::shared_ptr<stage_stats> last_stage() const
     {
-        obj = py::dict();
-        auto dict = obj.cast<py::dict>();
+        std::lock_guard<std::mutex> lock{mutex_};
+        return stages_.empty() ? nullptr : stages_.back();
+    }
 
-        for (const auto& pr : table)
+    std::vector<std::shared_ptr<stage_stats>> stages() const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return stages_;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (auto& stage : stages_)
+            stage->reset();
+    }
+
+    /**
+     * Finds a profile by the id it was registered with, for use by the
+     * filter factory while a configuration file is being loaded.
+     */
+    static std::shared_ptr<pipeline_profile> find(int64_t id)
+    {
+        std::lock_guard<std::mutex> lock{registry_mutex()};
+        auto it = registry().find(id);
+        return it == registry().end() ? nullptr : it->second.lock();
+    }
+
+    /**
+     * Registers a profile so that it can be referred to by id from a
+     * configuration file.
+     */
+    static int64_t enroll(const std::shared_ptr<pipeline_profile>& profile)
+    {
+        std::lock_guard<std::mutex> lock{registry_mutex()};
+        static int64_t next_id = 0;
+        // drop any profiles that no longer exist
+        for (auto it = registry().begin(); it != registry().end();)
         {
-            auto key = py::cast(pr.first);
-            py::object value;
-            pr.second->accept(*this, value);
-            dict[key] = value;
+            if (it->second.expired())
+                it = registry().erase(it);
+            else
+                ++it;
         }
+        registry()[next_id] = profile;
+        return next_id++;
     }
 
-    void visit(const cpptoml::array& arr, py::object& obj)
+  private:
+    static std::mutex& registry_mutex()
     {
-        obj = py::list();
-        auto lst = obj.cast<py::list>();
-        for (const auto& val : arr)
+        static std::mutex mut;
+        return mut;
+    }
+
+    static std::unordered_map<int64_t, std::weak_ptr<pipeline_profile>>&
+    registry()
+    {
+        static std::unordered_map<int64_t, std::weak_ptr<pipeline_profile>>
+            profiles;
+        return profiles;
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<stage_stats>> stages_;
+};
+
+/**
+ * Wraps a single stage of a filter chain, recording the number of
+ * documents and tokens that pass through it and the time spent in it.
+ *
+ * The time recorded is inclusive of every stage upstream of this one;
+ * since the upstream stage is also wrapped, the time spent in this stage
+ * alone is the difference between the two.
+ *
+ * Reading the clock costs about as much as a cheap filter does, so only
+ * one in every sample_period calls to next() and operator bool is timed,
+ * and counts for sample_period calls; set_content is timed once per
+ * document. Token and byte counts are kept locally and added to the
+ * shared stats at the end of every document.
+ */
+class profiled_filter
+    : public util::clonable<analyzers::token_stream, profiled_filter>
+{
+  public:
+    /// The identifier for this filter in a configuration file
+    const static util::string_view id;
+
+    profiled_filter(std::unique_ptr<analyzers::token_stream> stage,
+                    std::shared_ptr<stage_stats> stats)
+        : stage_{std::move(stage)}, stats_{std::move(stats)}
+    {
+        // nothing
+    }
+
+    profiled_filter(const profiled_filter& other)
+        : stage_{other.stage_->clone()}, stats_{other.stats_}
+    {
+        // nothing
+    }
+
+    ~profiled_filter()
+    {
+        flush();
+    }
+
+    virtual std::string next() override
+    {
+        std::string tok;
+        if (sampled())
         {
-            py::object value;
-            val->accept(*this, value);
-            lst.append(value);
+            timer t{*stats_, sample_period};
+            tok = stage_->next();
+        }
+        else
+        {
+            tok = stage_->next();
         }
+        ++tokens_;
+        bytes_ += tok.size();
+        return tok;
     }
 
-    void visit(const cpptoml::table_array& tarr, py::object& obj)
+    virtual operator bool() const override
     {
-        obj = py::list();
-        auto lst = obj.cast<py::list>();
-        for (const auto& table : tarr)
+        bool more;
+        if (sampled())
         {
-            py::object value;
-            table->accept(*this, value);
-            lst.append(value);
+            timer t{*stats_, sample_period};
+            more = static_cast<bool>(*stage_);
+        }
+        else
+        {
+            more = static_cast<bool>(*stage_);
         }
+        if (!more)
+            flush();
+        return more;
     }
-};
 
-class py_token_stream_iterator
-{
-    analyzers::token_stream& stream_;
-    py::object ref_;
+    virtual void set_content(std::string&& content) override
+    {
+        flush();
+        timer t{*stats_, 1};
+        ++stats_->documents;
+        stage_->set_content(std::move(content));
+    }
 
-  public:
-    py_token_stream_iterator(analyzers::token_stream& stream, py::object ref)
-        : stream_(stream), ref_(ref)
+    const std::shared_ptr<stage_stats>& stats() const
     {
-        // nothing
+        return stats_;
     }
 
-    std::string next()
+    /**
+     * Rewrites every explicit filter chain in a configuration so that each
+     * of its stages is wrapped in a profiled_filter reporting to the given
+     * profile. Named chains like "default-chain" are built by MeTA without
+     * going through the filter factory, so they cannot be instrumented and
+     * are rejected.
+     */
+    static void instrument(cpptoml::table& config,
+                           const std::shared_ptr<pipeline_profile>& profile)
     {
-        if (!stream_)
-            throw py::stop_iteration();
-        return stream_.next();
+        auto analyzers = config.get_table_array("analyzers");
+        if (!analyzers)
+            return;
+
+        auto profile_id = pipeline_profile::enroll(profile);
+        std::size_t ana_idx = 0;
+        for (auto& ana : *analyzers)
+        {
+            auto method = ana->get_as<std::string>("method");
+            if (auto chain = ana->get_as<std::string>("filter"))
+                throw analyzers::analyzer_exception{
+                    "cannot profile the named filter chain \"" + *chain
+                    + "\": list its filters in [[analyzers.filter]] tables "
+                      "instead"};
+            auto filters = ana->get_table_array("filter");
+            if (filters)
+            {
+                for (auto& filter : *filters)
+                {
+                    auto type = filter->get_as<std::string>("type");
+                    if (!type)
+                        continue;
+
+                    std::stringstream name;
+                    name << (method ? *method : "analyzer") << '[' << ana_idx
+                         << "] " << *type;
+                    filter->insert("profiled-type", *type);
+                    filter->insert("profiled-name", name.str());
+                    filter->insert("profile-id", profile_id);
+                    filter->insert("type", id.to_string());
+                }
+            }
+            ++ana_idx;
+        }
+    }
+
+  private:
+    /// One call to next() or operator bool in this many is timed
+    constexpr static uint64_t sample_period = 64;
+
+    /**
+     * Records the time until its destruction, multiplied by weight, as
+     * time spent in a stage.
+     */
+    class timer
+    {
+      public:
+        timer(stage_stats& stats, uint64_t weight)
+            : stats_(stats),
+              weight_{weight},
+              start_{std::chrono::steady_clock::now()}
+        {
+            // nothing
+        }
+
+        ~timer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            stats_.nanoseconds
+                += weight_
+                   * static_cast<uint64_t>(
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             elapsed)
+                             .count());
+        }
+
+      private:
+        stage_stats& stats_;
+        uint64_t weight_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    bool sampled() const
+    {
+        return ++calls_ % sample_period == 0;
+    }
+
+    /**
+     * Adds the locally counted tokens and bytes to the shared stats.
+     */
+    void flush() const
+    {
+        if (tokens_ == 0)
+            return;
+        stats_->tokens += tokens_;
+        stats_->bytes += bytes_;
+        tokens_ = 0;
+        bytes_ = 0;
     }
+
+    std::unique_ptr<analyzers::token_stream> stage_;
+    std::shared_ptr<stage_stats> stats_;
+    mutable uint64_t calls_ = 0;
+    mutable uint64_t tokens_ = 0;
+    mutable uint64_t bytes_ = 0;
 };
 
+constexpr uint64_t profiled_filter::sample_period;
+
+const util::string_view profiled_filter::id = "profiled-filter";
+
+/**
+ * Copies the configuration of a wrapper filter (like profiled_filter or
+ * memoized_filter) for the filter that it wraps: the wrapper's own keys
+ * are left out, since the wrapped filter may reject keys it does not know
+ * (filters defined in Python receive every key as a keyword argument),
+ * and the type becomes that of the wrapped filter.
+ */
+inline std::shared_ptr<cpptoml::table>
+wrapped_config(const cpptoml::table& config, const std::string& type,
+               std::initializer_list<const char*> wrapper_keys)
+{
+    auto inner = cpptoml::make_table();
+    for (const auto& pr : config)
+    {
+        if (pr.first == "type"
+            || std::find(wrapper_keys.begin(), wrapper_keys.end(), pr.first)
+                   != wrapper_keys.end())
+            continue;
+        inner->insert(pr.first, pr.second);
+    }
+    inner->insert("type", type);
+    return inner;
+}
+
+/**
+ * Converts a pipeline_profile into a list of per-stage dictionaries.
+ * Token input counts and exclusive times are computed relative to each
+ * stage's upstream stage.
+ */
+inline py::list profile_report(const pipeline_profile& profile)
+{
+    py::list report;
+    for (const auto& stage : profile.stages())
+    {
+        uint64_t tokens_in = 0;
+        uint64_t upstream_ns = 0;
+        if (stage->upstream)
+        {
+            tokens_in = stage->upstream->tokens;
+            upstream_ns = stage->upstream->nanoseconds;
+        }
+        uint64_t total_ns = stage->nanoseconds;
+        auto self_ns = total_ns > upstream_ns ? total_ns - upstream_ns : 0;
+
+        py::dict row;
+        row["name"] = py::cast(stage->name);
+        row["documents"] = py::cast(static_cast<uint64_t>(stage->documents));
+        row["tokens_in"] = py::cast(tokens_in);
+        row["tokens_out"] = py::cast(static_cast<uint64_t>(stage->tokens));
+        row["bytes_out"] = py::cast(static_cast<uint64_t>(stage->bytes));
+        row["seconds"] = py::cast(self_ns / 1e9);
+        row["cumulative_seconds"] = py::cast(total_ns / 1e9);
+        report.append(row);
+    }
+    return report;
+}
+
 void metapy_bind_analyzers(py::module& m)
 {
     using namespace analyzers;
@@ -354,6 +1833,12 @@ void metapy_bind_analyzers(py::module& m)
         py::arg_t<bool>{"suppress_tags", false});
     // py::arg("suppress_tags") = false);
 
+    py::class_<fast_icu_tokenizer>{m_ana, "FastICUTokenizer", ts_base}.def(
+        py::init<bool>(),
+        "Creates a tokenizer that produces the same tokens as ICUTokenizer, "
+        "but only uses ICU for text that is not pure ASCII",
+        py::arg_t<bool>{"suppress_tags", false});
+
     // filters
     py::class_<filters::alpha_filter>{m_ana, "AlphaFilter", ts_base}.def(
         "__init__", &make_token_stream<filters::alpha_filter>);
@@ -385,6 +1870,9 @@ void metapy_bind_analyzers(py::module& m)
     py::class_<filters::lowercase_filter>{m_ana, "LowercaseFilter", ts_base}
         .def("__init__", &make_token_stream<filters::lowercase_filter>);
 
+    py::class_<fast_lowercase_filter>{m_ana, "FastLowercaseFilter", ts_base}
+        .def("__init__", &make_token_stream<fast_lowercase_filter>);
+
     py::class_<filters::porter2_filter>{m_ana, "Porter2Filter", ts_base}.def(
         "__init__", &make_token_stream<filters::porter2_filter>);
 
@@ -396,20 +1884,78 @@ void metapy_bind_analyzers(py::module& m)
                                            ts_base}
         .def("__init__", &make_token_stream<filters::sentence_boundary>);
 
+    py::class_<single_token_stream>{m_ana, "SingleTokenStream", ts_base}.def(
+        py::init<>());
+
+    py::class_<memoized_filter>{m_ana, "MemoizedFilter", ts_base}
+        .def("__init__",
+             [](memoized_filter& filt, const token_stream& source,
+                py::object filter_type, uint64_t capacity) {
+                 // filter_type is invoked once to build the filter that
+                 // will be memoized, e.g. Porter2Filter or
+                 // lambda ts: ICUFilter(ts, "Latin-ASCII")
+                 py::object filter = filter_type(single_token_stream{});
+                 new (&filt) memoized_filter(
+                     source.clone(), filter.cast<const token_stream&>().clone(),
+                     capacity);
+             },
+             py::arg("source"), py::arg("filter"),
+             py::arg("capacity") = memoized_filter::default_capacity)
+        .def("hits", &memoized_filter::hits)
+        .def("misses", &memoized_filter::misses)
+        .def("evictions", &memoized_filter::evictions)
+        .def("hit_rate", &memoized_filter::hit_rate)
+        .def("cache_size", &memoized_filter::size)
+        .def("capacity", &memoized_filter::capacity)
+        .def("clear_cache", &memoized_filter::clear);
+
     // analyzers
     py::class_<analyzers::analyzer, py_analyzer> analyzer_base{m_ana,
                                                                "Analyzer"};
     analyzer_base.def(py::init<>())
         .def("analyze", &analyzer::analyze<uint64_t>)
-        .def("featurize", &analyzer::analyze<double>);
+        .def("featurize", &analyzer::analyze<double>)
+        .def("analyze_batch", &analyze_batch<uint64_t>, py::arg("docs"),
+             py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def("featurize_batch", &analyze_batch<double>, py::arg("docs"),
+             py::arg("num_threads") = std::thread::hardware_concurrency());
 
-    py::class_<ngram_word_analyzer>{m_ana, "NGramWordAnalyzer", analyzer_base}
+    // counting_ngram_word_analyzer is registered as the alias so that
+    // instances are allocated with room for it
+    py::class_<ngram_word_analyzer, counting_ngram_word_analyzer>{
+        m_ana, "NGramWordAnalyzer", analyzer_base}
         .def("__init__",
              [](ngram_word_analyzer& ana, uint16_t n, const token_stream& ts) {
-                 new (&ana) ngram_word_analyzer(n, ts.clone());
+                 new (&ana) counting_ngram_word_analyzer(n, ts);
+             })
+        .def("analyze", &ngram_word_analyze<uint64_t>)
+        .def("featurize", &ngram_word_analyze<double>)
+        .def("analyze_batch", &ngram_word_analyze_batch<uint64_t>,
+             py::arg("docs"),
+             py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def("featurize_batch", &ngram_word_analyze_batch<double>,
+             py::arg("docs"),
+             py::arg("num_threads") = std::thread::hardware_concurrency());
+
+    py::class_<ngram_counts>{m_ana, "NGramCounts"}
+        .def("__len__", &ngram_counts::size)
+        .def("__getitem__",
+             [](const ngram_counts& counts, const std::string& unigram) {
+                 return counts.count({unigram});
+             })
+        .def("__getitem__", &ngram_counts::count)
+        .def("n_value", &ngram_counts::n_value)
+        .def("vocab_size", &ngram_counts::vocab_size)
+        .def("to_dict", &ngram_counts_to_dict<uint64_t>);
+
+    py::class_<ngram_word_counter>{m_ana, "NGramWordCounter"}
+        .def("__init__",
+             [](ngram_word_counter& counter, uint16_t n,
+                const token_stream& ts) {
+                 new (&counter) ngram_word_counter(n, ts.clone());
              })
-        .def("analyze", &ngram_analyze<ngram_word_analyzer, uint64_t>)
-        .def("featurize", &ngram_analyze<ngram_word_analyzer, double>);
+        .def("analyze", &ngram_word_counter::analyze)
+        .def("n_value", &ngram_word_counter::n_value);
 
     py::class_<ngram_pos_analyzer>{m_ana, "NGramPOSAnalyzer", analyzer_base}
         .def("__init__",
@@ -419,7 +1965,13 @@ void metapy_bind_analyzers(py::module& m)
                  new (&ana) ngram_pos_analyzer(n, ts.clone(), crf_prefix);
              })
         .def("analyze", &ngram_analyze<ngram_pos_analyzer, uint64_t>)
-        .def("featurize", &ngram_analyze<ngram_pos_analyzer, double>);
+        .def("featurize", &ngram_analyze<ngram_pos_analyzer, double>)
+        .def("analyze_batch", &ngram_analyze_batch<ngram_pos_analyzer, uint64_t>,
+             py::arg("docs"),
+             py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def("featurize_batch", &ngram_analyze_batch<ngram_pos_analyzer, double>,
+             py::arg("docs"),
+             py::arg("num_threads") = std::thread::hardware_concurrency());
 
     py::class_<tree_featurizer> py_tree_feat{m_ana, "TreeFeaturizer"};
     py_tree_feat.def("tree_tokenize", &tree_featurizer::tree_tokenize);
@@ -453,11 +2005,121 @@ void metapy_bind_analyzers(py::module& m)
 
     py::class_<multi_analyzer>{m_ana, "MultiAnalyzer", analyzer_base};
 
-    m_ana.def("load", [](const std::string& filename) {
-        py::gil_scoped_release rel;
-        auto config = cpptoml::parse_file(filename);
-        return analyzers::load(*config);
-    });
+    py::class_<pipeline_profile, std::shared_ptr<pipeline_profile>>{
+        m_ana, "AnalyzerProfile"}
+        .def(py::init<>())
+        .def("wrap",
+             [](pipeline_profile& profile, const token_stream& stage,
+                const std::string& name, bool tokenizer) {
+                 // stages wrapped by hand are assumed to be wrapped in
+                 // pipeline order, starting from the tokenizer
+                 auto upstream = tokenizer ? nullptr : profile.last_stage();
+                 return profiled_filter{stage.clone(),
+                                        profile.add_stage(name, upstream)};
+             },
+             py::arg("stage"), py::arg("name"), py::arg("tokenizer") = false)
+        .def("report", &profile_report)
+        .def("reset", &pipeline_profile::reset)
+        .def("__str__", [](const pipeline_profile& profile) {
+            std::stringstream ss;
+            for (auto row : profile_report(profile))
+            {
+                auto stats = row.cast<py::dict>();
+                ss << stats["name"].cast<std::string>() << ": "
+                   << stats["tokens_out"].cast<uint64_t>() << " tokens out ("
+                   << stats["tokens_in"].cast<uint64_t>() << " in), "
+                   << stats["seconds"].cast<double>() << "s\n";
+            }
+            return ss.str();
+        });
+
+    py::class_<profiled_filter>{m_ana, "ProfiledFilter", ts_base};
+
+    m_ana.def("load",
+              [](const std::string& filename, py::object profile) {
+                  std::shared_ptr<pipeline_profile> prof;
+                  if (!profile.is_none())
+                      prof = profile.cast<std::shared_ptr<pipeline_profile>>();
+
+                  py::gil_scoped_release rel;
+                  auto config = cpptoml::parse_file(filename);
+                  if (prof)
+                      profiled_filter::instrument(*config, prof);
+                  return analyzers::load(*config);
+              },
+              py::arg("filename"), py::arg("profile") = py::none());
+
+    filter_factory::get().add(
+        profiled_filter::id,
+        [](std::unique_ptr<token_stream> source, const cpptoml::table& config) {
+            auto type = config.get_as<std::string>("profiled-type");
+            auto name = config.get_as<std::string>("profiled-name");
+            auto profile_id = config.get_as<int64_t>("profile-id");
+            if (!type || !name || !profile_id)
+                throw token_stream_exception{
+                    "profiled-filter is only created by analyzers.load"};
+
+            auto profile = pipeline_profile::find(*profile_id);
+            if (!profile)
+                throw token_stream_exception{"analyzer profile has expired"};
+
+            std::shared_ptr<stage_stats> upstream;
+            if (auto prev = dynamic_cast<profiled_filter*>(source.get()))
+                upstream = prev->stats();
+
+            auto inner = wrapped_config(
+                config, *type,
+                {"profiled-type", "profiled-name", "profile-id"});
+            auto stage = filter_factory::get().create(*type, std::move(source),
+                                                      *inner);
+            return make_unique<profiled_filter>(
+                std::move(stage), profile->add_stage(*name, upstream));
+        });
+
+    filter_factory::get().add(
+        fast_icu_tokenizer::id,
+        [](std::unique_ptr<token_stream> source, const cpptoml::table& config) {
+            if (source)
+                throw token_stream_exception{
+                    "tokenizers must be the first filter"};
+
+            auto suppress_tags = config.get_as<bool>("suppress-tags");
+            return make_unique<fast_icu_tokenizer>(suppress_tags
+                                                   && *suppress_tags);
+        });
+
+    filter_factory::get().add(
+        fast_lowercase_filter::id,
+        [](std::unique_ptr<token_stream> source, const cpptoml::table&) {
+            return make_unique<fast_lowercase_filter>(std::move(source));
+        });
+
+    // allows any registered filter to be memoized from a configuration
+    // file, e.g. { type = "memoize-filter", filter = "porter2-filter" }
+    filter_factory::get().add(
+        memoized_filter::id,
+        [](std::unique_ptr<token_stream> source, const cpptoml::table& config) {
+            auto filter_id = config.get_as<std::string>("filter");
+            if (!filter_id)
+                throw token_stream_exception{
+                    "memoize-filter requires a filter to memoize"};
+
+            auto capacity = memoized_filter::default_capacity;
+            if (auto cap = config.get_as<int64_t>("capacity"))
+            {
+                if (*cap <= 0)
+                    throw token_stream_exception{
+                        "memoize-filter capacity must be positive"};
+                capacity = static_cast<uint64_t>(*cap);
+            }
+
+            auto inner = wrapped_config(config, *filter_id,
+                                        {"filter", "capacity"});
+            auto filter = filter_factory::get().create(
+                *filter_id, make_unique<single_token_stream>(), *inner);
+            return make_unique<memoized_filter>(std::move(source),
+                                                std::move(filter), capacity);
+        });
 
     m_ana.def("register_filter", [](py::object cls) {
         py_factory_register(cls, filter_factory::get(),
@@ -3,7 +3,16 @@
  * @author Chase Geigle
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <thread>
+
 #include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/operators.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -11,19 +20,99 @@
 #include "cpptoml.h"
 #include "meta/classify/binary_dataset_view.h"
 #include "meta/classify/classifier/all.h"
+#include "meta/classify/classifier_factory.h"
 #include "meta/classify/kernel/all.h"
 #include "meta/index/ranker/ranker_factory.h"
 #include "meta/learn/dataset.h"
 #include "meta/learn/loss/loss_function_factory.h"
 #include "meta/logging/logger.h"
 #include "meta/util/iterator.h"
+#include "metapy_ann.h"
 #include "metapy_classify.h"
+#include "metapy_confusion.h"
+#include "metapy_csr.h"
 #include "metapy_identifiers.h"
+#include "metapy_kernel.h"
 #include "metapy_learn.h"
+#include "metapy_linear.h"
+#include "metapy_model_file.h"
+#include "metapy_naive_bayes.h"
+#include "metapy_parallel.h"
+#include "metapy_progress.h"
 
 namespace py = pybind11;
 using namespace meta;
 
+constexpr std::size_t ann_knn::default_num_tables;
+constexpr std::size_t ann_knn::default_num_bits;
+constexpr std::size_t ann_knn::default_num_probes;
+constexpr double linear_one_vs_all::default_gamma;
+constexpr std::size_t linear_one_vs_all::default_max_iter;
+constexpr double kernel_perceptron::default_alpha;
+constexpr double kernel_perceptron::default_gamma;
+constexpr double kernel_perceptron::default_bias;
+constexpr uint64_t kernel_perceptron::default_max_iter;
+constexpr std::size_t kernel_perceptron::default_cache_size;
+constexpr double online_naive_bayes::default_alpha;
+constexpr double online_naive_bayes::default_beta;
+const util::string_view online_naive_bayes::id = "online-naive-bayes";
+
+/**
+ * A Python exception raised by Python code that native code called from a
+ * thread that may not be the one that entered C++ (or that released the
+ * GIL). The exception is taken out of the error_already_set while the GIL
+ * is held, crosses threads as a C++ exception, and is raised again
+ * unchanged (type, value, and traceback) by the exception translator that
+ * metapy_bind_classify registers.
+ */
+class worker_python_error : public std::runtime_error
+{
+  public:
+    /**
+     * Must be called with the GIL held.
+     */
+    explicit worker_python_error(py::error_already_set& ex)
+        : std::runtime_error{ex.what()}, error_{std::make_shared<fetched>()}
+    {
+        ex.restore();
+        PyObject *type, *value, *trace;
+        PyErr_Fetch(&type, &value, &trace);
+        error_->type = py::reinterpret_steal<py::object>(type);
+        error_->value = py::reinterpret_steal<py::object>(value);
+        error_->trace = py::reinterpret_steal<py::object>(trace);
+    }
+
+    /**
+     * Sets the exception as the current Python error. Must be called with
+     * the GIL held.
+     */
+    void restore() const
+    {
+        PyErr_Restore(error_->type.inc_ref().ptr(),
+                      error_->value.inc_ref().ptr(),
+                      error_->trace.inc_ref().ptr());
+    }
+
+  private:
+    struct fetched
+    {
+        py::object type;
+        py::object value;
+        py::object trace;
+
+        ~fetched()
+        {
+            // the last copy of the exception may die without the GIL
+            py::gil_scoped_acquire acq;
+            type = py::object{};
+            value = py::object{};
+            trace = py::object{};
+        }
+    };
+
+    std::shared_ptr<fetched> error_;
+};
+
 template <class ClassifierBase = classify::binary_classifier>
 class py_binary_classifier : public ClassifierBase
 {
@@ -107,6 +196,88 @@ class py_kernel : public classify::kernel::kernel
     }
 };
 
+/**
+ * A batch_kernel for a Kernel defined in Python. Each row is a single call
+ * to the kernel's batch() method made with the GIL held, and the
+ * documents are converted to Python objects once, in reset().
+ */
+class py_batch_kernel : public batch_kernel
+{
+  public:
+    py_batch_kernel(py::object kernel) : kernel_{std::move(kernel)}
+    {
+        // nothing
+    }
+
+    ~py_batch_kernel()
+    {
+        // classifiers may be destroyed on threads that do not hold the GIL
+        py::gil_scoped_acquire acq;
+        kernel_ = py::object{};
+        docs_ = py::object{};
+    }
+
+    void reset(const std::vector<learn::feature_vector>& docs) override
+    {
+        py::gil_scoped_acquire acq;
+        docs_ = py::cast(docs);
+        num_docs_ = docs.size();
+    }
+
+    void evaluate(const learn::feature_vector& x, double* out) const override
+    {
+        py::gil_scoped_acquire acq;
+        try
+        {
+            auto values
+                = kernel_.attr("batch")(x, docs_).cast<py_value_array>();
+            if (static_cast<std::size_t>(values.size()) != num_docs_)
+                throw std::runtime_error{
+                    "Kernel.batch must return one value per document"};
+            std::copy(values.data(), values.data() + num_docs_, out);
+        }
+        catch (py::error_already_set& ex)
+        {
+            throw worker_python_error{ex};
+        }
+    }
+
+  private:
+    py::object kernel_;
+    py::object docs_;
+    std::size_t num_docs_ = 0;
+};
+
+/**
+ * Copies a native kernel for a classifier to own. The vectorized kernels
+ * are copied as they are; any other kernel goes through MeTA's kernel
+ * loader.
+ */
+std::unique_ptr<classify::kernel::kernel>
+copy_native_kernel(const classify::kernel::kernel& kern)
+{
+    if (auto poly = dynamic_cast<const simd_polynomial*>(&kern))
+        return make_unique<simd_polynomial>(*poly);
+    if (auto sig = dynamic_cast<const simd_sigmoid*>(&kern))
+        return make_unique<simd_sigmoid>(*sig);
+
+    std::stringstream ss;
+    kern.save(ss);
+    return classify::kernel::load_kernel(ss);
+}
+
+/**
+ * Kernels defined in Python are evaluated through their batch() method;
+ * native kernels are copied so that they can be used without the GIL.
+ */
+std::unique_ptr<batch_kernel> make_batch_kernel(py::object kernel)
+{
+    const auto& kern = kernel.cast<const classify::kernel::kernel&>();
+    if (dynamic_cast<const py_kernel*>(&kern))
+        return make_unique<py_batch_kernel>(std::move(kernel));
+    return make_unique<native_batch_kernel>(copy_native_kernel(kern));
+}
+
 /**
  * This class holds a binary_classifier that was created by invoking
  * Python code.
@@ -123,42 +294,737 @@ class cpp_created_py_binary_classifier
     : public classify::online_binary_classifier
 {
   public:
-    cpp_created_py_binary_classifier(py::object cls) : cls_{cls}
+    cpp_created_py_binary_classifier(py::object cls)
+        : cls_{cls}, predictor_{cls_.cast<classify::binary_classifier*>()}
     {
         // nothing
     }
 
+    ~cpp_created_py_binary_classifier()
+    {
+        // ensembles may be destroyed on threads that do not hold the GIL
+        py::gil_scoped_acquire acq;
+        cls_ = py::object{};
+    }
+
+    /**
+     * The classifier pointer is resolved once up front so that native
+     * classifiers can be used from threads that do not hold the GIL;
+     * Python-defined classifiers acquire it themselves when called.
+     */
     double predict(const learn::feature_vector& instance) const override
     {
-        return cls_.cast<classify::binary_classifier&>().predict(instance);
+        return predictor_->predict(instance);
     }
 
     void save(std::ostream& os) const override
     {
-        cls_.cast<classify::binary_classifier&>().save(os);
+        predictor_->save(os);
     }
 
     void train(classify::binary_dataset_view bdv) override
     {
+        py::gil_scoped_acquire acq;
         cls_.cast<classify::online_binary_classifier&>().train(bdv);
     }
 
     void train_one(const learn::feature_vector& instance, bool label) override
     {
+        py::gil_scoped_acquire acq;
         cls_.cast<classify::online_binary_classifier&>().train_one(instance,
                                                                    label);
     }
 
   private:
     py::object cls_;
+    classify::binary_classifier* predictor_;
+};
+
+/**
+ * Calls into classifiers defined in Python need the GIL, so batch
+ * operations run them sequentially instead of on a thread pool.
+ */
+bool is_python_classifier(const classify::classifier& cls)
+{
+    return dynamic_cast<const py_classifier<>*>(&cls)
+           || dynamic_cast<const py_online_classifier*>(&cls);
+}
+
+bool is_python_classifier(const classify::binary_classifier& cls)
+{
+    return dynamic_cast<const py_binary_classifier<>*>(&cls)
+           || dynamic_cast<const py_online_binary_classifier*>(&cls);
+}
+
+/**
+ * Invokes fn(idx) for every instance of a batch. Native classifiers are
+ * run on a thread pool with the GIL released.
+ */
+template <class Classifier, class Function>
+void for_each_in_batch(const Classifier& cls, std::size_t size,
+                       std::size_t num_threads, Function&& fn)
+{
+    if (is_python_classifier(cls))
+    {
+        for (std::size_t i = 0; i < size; ++i)
+            fn(i);
+        return;
+    }
+
+    py::gil_scoped_release rel;
+    parallel_for_blocks(size, num_threads,
+                        [&](std::size_t start, std::size_t end) {
+                            for (auto i = start; i < end; ++i)
+                                fn(i);
+                        });
+}
+
+/**
+ * Classifies every instance of a batch.
+ * @param labels If not None, the label space to report ids in: the ids
+ * index this list, so they mean the same thing in every batch, and
+ * predicting a label that is not in it is an error. Otherwise, the ids
+ * index the (sorted) labels predicted in this batch only, which differ
+ * from batch to batch.
+ * @return a tuple of a numpy array with the label id of each instance and
+ * the list of labels that the ids refer to
+ */
+template <class Batch>
+py::tuple classify_batch(const classify::classifier& cls, const Batch& batch,
+                         py::object labels_arg, std::size_t num_threads)
+{
+    std::vector<class_label> predictions(batch.size());
+    for_each_in_batch(cls, batch.size(), num_threads, [&](std::size_t i) {
+        predictions[i] = cls.classify(instance_features(batch, i));
+    });
+
+    std::vector<class_label> labels;
+    if (labels_arg.is_none())
+    {
+        labels = predictions;
+        std::sort(labels.begin(), labels.end());
+        labels.erase(std::unique(labels.begin(), labels.end()),
+                     labels.end());
+    }
+    else
+    {
+        labels = labels_arg.cast<std::vector<class_label>>();
+    }
+
+    // (label, id) pairs sorted by label, for looking up the predictions
+    std::vector<std::pair<class_label, uint32_t>> index(labels.size());
+    for (std::size_t i = 0; i < labels.size(); ++i)
+        index[i] = {labels[i], static_cast<uint32_t>(i)};
+    std::sort(index.begin(), index.end());
+    for (std::size_t i = 1; i < index.size(); ++i)
+        if (index[i].first == index[i - 1].first)
+            throw py::value_error{"labels must not contain duplicates"};
+
+    std::vector<uint32_t> ids(predictions.size());
+    for (std::size_t i = 0; i < predictions.size(); ++i)
+    {
+        auto it = std::lower_bound(
+            index.begin(), index.end(), predictions[i],
+            [](const std::pair<class_label, uint32_t>& entry,
+               const class_label& lbl) { return entry.first < lbl; });
+        if (it == index.end() || it->first != predictions[i])
+            throw py::value_error{"predicted label "
+                                  + static_cast<std::string>(predictions[i])
+                                  + " is not in labels"};
+        ids[i] = it->second;
+    }
+
+    return py::make_tuple(py::array(ids.size(), ids.data()), labels);
+}
+
+/**
+ * Computes the margin of a binary classifier for every instance of a
+ * batch, returned as a numpy array.
+ */
+template <class Batch>
+py::array predict_batch(const classify::binary_classifier& cls,
+                        const Batch& batch, std::size_t num_threads)
+{
+    std::vector<double> margins(batch.size());
+    for_each_in_batch(cls, batch.size(), num_threads, [&](std::size_t i) {
+        margins[i] = cls.predict(instance_features(batch, i));
+    });
+    return py::array(margins.size(), margins.data());
+}
+
+template <class Batch>
+void bind_batch_methods(
+    py::class_<classify::classifier, py_classifier<>>& pycls,
+    py::class_<classify::binary_classifier, py_binary_classifier<>>& pybincls)
+{
+    pycls.def("classify_batch", &classify_batch<Batch>, py::arg("batch"),
+              py::arg("labels") = py::none(),
+              py::arg("num_threads") = std::thread::hardware_concurrency());
+    pybincls.def("predict_batch", &predict_batch<Batch>, py::arg("batch"),
+                 py::arg("num_threads") = std::thread::hardware_concurrency());
+}
+
+using py_label_mask
+    = py::array_t<bool, py::array::c_style | py::array::forcecast>;
+
+classify::binary_dataset make_binary_csr_dataset(const csr_arrays& csr,
+                                                 const py_label_mask& labels)
+{
+    if (static_cast<std::size_t>(labels.size()) != csr.rows)
+        throw py::value_error{"there must be exactly one label per row"};
+
+    auto lbls = labels.data();
+    py::gil_scoped_release release;
+    return make_csr_dataset<classify::binary_dataset>(
+        csr, [&](std::size_t row) { return lbls[row]; });
+}
+
+classify::multiclass_dataset
+make_multiclass_csr_dataset(const csr_arrays& csr,
+                            const std::vector<class_label>& labels)
+{
+    if (labels.size() != csr.rows)
+        throw py::value_error{"there must be exactly one label per row"};
+
+    py::gil_scoped_release release;
+    return make_csr_dataset<classify::multiclass_dataset>(
+        csr, [&](std::size_t row) { return labels[row]; });
+}
+
+using cv_creator_type
+    = std::function<py::object(classify::multiclass_dataset_view)>;
+
+using cv_fold = std::pair<classify::multiclass_dataset_view,
+                          classify::multiclass_dataset_view>;
+
+/**
+ * The k (training, testing) folds of a dataset, using the same shuffled
+ * fold layout as classify::cross_validate. Only the shuffled view is
+ * kept: MeTA's views own their instance ids, so each fold's pair of views
+ * (O(n) ids) is made only when the fold is run, and at most one fold per
+ * thread holds its ids at a time.
+ */
+class cv_folds
+{
+  public:
+    cv_folds(classify::multiclass_dataset_view docs, std::size_t k,
+             bool even_split)
+        : docs_{std::move(docs)}, k_{k}
+    {
+        if (k == 0)
+            throw py::value_error{"k must be positive"};
+        if (even_split)
+            docs_ = docs_.create_even_split();
+        docs_.shuffle();
+        step_size_ = docs_.size() / k;
+    }
+
+    std::size_t size() const
+    {
+        return k_;
+    }
+
+    /**
+     * @return fold i: its testing view is the i-th run of step_size
+     * shuffled instances and its training view is every other instance,
+     * in the order of the view rotated to start just after that run
+     */
+    cv_fold operator[](std::size_t i) const
+    {
+        auto first = docs_.begin() + i * step_size_;
+        auto last = first + step_size_;
+
+        std::vector<std::size_t> training;
+        training.reserve(docs_.size() - step_size_);
+        for (auto it = last; it != docs_.end(); ++it)
+            training.push_back(it->id);
+        for (auto it = docs_.begin(); it != first; ++it)
+            training.push_back(it->id);
+
+        std::vector<std::size_t> testing;
+        testing.reserve(step_size_);
+        for (auto it = first; it != last; ++it)
+            testing.push_back(it->id);
+
+        return {classify::multiclass_dataset_view{docs_, std::move(training)},
+                classify::multiclass_dataset_view{docs_, std::move(testing)}};
+    }
+
+  private:
+    classify::multiclass_dataset_view docs_;
+    std::size_t k_;
+    std::size_t step_size_;
+};
+
+/**
+ * Trains a classifier on one fold and tests it, from a thread that does
+ * not hold the GIL. The creator is called with the GIL held; native
+ * classifiers release it again while they train. Testing happens without
+ * the GIL.
+ *
+ * @param seconds If not null, receives the wall-clock time spent
+ * training (including any wait for the GIL) and testing
+ */
+template <class Creator>
+classify::confusion_matrix run_cv_fold(Creator&& creator, const cv_fold& fold,
+                                       std::pair<double, double>* seconds)
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    py::object cls;
+    classify::classifier* ptr;
+    {
+        py::gil_scoped_acquire acq;
+        try
+        {
+            cls = creator(fold.first);
+            ptr = cls.cast<classify::classifier*>();
+        }
+        catch (py::error_already_set& ex)
+        {
+            throw worker_python_error{ex};
+        }
+    }
+    auto trained = clock::now();
+
+    classify::confusion_matrix matrix;
+    try
+    {
+        matrix = ptr->test(fold.second);
+    }
+    catch (...)
+    {
+        py::gil_scoped_acquire acq;
+        cls = py::object{};
+        throw;
+    }
+
+    if (seconds)
+    {
+        using secs = std::chrono::duration<double>;
+        seconds->first = secs(trained - start).count();
+        seconds->second = secs(clock::now() - trained).count();
+    }
+
+    py::gil_scoped_acquire acq;
+    cls = py::object{};
+    return matrix;
+}
+
+/**
+ * Cross-validates the folds concurrently; the per-fold confusion matrices
+ * are merged in fold order. Each fold's views are made by the thread
+ * that runs it.
+ */
+classify::confusion_matrix
+parallel_cross_validate(const cv_creator_type& creator,
+                        classify::multiclass_dataset_view docs, std::size_t k,
+                        bool even_split, std::size_t num_threads)
+{
+    cv_folds folds{std::move(docs), k, even_split};
+    std::vector<classify::confusion_matrix> results(k);
+    {
+        py::gil_scoped_release rel;
+        parallel_for_blocks(k, num_threads, [&](std::size_t start,
+                                                std::size_t end) {
+            for (auto i = start; i < end; ++i)
+                results[i] = run_cv_fold(creator, folds[i], nullptr);
+        });
+    }
+
+    classify::confusion_matrix matrix;
+    for (const auto& fold : results)
+    {
+        matrix += fold;
+        matrix.add_fold_accuracy(fold.accuracy());
+    }
+    return matrix;
+}
+
+/**
+ * Expands a parameter grid (a dict mapping parameter names to lists of
+ * values, or a list of such dicts) into every configuration it describes,
+ * each a dict of keyword arguments.
+ */
+std::vector<py::dict> expand_param_grid(py::object grid)
+{
+    std::vector<py::dict> configs;
+    auto expand = [&](py::handle subgrid) {
+        std::vector<std::pair<py::object, std::vector<py::object>>> params;
+        for (auto item : subgrid.cast<py::dict>())
+        {
+            std::vector<py::object> values;
+            for (auto value : item.second)
+                values.push_back(py::reinterpret_borrow<py::object>(value));
+            if (values.empty())
+                return;
+            params.emplace_back(
+                py::reinterpret_borrow<py::object>(item.first),
+                std::move(values));
+        }
+
+        // odometer over the value lists, last parameter fastest
+        std::vector<std::size_t> pos(params.size(), 0);
+        while (true)
+        {
+            py::dict config;
+            for (std::size_t p = 0; p < params.size(); ++p)
+                config[params[p].first] = params[p].second[pos[p]];
+            configs.push_back(std::move(config));
+
+            auto p = params.size();
+            while (p > 0 && ++pos[p - 1] == params[p - 1].second.size())
+                pos[--p] = 0;
+            if (p == 0)
+                break;
+        }
+    };
+
+    if (py::hasattr(grid, "items"))
+        expand(grid);
+    else
+        for (auto subgrid : grid)
+            expand(subgrid);
+    return configs;
+}
+
+/**
+ * Cross-validates every configuration of a parameter grid. Every
+ * (configuration, fold) pair is a separate task; idle threads claim the
+ * next unstarted task, so slow configurations don't hold up the others.
+ * All tasks share the same shuffled fold layout; each task makes the
+ * views of its fold. Once a task fails no new tasks are started, and the
+ * exception of the earliest failed task (in grid order) is rethrown on
+ * the calling thread.
+ *
+ * @return a list with one dict per configuration, in grid order
+ */
+py::list grid_search(py::object classifier_type, py::object param_grid,
+                     classify::multiclass_dataset_view docs, std::size_t k,
+                     bool even_split, std::size_t num_threads)
+{
+    auto configs = expand_param_grid(std::move(param_grid));
+    cv_folds folds{std::move(docs), k, even_split};
+
+    auto num_tasks = configs.size() * k;
+    std::vector<classify::confusion_matrix> results(num_tasks);
+    std::vector<std::pair<double, double>> seconds(num_tasks);
+    std::vector<std::exception_ptr> errors(num_tasks);
+    {
+        std::atomic<std::size_t> next_task{0};
+        std::atomic<bool> failed{false};
+        py::gil_scoped_release rel;
+        parallel_for_blocks(
+            num_threads, num_threads, [&](std::size_t, std::size_t) {
+                std::size_t task;
+                while (!failed && (task = next_task++) < num_tasks)
+                {
+                    const auto& config = configs[task / k];
+                    auto creator = [&](
+                        const classify::multiclass_dataset_view& train) {
+                        return classifier_type(train, **config);
+                    };
+                    try
+                    {
+                        results[task] = run_cv_fold(
+                            creator, folds[task % k], &seconds[task]);
+                    }
+                    catch (...)
+                    {
+                        errors[task] = std::current_exception();
+                        failed = true;
+                    }
+                }
+            });
+    }
+    for (const auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    py::list table;
+    for (std::size_t c = 0; c < configs.size(); ++c)
+    {
+        classify::confusion_matrix matrix;
+        py::list fold_accuracies;
+        double train_seconds = 0;
+        double test_seconds = 0;
+        double mean = 0;
+        for (std::size_t f = 0; f < k; ++f)
+        {
+            const auto& fold = results[c * k + f];
+            matrix += fold;
+            matrix.add_fold_accuracy(fold.accuracy());
+            fold_accuracies.append(py::cast(fold.accuracy()));
+            mean += fold.accuracy() / k;
+            train_seconds += seconds[c * k + f].first;
+            test_seconds += seconds[c * k + f].second;
+        }
+
+        double variance = 0;
+        for (std::size_t f = 0; f < k; ++f)
+        {
+            auto diff = results[c * k + f].accuracy() - mean;
+            variance += diff * diff / k;
+        }
+
+        py::dict row;
+        row["params"] = configs[c];
+        row["accuracy"] = py::cast(mean);
+        row["accuracy_std"] = py::cast(std::sqrt(variance));
+        row["fold_accuracies"] = fold_accuracies;
+        row["train_seconds"] = py::cast(train_seconds);
+        row["test_seconds"] = py::cast(test_seconds);
+        row["matrix"] = py::cast(std::move(matrix));
+        table.append(row);
+    }
+    return table;
+}
+
+/**
+ * The arguments of an SGD classifier, parsed from the keyword arguments
+ * given to an ensemble method. This lets OneVsAll and OneVsOne create
+ * their SGD subclassifiers natively instead of calling back into Python
+ * (and taking the GIL) for each one.
+ */
+struct sgd_factory
+{
+    std::string loss_id;
+    learn::sgd_model::options_type options;
+    double gamma = classify::sgd::default_gamma;
+    std::size_t max_iter = classify::sgd::default_max_iter;
+    bool calibrate = true;
+
+    explicit sgd_factory(const py::kwargs& kwargs)
+    {
+        for (const auto& item : kwargs)
+        {
+            auto key = item.first.cast<std::string>();
+            if (key == "loss_id")
+                loss_id = item.second.cast<std::string>();
+            else if (key == "options")
+                options = item.second.cast<learn::sgd_model::options_type>();
+            else if (key == "gamma")
+                gamma = item.second.cast<double>();
+            else if (key == "max_iter")
+                max_iter = item.second.cast<std::size_t>();
+            else if (key == "calibrate")
+                calibrate = item.second.cast<bool>();
+            else
+                throw py::type_error{"unexpected keyword argument for SGD: "
+                                     + key};
+        }
+        if (loss_id.empty())
+            throw py::type_error{"SGD requires a loss_id"};
+        // fail early on unknown losses rather than in a worker thread
+        learn::loss::make_loss_function(loss_id);
+    }
+
+    std::unique_ptr<classify::binary_classifier>
+    operator()(const classify::binary_dataset_view& bdv) const
+    {
+        return make_unique<classify::sgd>(
+            bdv, learn::loss::make_loss_function(loss_id), options, gamma,
+            max_iter, calibrate);
+    }
 };
 
+/**
+ * Training is deterministic (seeded and single-threaded) when a seed is
+ * given, and otherwise uses num_threads Hogwild-style threads.
+ */
+linear_model::fit_options make_fit_options(double gamma, std::size_t max_iter,
+                                           std::size_t num_threads,
+                                           py::object seed)
+{
+    linear_model::fit_options fopts;
+    fopts.gamma = gamma;
+    fopts.max_iter = max_iter;
+    fopts.num_threads = num_threads;
+    fopts.deterministic = !seed.is_none();
+    if (fopts.deterministic)
+        fopts.seed = seed.cast<uint64_t>();
+    return fopts;
+}
+
+py::dict epoch_stats_dict(const epoch_stats& stats)
+{
+    py::dict ret;
+    ret["epoch"] = py::cast(stats.epoch);
+    ret["loss"] = py::cast(stats.loss);
+    ret["seconds"] = py::cast(stats.seconds);
+    ret["examples_per_second"] = py::cast(stats.examples_per_second);
+    ret["weight_norm"] = py::cast(stats.weight_norm);
+    ret["holdout_accuracy"] = py::cast(stats.holdout_accuracy);
+    return ret;
+}
+
+/**
+ * Creates the monitor for a training run, or returns null if there is
+ * neither a callback nor a held-out set. The callback is given lists of
+ * epoch stats (as dicts), at most once every interval seconds, and may
+ * return False to stop training. It is called from the training thread,
+ * which acquires the GIL to do so. This must be called with the GIL held.
+ * An exception raised by the callback ends training and is raised again,
+ * unchanged, by the learner's constructor.
+ */
+std::unique_ptr<training_monitor>
+make_training_monitor(py::object callback, double interval,
+                      bool has_holdout, std::size_t patience)
+{
+    if (callback.is_none() && !has_holdout)
+        return nullptr;
+
+    training_monitor::sink_type sink;
+    if (!callback.is_none())
+        sink = [callback](const std::vector<epoch_stats>& batch) {
+            py::gil_scoped_acquire acq;
+            try
+            {
+                py::list reports;
+                for (const auto& stats : batch)
+                    reports.append(epoch_stats_dict(stats));
+                auto result = callback(reports);
+                return result.is_none() || result.cast<bool>();
+            }
+            catch (py::error_already_set& ex)
+            {
+                throw worker_python_error{ex};
+            }
+        };
+    return make_unique<training_monitor>(std::move(sink), interval,
+                                         patience);
+}
+
+template <class View>
+std::unique_ptr<View> make_holdout(py::object holdout)
+{
+    if (holdout.is_none())
+        return nullptr;
+    return make_unique<View>(holdout.cast<View>());
+}
+
+/**
+ * Binds an __init__ of a linear learner (LinearSGD or LinearOneVsAll)
+ * that trains on a view of a CSR dataset, or on a CSR dataset (including
+ * a memory mapped one) through its implicit conversion to a view. The
+ * rows are read straight from the CSR arrays, so no feature_vector copy
+ * of the dataset is ever made.
+ */
+template <class CSRView, class Learner>
+void bind_linear_csr_init(py::class_<Learner>& cls, double default_gamma,
+                          std::size_t default_max_iter)
+{
+    cls.def("__init__",
+            [](Learner& learner, const CSRView& training,
+               const std::string& loss_id,
+               learn::sgd_model::options_type options, double gamma,
+               std::size_t max_iter, std::size_t num_threads,
+               py::object seed, py::object callback,
+               double callback_interval, py::object holdout,
+               std::size_t patience) {
+                auto loss = learn::loss::make_loss_function(loss_id);
+                auto fopts
+                    = make_fit_options(gamma, max_iter, num_threads, seed);
+                auto held_out = make_holdout<CSRView>(holdout);
+                auto monitor = make_training_monitor(
+                    callback, callback_interval, held_out != nullptr,
+                    patience);
+                py::gil_scoped_release rel;
+                new (&learner) Learner(training, std::move(loss), options,
+                                       fopts, monitor.get(), held_out.get());
+            },
+            py::arg("training"), py::arg("loss_id"),
+            py::arg("options") = learn::sgd_model::options_type{},
+            py::arg("gamma") = default_gamma,
+            py::arg("max_iter") = default_max_iter,
+            py::arg("num_threads") = 1, py::arg("seed") = py::none(),
+            py::arg("callback") = py::none(),
+            py::arg("callback_interval") = 1.0,
+            py::arg("holdout") = py::none(), py::arg("patience") = 0);
+}
+
+/**
+ * Writes a model file with the GIL released, storing the weights in
+ * single precision if float32 is true.
+ */
+template <class WeightFunction>
+void save_model_file(const std::string& path,
+                     const model_file_contents& contents, bool float32,
+                     WeightFunction&& weight)
+{
+    py::gil_scoped_release rel;
+    if (float32)
+        write_model_file<float>(path, contents, weight);
+    else
+        write_model_file<double>(path, contents, weight);
+}
+
+void save_mapped_linear(const linear_model& model,
+                        std::vector<std::string> labels, bool binary,
+                        const std::string& path, bool float32)
+{
+    model_file_contents contents;
+    contents.num_features = model.num_features();
+    contents.binary = binary;
+    contents.labels = std::move(labels);
+    for (std::size_t o = 0; o < model.num_outputs(); ++o)
+    {
+        contents.bias.push_back(model.bias(o));
+        contents.unseen.push_back(0);
+    }
+    save_model_file(path, contents, float32, [&](uint64_t f, double* out) {
+        for (std::size_t o = 0; o < model.num_outputs(); ++o)
+            out[o] = model.weight(f, o);
+    });
+}
+
+/**
+ * Naive Bayes is linear in the feature counts: the score of a label is
+ * its log prior plus the count-weighted log probabilities of the
+ * features.
+ */
+void save_mapped_naive_bayes(const online_naive_bayes& nb,
+                             const std::string& path, bool float32)
+{
+    model_file_contents contents;
+    contents.num_features = nb.total_features();
+    contents.labels = nb.labels();
+    for (std::size_t l = 0; l < nb.labels().size(); ++l)
+    {
+        contents.bias.push_back(nb.log_prior(l));
+        contents.unseen.push_back(
+            nb.log_term_probability(l, nb.total_features()));
+    }
+    save_model_file(path, contents, float32, [&](uint64_t f, double* out) {
+        for (std::size_t l = 0; l < nb.labels().size(); ++l)
+            out[l] = nb.log_term_probability(l, f);
+    });
+}
+
 void metapy_bind_classify(py::module& m)
 {
     auto pydset = (py::object)m.attr("learn").attr("Dataset");
     auto pydset_view = (py::object)m.attr("learn").attr("DatasetView");
     auto m_classify = m.def_submodule("classify");
 
+    classify::classifier_loader::get().add(
+        online_naive_bayes::id, [](std::istream& in) {
+            return make_unique<online_naive_bayes>(in);
+        });
+
+    py::register_exception_translator([](std::exception_ptr ptr) {
+        try
+        {
+            if (ptr)
+                std::rethrow_exception(ptr);
+        }
+        catch (const worker_python_error& ex)
+        {
+            ex.restore();
+        }
+    });
+
     // binary datasets/views
     py::class_<classify::binary_dataset>{m_classify, "BinaryDataset", pydset}
         .def("__init__",
@@ -190,6 +1056,28 @@ void metapy_bind_classify(py::module& m)
                          return py::cast<bool>(labeler(obj));
                      });
              })
+        .def("__init__",
+             [](classify::binary_dataset& dset, const py_id_array& indptr,
+                const py_id_array& indices, const py_value_array& data,
+                std::size_t total_features, const py_label_mask& labels) {
+                 new (&dset) classify::binary_dataset(make_binary_csr_dataset(
+                     {indptr, indices, data, total_features}, labels));
+             },
+             py::arg("indptr"), py::arg("indices"), py::arg("data"),
+             py::arg("total_features"), py::arg("labels"))
+        .def_static("from_csr",
+                    [](py::object matrix, const py_label_mask& labels) {
+                        return with_scipy_csr(
+                            matrix, [&](const py_id_array& indptr,
+                                        const py_id_array& indices,
+                                        const py_value_array& data,
+                                        std::size_t total_features) {
+                                return make_binary_csr_dataset(
+                                    {indptr, indices, data, total_features},
+                                    labels);
+                            });
+                    },
+                    py::arg("matrix"), py::arg("labels"))
         .def("label", &classify::binary_dataset::label)
         .def("__getitem__",
              [](const classify::binary_dataset& dset, int64_t offset) {
@@ -207,8 +1095,9 @@ void metapy_bind_classify(py::module& m)
              },
              py::keep_alive<0, 1>());
 
-    py::class_<classify::binary_dataset_view>{m_classify, "BinaryDatasetView",
-                                              pydset_view}
+    py::class_<classify::binary_dataset_view> pybdset_view{
+        m_classify, "BinaryDatasetView", pydset_view};
+    pybdset_view
         .def(py::init<const classify::binary_dataset&>(),
              py::keep_alive<0, 1>())
         .def("__getitem__",
@@ -228,6 +1117,14 @@ void metapy_bind_classify(py::module& m)
 
     py::implicitly_convertible<classify::binary_dataset,
                                classify::binary_dataset_view>();
+    bind_csr_view_init(pybdset_view,
+                       &csr_dataset64::materialized_binary_dataset);
+    bind_csr_view_init(pybdset_view,
+                       &csr_dataset32::materialized_binary_dataset);
+    bind_csr_view_init<csr_dataset_view64>(
+        pybdset_view, &csr_dataset64::materialized_binary_dataset);
+    bind_csr_view_init<csr_dataset_view32>(
+        pybdset_view, &csr_dataset32::materialized_binary_dataset);
 
     // multiclass datasets/views
     py::class_<classify::multiclass_dataset>{m_classify, "MulticlassDataset",
@@ -259,6 +1156,31 @@ void metapy_bind_classify(py::module& m)
                          return py::cast<class_label>(labeler(obj));
                      });
              })
+        .def("__init__",
+             [](classify::multiclass_dataset& dset, const py_id_array& indptr,
+                const py_id_array& indices, const py_value_array& data,
+                std::size_t total_features,
+                const std::vector<class_label>& labels) {
+                 new (&dset)
+                     classify::multiclass_dataset(make_multiclass_csr_dataset(
+                         {indptr, indices, data, total_features}, labels));
+             },
+             py::arg("indptr"), py::arg("indices"), py::arg("data"),
+             py::arg("total_features"), py::arg("labels"))
+        .def_static(
+            "from_csr",
+            [](py::object matrix, const std::vector<class_label>& labels) {
+                return with_scipy_csr(
+                    matrix, [&](const py_id_array& indptr,
+                                const py_id_array& indices,
+                                const py_value_array& data,
+                                std::size_t total_features) {
+                        return make_multiclass_csr_dataset(
+                            {indptr, indices, data, total_features},
+                            labels);
+                    });
+            },
+            py::arg("matrix"), py::arg("labels"))
         .def("label",
              [](const classify::multiclass_dataset& dset,
                 const learn::instance& inst) { return dset.label(inst); })
@@ -281,8 +1203,9 @@ void metapy_bind_classify(py::module& m)
              },
              py::keep_alive<0, 1>());
 
-    py::class_<classify::multiclass_dataset_view>{
-        m_classify, "MulticlassDatasetView", pydset_view}
+    py::class_<classify::multiclass_dataset_view> pymdset_view{
+        m_classify, "MulticlassDatasetView", pydset_view};
+    pymdset_view
         .def(py::init<const classify::multiclass_dataset&>(),
              py::keep_alive<0, 1>())
         .def("__getitem__",
@@ -315,6 +1238,14 @@ void metapy_bind_classify(py::module& m)
 
     py::implicitly_convertible<classify::multiclass_dataset,
                                classify::multiclass_dataset_view>();
+    bind_csr_view_init(pymdset_view,
+                       &csr_dataset64::materialized_multiclass_dataset);
+    bind_csr_view_init(pymdset_view,
+                       &csr_dataset32::materialized_multiclass_dataset);
+    bind_csr_view_init<csr_dataset_view64>(
+        pymdset_view, &csr_dataset64::materialized_multiclass_dataset);
+    bind_csr_view_init<csr_dataset_view32>(
+        pymdset_view, &csr_dataset32::materialized_multiclass_dataset);
 
     // confusion matrix
     py::class_<classify::confusion_matrix>{m_classify, "ConfusionMatrix"}
@@ -372,14 +1303,128 @@ void metapy_bind_classify(py::module& m)
         .def_static("mcnemar_significant",
                     &classify::confusion_matrix::mcnemar_significant);
 
+    py::class_<dense_confusion_matrix>{m_classify, "DenseConfusionMatrix"}
+        .def(py::init<std::vector<std::string>>(), py::arg("labels"))
+        .def("add", &dense_confusion_matrix::add, py::arg("predicted"),
+             py::arg("actual"), py::arg("num_times") = 1)
+        .def("add_batch",
+             [](dense_confusion_matrix& matrix, const py_id_array& predicted,
+                const py_id_array& actual,
+                const std::vector<std::string>& predicted_labels,
+                py::object actual_labels, std::size_t num_threads) {
+                 if (predicted.size() != actual.size())
+                     throw py::value_error{
+                         "predicted and actual must have the same length"};
+                 auto act_labels
+                     = actual_labels.is_none()
+                           ? matrix.labels()
+                           : actual_labels.cast<std::vector<std::string>>();
+                 auto size = static_cast<std::size_t>(predicted.size());
+                 auto pred = predicted.data();
+                 auto act = actual.data();
+                 py::gil_scoped_release release;
+                 matrix.add_batch(pred, predicted_labels, act, act_labels,
+                                  size, num_threads);
+             },
+             py::arg("predicted"), py::arg("actual"),
+             py::arg("predicted_labels"),
+             py::arg("actual_labels") = py::none(),
+             py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def("add_batch",
+             [](dense_confusion_matrix& matrix, const py_id_array& predicted,
+                const py_id_array& actual, std::size_t num_threads) {
+                 if (predicted.size() != actual.size())
+                     throw py::value_error{
+                         "predicted and actual must have the same length"};
+                 auto size = static_cast<std::size_t>(predicted.size());
+                 auto pred = predicted.data();
+                 auto act = actual.data();
+                 py::gil_scoped_release release;
+                 matrix.add_batch(pred, act, size, num_threads);
+             },
+             py::arg("predicted"), py::arg("actual"),
+             py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def("count", &dense_confusion_matrix::count, py::arg("predicted"),
+             py::arg("actual"))
+        .def("counts",
+             [](const dense_confusion_matrix& matrix) {
+                 const auto& counts = matrix.counts();
+                 py::object arr = py::array(counts.size(), counts.data());
+                 return arr.attr("reshape")(matrix.num_labels(),
+                                            matrix.num_labels());
+             })
+        .def("labels", &dense_confusion_matrix::labels)
+        .def("predictions", &dense_confusion_matrix::predictions)
+        .def("accuracy", &dense_confusion_matrix::accuracy)
+        .def("f1_score",
+             [](const dense_confusion_matrix& matrix) {
+                 return matrix.f1_score();
+             })
+        .def("f1_score",
+             [](const dense_confusion_matrix& matrix, uint64_t lbl) {
+                 return matrix.f1_score(lbl);
+             })
+        .def("precision",
+             [](const dense_confusion_matrix& matrix) {
+                 return matrix.precision();
+             })
+        .def("precision",
+             [](const dense_confusion_matrix& matrix, uint64_t lbl) {
+                 return matrix.precision(lbl);
+             })
+        .def("recall",
+             [](const dense_confusion_matrix& matrix) {
+                 return matrix.recall();
+             })
+        .def("recall",
+             [](const dense_confusion_matrix& matrix, uint64_t lbl) {
+                 return matrix.recall(lbl);
+             })
+        .def("to_confusion_matrix",
+             &dense_confusion_matrix::to_confusion_matrix)
+        .def("__str__",
+             [](const dense_confusion_matrix& matrix) {
+                 std::stringstream ss;
+                 matrix.to_confusion_matrix().print(ss);
+                 return ss.str();
+             })
+        .def("print_stats",
+             [](const dense_confusion_matrix& matrix) {
+                 std::stringstream ss;
+                 matrix.to_confusion_matrix().print_stats(ss);
+                 py::print(ss.str());
+             })
+        .def(py::self + py::self)
+        .def(py::self += py::self);
+
     // kernels
     auto m_kernel = m_classify.def_submodule("kernel");
     py::class_<classify::kernel::kernel, py_kernel> pykernel{m_classify,
                                                              "Kernel"};
-    pykernel.def("__call__", &classify::kernel::kernel::operator());
+    pykernel.def("__call__", &classify::kernel::kernel::operator())
+        .def("batch",
+             [](const classify::kernel::kernel& kernel,
+                const learn::feature_vector& x, py::list docs) {
+                 std::vector<double> values;
+                 values.reserve(docs.size());
+                 for (auto doc : docs)
+                     values.push_back(
+                         kernel(x, doc.cast<const learn::feature_vector&>()));
+                 return py::array(values.size(), values.data());
+             },
+             "Evaluates the kernel between x and each of a list of "
+             "documents. Python kernels may override this to evaluate a "
+             "whole batch at once.",
+             py::arg("x"), py::arg("docs"));
 
-    py::class_<classify::kernel::polynomial>{m_kernel, "Polynomial", pykernel}
-        .def(py::init<uint8_t, double>(),
+    // the vectorized kernels are used in place of MeTA's; the alias type
+    // makes room for them in the Python instance
+    py::class_<classify::kernel::polynomial, simd_polynomial>{
+        m_kernel, "Polynomial", pykernel}
+        .def("__init__",
+             [](classify::kernel::polynomial& kern, uint8_t power, double c) {
+                 new (&kern) simd_polynomial(power, c);
+             },
              py::arg("power") = classify::kernel::polynomial::default_power,
              py::arg("c") = classify::kernel::polynomial::default_c)
         .def_property_readonly_static(
@@ -399,8 +1444,13 @@ void metapy_bind_classify(py::module& m)
             return classify::kernel::radial_basis::id.to_string();
         });
 
-    py::class_<classify::kernel::sigmoid>{m_kernel, "Sigmoid", pykernel}
-        .def(py::init<double, double>(), py::arg("alpha"), py::arg("c"))
+    py::class_<classify::kernel::sigmoid, simd_sigmoid>{m_kernel, "Sigmoid",
+                                                        pykernel}
+        .def("__init__",
+             [](classify::kernel::sigmoid& kern, double alpha, double c) {
+                 new (&kern) simd_sigmoid(alpha, c);
+             },
+             py::arg("alpha"), py::arg("c"))
         .def_property_readonly_static("id", [](py::object /* self */) {
             return classify::kernel::sigmoid::id.to_string();
         });
@@ -416,7 +1466,11 @@ void metapy_bind_classify(py::module& m)
     py_online_bincls.def("train", &classify::online_binary_classifier::train)
         .def("train_one", &classify::online_binary_classifier::train_one);
 
-    py::class_<classify::sgd>{m_classify, "SGD", py_online_bincls}
+    py::class_<classify::sgd> pysgd{
+        m_classify, "SGD", py_online_bincls,
+        "A binary classifier trained with SGD inside MeTA, which reports no "
+        "progress. Use LinearSGD for progress callbacks and early stopping."};
+    pysgd
         .def_property_readonly_static(
             "id",
             [](py::object /* self */) { return classify::sgd::id.to_string(); })
@@ -442,29 +1496,113 @@ void metapy_bind_classify(py::module& m)
              py::arg("max_iter") = classify::sgd::default_max_iter,
              py::arg("calibrate") = true);
 
+    py::class_<linear_sgd> pylinear_sgd{m_classify, "LinearSGD", pybincls};
+    pylinear_sgd
+        .def("__init__",
+             [](linear_sgd& cls, classify::binary_dataset_view training,
+                const std::string& loss_id,
+                learn::sgd_model::options_type options, double gamma,
+                std::size_t max_iter, std::size_t num_threads,
+                py::object seed, py::object callback,
+                double callback_interval, py::object holdout,
+                std::size_t patience) {
+                 auto loss = learn::loss::make_loss_function(loss_id);
+                 auto fopts = make_fit_options(gamma, max_iter, num_threads,
+                                               seed);
+                 auto held_out
+                     = make_holdout<classify::binary_dataset_view>(holdout);
+                 auto monitor = make_training_monitor(
+                     callback, callback_interval, held_out != nullptr,
+                     patience);
+                 py::gil_scoped_release rel;
+                 new (&cls) linear_sgd(std::move(training), std::move(loss),
+                                       options, fopts, monitor.get(),
+                                       held_out.get());
+             },
+             py::arg("training"), py::arg("loss_id"),
+             py::arg("options") = learn::sgd_model::options_type{},
+             py::arg("gamma") = classify::sgd::default_gamma,
+             py::arg("max_iter") = classify::sgd::default_max_iter,
+             py::arg("num_threads") = 1, py::arg("seed") = py::none(),
+             py::arg("callback") = py::none(),
+             py::arg("callback_interval") = 1.0,
+             py::arg("holdout") = py::none(), py::arg("patience") = 0)
+        .def("epoch_losses", &linear_sgd::epoch_losses)
+        .def("weight",
+             [](const linear_sgd& cls, learn::feature_id fid) {
+                 if (fid >= cls.model().num_features())
+                     throw py::index_error();
+                 return cls.model().weight(fid, 0);
+             })
+        .def("bias", [](const linear_sgd& cls) { return cls.model().bias(0); })
+        .def("save_mapped",
+             [](const linear_sgd& cls, const std::string& path,
+                bool float32) {
+                 save_mapped_linear(cls.model(), {"positive"}, true, path,
+                                    float32);
+             },
+             "Saves the model in a format that load_mapped can memory map",
+             py::arg("path"), py::arg("float32") = false);
+    bind_linear_csr_init<csr_dataset_view64>(
+        pylinear_sgd, classify::sgd::default_gamma,
+        classify::sgd::default_max_iter);
+    bind_linear_csr_init<csr_dataset_view32>(
+        pylinear_sgd, classify::sgd::default_gamma,
+        classify::sgd::default_max_iter);
+
+    py::class_<mapped_linear_binary_classifier>{
+        m_classify, "MappedLinearBinaryClassifier", pybincls}
+        .def("__init__",
+             [](mapped_linear_binary_classifier& cls,
+                const std::string& path) {
+                 new (&cls) mapped_linear_binary_classifier(
+                     mapped_linear_model{path});
+             },
+             py::arg("path"))
+        .def("num_features",
+             [](const mapped_linear_binary_classifier& cls) {
+                 return cls.model().num_features();
+             })
+        .def("float32",
+             [](const mapped_linear_binary_classifier& cls) {
+                 return cls.model().single_precision();
+             })
+        .def_property_readonly("path",
+                               [](const mapped_linear_binary_classifier& cls) {
+                                   return cls.model().path();
+                               });
+
     // multiclass classifiers
     py::class_<classify::classifier, py_classifier<>> pycls{m_classify,
                                                             "Classifier"};
     pycls.def("classify", &classify::classifier::classify)
         .def("test", &classify::classifier::test);
 
+    // batch APIs; CSR views are read row by row without materializing them
+    bind_batch_methods<csr_dataset_view64>(pycls, pybincls);
+    bind_batch_methods<csr_dataset_view32>(pycls, pybincls);
+    bind_batch_methods<learn::dataset_view>(pycls, pybincls);
+
     py::class_<classify::online_classifier, py_online_classifier> py_online_cls{
         m_classify, "OnlineClassifier", pycls};
     py_online_cls.def("train", &classify::online_classifier::train)
         .def("train_one", &classify::online_classifier::train_one);
 
-    py::class_<classify::dual_perceptron>{m_classify, "DualPerceptron", pycls}
+    py::class_<classify::dual_perceptron>{
+        m_classify, "DualPerceptron", pycls,
+        "A kernel perceptron trained inside MeTA, which reports no progress. "
+        "Use KernelPerceptron for progress callbacks and early stopping."}
         .def("__init__",
              [](classify::dual_perceptron& cls,
                 classify::multiclass_dataset_view training,
                 const classify::kernel::kernel& kernel, double alpha,
                 double gamma, double bias, uint64_t max_iter) {
-                 std::stringstream ss;
-                 kernel.save(ss);
+                 auto kern = copy_native_kernel(kernel);
 
+                 py::gil_scoped_release rel;
                  new (&cls) classify::dual_perceptron(
-                     std::move(training), classify::kernel::load_kernel(ss),
-                     alpha, gamma, bias, max_iter);
+                     std::move(training), std::move(kern), alpha, gamma, bias,
+                     max_iter);
              },
              py::arg("training"), py::arg("kernel"),
              py::arg("alpha") = classify::dual_perceptron::default_alpha,
@@ -480,6 +1618,53 @@ void metapy_bind_classify(py::module& m)
         .def_readonly_static("default_max_iter",
                              &classify::dual_perceptron::default_max_iter);
 
+    py::class_<kernel_perceptron>{m_classify, "KernelPerceptron", pycls}
+        .def("__init__",
+             [](kernel_perceptron& cls,
+                classify::multiclass_dataset_view training, py::object kernel,
+                double alpha, double gamma, double bias, uint64_t max_iter,
+                std::size_t cache_size, std::size_t num_threads,
+                uint64_t seed, py::object callback, double callback_interval,
+                py::object holdout, std::size_t patience) {
+                 auto batch = make_batch_kernel(std::move(kernel));
+                 auto held_out
+                     = make_holdout<classify::multiclass_dataset_view>(
+                         holdout);
+                 auto monitor = make_training_monitor(
+                     callback, callback_interval, held_out != nullptr,
+                     patience);
+                 py::gil_scoped_release rel;
+                 new (&cls) kernel_perceptron(
+                     std::move(training), std::move(batch), alpha, gamma,
+                     bias, max_iter, cache_size, num_threads, seed,
+                     monitor.get(), held_out.get());
+             },
+             py::arg("training"), py::arg("kernel"),
+             py::arg("alpha") = kernel_perceptron::default_alpha,
+             py::arg("gamma") = kernel_perceptron::default_gamma,
+             py::arg("bias") = kernel_perceptron::default_bias,
+             py::arg("max_iter") = kernel_perceptron::default_max_iter,
+             py::arg("cache_size") = kernel_perceptron::default_cache_size,
+             py::arg("num_threads") = 1, py::arg("seed") = 1,
+             py::arg("callback") = py::none(),
+             py::arg("callback_interval") = 1.0,
+             py::arg("holdout") = py::none(), py::arg("patience") = 0)
+        .def("num_support_vectors", &kernel_perceptron::num_support_vectors)
+        .def("epoch_errors", &kernel_perceptron::epoch_errors)
+        .def("cache_stats",
+             [](const kernel_perceptron& cls) {
+                 return py::make_tuple(cls.cache_hits(), cls.cache_misses());
+             })
+        .def_readonly_static("default_alpha",
+                             &kernel_perceptron::default_alpha)
+        .def_readonly_static("default_gamma",
+                             &kernel_perceptron::default_gamma)
+        .def_readonly_static("default_bias", &kernel_perceptron::default_bias)
+        .def_readonly_static("default_max_iter",
+                             &kernel_perceptron::default_max_iter)
+        .def_readonly_static("default_cache_size",
+                             &kernel_perceptron::default_cache_size);
+
     py::class_<classify::knn>{m_classify, "KNN", pycls}.def(
         "__init__",
         [](classify::knn& cls, classify::multiclass_dataset_view training,
@@ -488,16 +1673,76 @@ void metapy_bind_classify(py::module& m)
             std::stringstream ss;
             ranker.save(ss);
 
+            py::gil_scoped_release rel;
             new (&cls) classify::knn(std::move(training), std::move(idx), k,
                                      index::load_ranker(ss), weighted);
         },
         py::arg("training"), py::arg("inv_idx"), py::arg("k"),
         py::arg("ranker"), py::arg("weighted") = false);
 
-    py::class_<classify::logistic_regression>{m_classify, "LogisticRegression",
-                                              pycls}
-        .def(py::init<classify::multiclass_dataset_view,
-                      learn::sgd_model::options_type, double, uint64_t>(),
+    py::class_<ann_knn>{m_classify, "ApproximateKNN", pycls}
+        .def("__init__",
+             [](ann_knn& cls, classify::multiclass_dataset_view training,
+                std::size_t k, std::size_t num_tables, std::size_t num_bits,
+                std::size_t num_probes, bool weighted, uint64_t seed) {
+                 py::gil_scoped_release rel;
+                 new (&cls) ann_knn(std::move(training), k, num_tables,
+                                    num_bits, num_probes, weighted, seed);
+             },
+             py::arg("training"), py::arg("k"),
+             py::arg("num_tables") = ann_knn::default_num_tables,
+             py::arg("num_bits") = ann_knn::default_num_bits,
+             py::arg("num_probes") = ann_knn::default_num_probes,
+             py::arg("weighted") = false, py::arg("seed") = 1)
+        .def("neighbors", &ann_knn::neighbors)
+        .def("exact_neighbors", &ann_knn::exact_neighbors)
+        .def("classify_exact", &ann_knn::classify_exact)
+        .def("label", &ann_knn::label)
+        .def("recall",
+             [](const ann_knn& cls, const learn::feature_vector& instance) {
+                 return cls.recall(instance);
+             })
+        .def("recall",
+             [](const ann_knn& cls, const learn::dataset_view& queries,
+                std::size_t num_threads) {
+                 std::vector<double> recalls(queries.size());
+                 {
+                     py::gil_scoped_release rel;
+                     parallel_for_blocks(
+                         queries.size(), num_threads,
+                         [&](std::size_t start, std::size_t end) {
+                             for (auto i = start; i < end; ++i)
+                                 recalls[i] = cls.recall(
+                                     instance_features(queries, i));
+                         });
+                 }
+                 double total = 0;
+                 for (auto r : recalls)
+                     total += r;
+                 return recalls.empty() ? 1.0 : total / recalls.size();
+             },
+             py::arg("queries"),
+             py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def_readonly_static("default_num_tables",
+                             &ann_knn::default_num_tables)
+        .def_readonly_static("default_num_bits", &ann_knn::default_num_bits)
+        .def_readonly_static("default_num_probes",
+                             &ann_knn::default_num_probes);
+
+    py::class_<classify::logistic_regression>{
+        m_classify, "LogisticRegression", pycls,
+        "A multiclass logistic regression trained inside MeTA, which reports "
+        "no progress. Use LinearOneVsAll with the 'logistic' loss for "
+        "progress callbacks and early stopping."}
+        .def("__init__",
+             [](classify::logistic_regression& cls,
+                classify::multiclass_dataset_view training,
+                learn::sgd_model::options_type options, double gamma,
+                uint64_t max_iter) {
+                 py::gil_scoped_release rel;
+                 new (&cls) classify::logistic_regression(
+                     std::move(training), options, gamma, max_iter);
+             },
              py::arg("training"),
              py::arg("options") = learn::sgd_model::options_type{},
              py::arg("gamma") = classify::sgd::default_gamma,
@@ -505,7 +1750,14 @@ void metapy_bind_classify(py::module& m)
         .def("predict", &classify::logistic_regression::predict);
 
     py::class_<classify::naive_bayes>{m_classify, "NaiveBayes", pycls}
-        .def(py::init<classify::multiclass_dataset_view, double, double>(),
+        .def("__init__",
+             [](classify::naive_bayes& cls,
+                classify::multiclass_dataset_view training, double alpha,
+                double beta) {
+                 py::gil_scoped_release rel;
+                 new (&cls)
+                     classify::naive_bayes(std::move(training), alpha, beta);
+             },
              py::arg("training"),
              py::arg("alpha") = classify::naive_bayes::default_alpha,
              py::arg("beta") = classify::naive_bayes::default_beta)
@@ -514,15 +1766,90 @@ void metapy_bind_classify(py::module& m)
         .def_readonly_static("default_beta",
                              &classify::naive_bayes::default_beta);
 
+    py::class_<online_naive_bayes>{m_classify, "OnlineNaiveBayes",
+                                   py_online_cls}
+        .def("__init__",
+             [](online_naive_bayes& cls,
+                classify::multiclass_dataset_view training, double alpha,
+                double beta, std::size_t num_threads) {
+                 py::gil_scoped_release rel;
+                 new (&cls) online_naive_bayes(alpha, beta);
+                 cls.train(std::move(training), num_threads);
+             },
+             py::arg("training"),
+             py::arg("alpha") = online_naive_bayes::default_alpha,
+             py::arg("beta") = online_naive_bayes::default_beta,
+             py::arg("num_threads") = 1)
+        .def(py::init<double, double>(),
+             py::arg("alpha") = online_naive_bayes::default_alpha,
+             py::arg("beta") = online_naive_bayes::default_beta)
+        .def("train",
+             [](online_naive_bayes& cls,
+                classify::multiclass_dataset_view training,
+                std::size_t num_threads) {
+                 py::gil_scoped_release rel;
+                 cls.train(std::move(training), num_threads);
+             },
+             py::arg("training"), py::arg("num_threads") = 1)
+        .def("merge", &online_naive_bayes::merge, py::arg("other"))
+        .def("save",
+             [](const online_naive_bayes& cls, const std::string& path) {
+                 std::ofstream out{path, std::ios::binary};
+                 if (!out)
+                     throw std::runtime_error{"failed to open " + path};
+                 cls.save(out);
+             },
+             "Saves every count of the model, so that load can restore it "
+             "for further training or merging",
+             py::arg("path"))
+        .def_static(
+            "load",
+            [](const std::string& path) {
+                std::ifstream in{path, std::ios::binary};
+                if (!in)
+                    throw std::runtime_error{"failed to open " + path};
+                auto cls = classify::load_classifier(in);
+                auto nb = dynamic_cast<online_naive_bayes*>(cls.get());
+                if (!nb)
+                    throw classify::classifier_exception{
+                        path + " does not hold an online naive Bayes model"};
+                return std::move(*nb);
+            },
+            "Loads a model written by save", py::arg("path"))
+        .def("save_mapped", &save_mapped_naive_bayes,
+             "Saves the model in a format that load_mapped can memory map",
+             py::arg("path"), py::arg("float32") = false)
+        .def("num_docs", &online_naive_bayes::num_docs)
+        .def("labels", &online_naive_bayes::labels)
+        .def_readonly_static("default_alpha",
+                             &online_naive_bayes::default_alpha)
+        .def_readonly_static("default_beta",
+                             &online_naive_bayes::default_beta);
+
     py::class_<classify::nearest_centroid>{m_classify, "NearestCentroid", pycls}
-        .def(py::init<classify::multiclass_dataset_view,
-                      std::shared_ptr<index::inverted_index>>(),
+        .def("__init__",
+             [](classify::nearest_centroid& cls,
+                classify::multiclass_dataset_view training,
+                std::shared_ptr<index::inverted_index> inv_idx) {
+                 py::gil_scoped_release rel;
+                 new (&cls) classify::nearest_centroid(std::move(training),
+                                                       std::move(inv_idx));
+             },
              py::arg("training"), py::arg("inv_idx"));
 
+    py::object sgd_type = pysgd;
     py::class_<classify::one_vs_all>{m_classify, "OneVsAll", py_online_cls}.def(
         "__init__",
-        [](classify::one_vs_all& ova, classify::multiclass_dataset_view mdv,
-           py::object cls, py::kwargs kwargs) {
+        [sgd_type](classify::one_vs_all& ova,
+                   classify::multiclass_dataset_view mdv, py::object cls,
+                   py::kwargs kwargs) {
+            if (cls.ptr() == sgd_type.ptr())
+            {
+                sgd_factory factory{kwargs};
+                py::gil_scoped_release rel;
+                new (&ova) classify::one_vs_all(std::move(mdv), factory);
+                return;
+            }
 
             auto creator = [=](const classify::binary_dataset_view& bdv) {
                 // must acquire the GIL before calling back into Python
@@ -540,8 +1867,16 @@ void metapy_bind_classify(py::module& m)
 
     py::class_<classify::one_vs_one>{m_classify, "OneVsOne", py_online_cls}.def(
         "__init__",
-        [](classify::one_vs_one& ovo, classify::multiclass_dataset_view mdv,
-           py::object cls, py::kwargs kwargs) {
+        [sgd_type](classify::one_vs_one& ovo,
+                   classify::multiclass_dataset_view mdv, py::object cls,
+                   py::kwargs kwargs) {
+            if (cls.ptr() == sgd_type.ptr())
+            {
+                sgd_factory factory{kwargs};
+                py::gil_scoped_release rel;
+                new (&ovo) classify::one_vs_one(std::move(mdv), factory);
+                return;
+            }
 
             auto creator = [=](const classify::binary_dataset_view& bdv) {
                 // must acquire the GIL before calling back into Python
@@ -557,9 +1892,111 @@ void metapy_bind_classify(py::module& m)
             new (&ovo) classify::one_vs_one(std::move(mdv), std::move(creator));
         });
 
-    py::class_<classify::winnow>{m_classify, "Winnow", pycls}
-        .def(py::init<classify::multiclass_dataset_view, double, double,
-                      std::size_t>(),
+    py::class_<linear_one_vs_all> pylinear_ova{m_classify, "LinearOneVsAll",
+                                               pycls};
+    pylinear_ova
+        .def("__init__",
+             [](linear_one_vs_all& cls,
+                classify::multiclass_dataset_view training,
+                const std::string& loss_id,
+                learn::sgd_model::options_type options, double gamma,
+                std::size_t max_iter, std::size_t num_threads,
+                py::object seed, py::object callback,
+                double callback_interval, py::object holdout,
+                std::size_t patience) {
+                 auto loss = learn::loss::make_loss_function(loss_id);
+                 auto fopts = make_fit_options(gamma, max_iter, num_threads,
+                                               seed);
+                 auto held_out
+                     = make_holdout<classify::multiclass_dataset_view>(
+                         holdout);
+                 auto monitor = make_training_monitor(
+                     callback, callback_interval, held_out != nullptr,
+                     patience);
+                 py::gil_scoped_release rel;
+                 new (&cls) linear_one_vs_all(std::move(training),
+                                              std::move(loss), options, fopts,
+                                              monitor.get(), held_out.get());
+             },
+             py::arg("training"), py::arg("loss_id"),
+             py::arg("options") = learn::sgd_model::options_type{},
+             py::arg("gamma") = linear_one_vs_all::default_gamma,
+             py::arg("max_iter") = linear_one_vs_all::default_max_iter,
+             py::arg("num_threads") = 1, py::arg("seed") = py::none(),
+             py::arg("callback") = py::none(),
+             py::arg("callback_interval") = 1.0,
+             py::arg("holdout") = py::none(), py::arg("patience") = 0)
+        .def("epoch_losses", &linear_one_vs_all::epoch_losses)
+        .def("margins",
+             [](const linear_one_vs_all& cls,
+                const learn::feature_vector& instance) {
+                 auto margins = cls.margins(instance);
+                 return py::array(margins.size(), margins.data());
+             })
+        .def("labels", &linear_one_vs_all::labels)
+        .def("save_mapped",
+             [](const linear_one_vs_all& cls, const std::string& path,
+                bool float32) {
+                 std::vector<std::string> labels;
+                 for (const auto& lbl : cls.labels())
+                     labels.push_back(static_cast<std::string>(lbl));
+                 save_mapped_linear(cls.model(), std::move(labels), false,
+                                    path, float32);
+             },
+             "Saves the model in a format that load_mapped can memory map",
+             py::arg("path"), py::arg("float32") = false)
+        .def_readonly_static("default_gamma",
+                             &linear_one_vs_all::default_gamma)
+        .def_readonly_static("default_max_iter",
+                             &linear_one_vs_all::default_max_iter);
+    bind_linear_csr_init<csr_dataset_view64>(
+        pylinear_ova, linear_one_vs_all::default_gamma,
+        linear_one_vs_all::default_max_iter);
+    bind_linear_csr_init<csr_dataset_view32>(
+        pylinear_ova, linear_one_vs_all::default_gamma,
+        linear_one_vs_all::default_max_iter);
+
+    py::class_<mapped_linear_classifier>{m_classify, "MappedLinearClassifier",
+                                         pycls}
+        .def("__init__",
+             [](mapped_linear_classifier& cls, const std::string& path) {
+                 new (&cls) mapped_linear_classifier(mapped_linear_model{path});
+             },
+             py::arg("path"))
+        .def("margins",
+             [](const mapped_linear_classifier& cls,
+                const learn::feature_vector& instance) {
+                 auto margins = cls.model().margins(instance);
+                 return py::array(margins.size(), margins.data());
+             })
+        .def("labels",
+             [](const mapped_linear_classifier& cls) {
+                 return cls.model().labels();
+             })
+        .def("num_features",
+             [](const mapped_linear_classifier& cls) {
+                 return cls.model().num_features();
+             })
+        .def("float32",
+             [](const mapped_linear_classifier& cls) {
+                 return cls.model().single_precision();
+             })
+        .def_property_readonly("path", [](const mapped_linear_classifier& cls) {
+            return cls.model().path();
+        });
+
+    py::class_<classify::winnow>{
+        m_classify, "Winnow", pycls,
+        "A multiclass Winnow classifier trained inside MeTA, which reports "
+        "no progress and cannot stop early."}
+        .def("__init__",
+             [](classify::winnow& cls,
+                classify::multiclass_dataset_view training, double m,
+                double gamma, std::size_t max_iter) {
+                 py::gil_scoped_release rel;
+                 new (&cls) classify::winnow(std::move(training), m, gamma,
+                                             max_iter);
+             },
              py::arg("training"), py::arg("m") = classify::winnow::default_m,
              py::arg("gamma") = classify::winnow::default_gamma,
              py::arg("max_iter") = classify::winnow::default_max_iter)
@@ -571,17 +2008,19 @@ void metapy_bind_classify(py::module& m)
     // utility functions
     m_classify.def(
         "cross_validate",
-        [](std::function<py::object(classify::multiclass_dataset_view)> creator,
+        [](const cv_creator_type& creator,
            classify::multiclass_dataset_view mdv, std::size_t k,
-           bool even_split) {
+           bool even_split, std::size_t num_threads) {
+            if (num_threads > 1)
+                return parallel_cross_validate(creator, std::move(mdv), k,
+                                               even_split, num_threads);
+
             struct creator_type
             {
                 py::object cls_;
-                std::function<py::object(classify::multiclass_dataset_view)>&
-                    creator_;
+                const cv_creator_type& creator_;
 
-                creator_type(std::function<py::object(
-                                 classify::multiclass_dataset_view)>& creator)
+                creator_type(const cv_creator_type& creator)
                     : creator_(creator)
                 {
                     // nothing
@@ -598,5 +2037,29 @@ void metapy_bind_classify(py::module& m)
             return classify::cross_validate(maker, mdv, k, even_split);
         },
         py::arg("creator"), py::arg("mdv"), py::arg("k"),
-        py::arg("even_split") = false);
+        py::arg("even_split") = false, py::arg("num_threads") = 1);
+
+    m_classify.def("load_mapped",
+                   [](const std::string& path) -> py::object {
+                       mapped_linear_model model{path};
+                       if (model.binary())
+                           return py::cast(mapped_linear_binary_classifier{
+                               std::move(model)});
+                       return py::cast(
+                           mapped_linear_classifier{std::move(model)});
+                   },
+                   "Memory maps a model written by save_mapped",
+                   py::arg("path"));
+
+    m_classify.def(
+        "grid_search", &grid_search,
+        "Cross-validates classifier_type(training, **params) for every "
+        "configuration of param_grid (a dict mapping parameter names to "
+        "lists of values, or a list of such dicts). Returns one dict per "
+        "configuration with its params, mean accuracy and standard "
+        "deviation, fold accuracies, merged confusion matrix, and the "
+        "seconds spent training and testing.",
+        py::arg("classifier_type"), py::arg("param_grid"), py::arg("mdv"),
+        py::arg("k") = 5, py::arg("even_split") = false,
+        py::arg("num_threads") = std::thread::hardware_concurrency());
 }
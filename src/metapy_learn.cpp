@@ -3,7 +3,13 @@
  * @author Chase Geigle
  */
 
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
 #include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
@@ -14,8 +20,14 @@
 #include "meta/learn/sgd.h"
 #include "meta/learn/transform.h"
 #include "meta/util/iterator.h"
+#include "metapy_csr.h"
+#include "metapy_csr_file.h"
 #include "metapy_identifiers.h"
 #include "metapy_learn.h"
+#include "metapy_parallel.h"
+#include "metapy_similarity.h"
+#include "metapy_simd.h"
+#include "metapy_transform.h"
 
 namespace py = pybind11;
 using namespace meta;
@@ -53,6 +65,561 @@ struct py_loss_function : public learn::loss::loss_function
     }
 };
 
+/**
+ * Packs the rows of a CSR matrix into a csr_dataset, sorting each row by
+ * feature id and summing duplicates. This may be called without the GIL.
+ */
+template <class CSRDataset>
+CSRDataset make_csr_storage(const csr_arrays& csr)
+{
+    using feature_id_type = typename CSRDataset::feature_id_type;
+    using value_type = typename CSRDataset::value_type;
+
+    std::vector<uint64_t> offsets;
+    offsets.reserve(csr.rows + 1);
+    offsets.push_back(0);
+    std::vector<feature_id_type> ids;
+    ids.reserve(csr.indptr[csr.rows]);
+    std::vector<value_type> values;
+    values.reserve(csr.indptr[csr.rows]);
+
+    for (std::size_t row = 0; row < csr.rows; ++row)
+    {
+        for (const auto& pr : csr.row(row))
+        {
+            ids.push_back(static_cast<feature_id_type>(pr.first));
+            values.push_back(static_cast<value_type>(pr.second));
+        }
+        offsets.push_back(ids.size());
+    }
+    return {std::move(offsets), std::move(ids), std::move(values),
+            csr.num_columns};
+}
+
+/**
+ * Assigns label ids to label names in sorted order, so that the ids do not
+ * depend on the order of the instances (and "false" gets id 0 and "true"
+ * id 1, as when compacting a binary_dataset).
+ */
+template <class CSRDataset>
+void set_csr_labels(CSRDataset& dset, const std::vector<std::string>& labels)
+{
+    std::vector<std::string> names(labels);
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    std::unordered_map<std::string, uint32_t> ids;
+    for (std::size_t i = 0; i < names.size(); ++i)
+        ids.emplace(names[i], static_cast<uint32_t>(i));
+
+    std::vector<uint32_t> label_ids;
+    label_ids.reserve(labels.size());
+    for (const auto& lbl : labels)
+        label_ids.push_back(ids[lbl]);
+    dset.set_labels(std::move(label_ids), std::move(names));
+}
+
+template <class FeatureId, class Value>
+py::class_<csr_dataset<FeatureId, Value>> bind_csr_dataset(py::module& m,
+                                                           const char* name)
+{
+    using csr_type = csr_dataset<FeatureId, Value>;
+
+    py::class_<csr_type> pycsr{m, name};
+    pycsr
+        .def("__init__",
+             [](csr_type& dset, const classify::multiclass_dataset& mdset) {
+                 py::gil_scoped_release release;
+                 new (&dset) csr_type(mdset);
+             })
+        .def("__init__",
+             [](csr_type& dset, const classify::binary_dataset& bdset) {
+                 py::gil_scoped_release release;
+                 new (&dset) csr_type(bdset);
+             })
+        .def("__init__",
+             [](csr_type& dset, const learn::dataset& ldset) {
+                 py::gil_scoped_release release;
+                 new (&dset) csr_type(ldset);
+             })
+        .def("__init__",
+             [](csr_type& dset, const py_id_array& indptr,
+                const py_id_array& indices, const py_value_array& data,
+                uint64_t total_features) {
+                 csr_arrays csr{indptr, indices, data, total_features};
+                 py::gil_scoped_release release;
+                 new (&dset) csr_type(make_csr_storage<csr_type>(csr));
+             },
+             py::arg("indptr"), py::arg("indices"), py::arg("data"),
+             py::arg("total_features"))
+        .def("__init__",
+             [](csr_type& dset, const py_id_array& indptr,
+                const py_id_array& indices, const py_value_array& data,
+                uint64_t total_features,
+                const std::vector<std::string>& labels) {
+                 csr_arrays csr{indptr, indices, data, total_features};
+                 py::gil_scoped_release release;
+                 new (&dset) csr_type(make_csr_storage<csr_type>(csr));
+                 set_csr_labels(dset, labels);
+             },
+             py::arg("indptr"), py::arg("indices"), py::arg("data"),
+             py::arg("total_features"), py::arg("labels"))
+        .def_static("from_csr",
+                    [](py::object matrix, py::object labels) {
+                        return with_scipy_csr(
+                            matrix, [&](const py_id_array& indptr,
+                                        const py_id_array& indices,
+                                        const py_value_array& data,
+                                        std::size_t total_features) {
+                                csr_arrays csr{indptr, indices, data,
+                                               total_features};
+                                std::vector<std::string> lbls;
+                                if (!labels.is_none())
+                                    lbls = labels.cast<
+                                        std::vector<std::string>>();
+
+                                py::gil_scoped_release release;
+                                auto dset = make_csr_storage<csr_type>(csr);
+                                if (!labels.is_none())
+                                    set_csr_labels(dset, lbls);
+                                return dset;
+                            });
+                    },
+                    py::arg("matrix"), py::arg("labels") = py::none())
+        .def("__len__", &csr_type::size)
+        .def("total_features", &csr_type::total_features)
+        .def("nnz", &csr_type::nnz)
+        .def_property_readonly("nbytes", &csr_type::bytes)
+        .def("__getitem__",
+             [](const csr_type& dset, int64_t offset) {
+                 std::size_t idx = offset >= 0
+                                       ? static_cast<std::size_t>(offset)
+                                       : dset.size() + offset;
+                 if (idx >= dset.size())
+                     throw py::index_error();
+                 return dset.feature_vector(idx);
+             })
+        .def("__getitem__",
+             [](const csr_type& dset, py::slice slice) {
+                 return make_sliced_csr_view(
+                     csr_dataset_view<FeatureId, Value>{dset}, slice);
+             })
+        .def("has_labels", &csr_type::has_labels)
+        .def("total_labels", &csr_type::total_labels)
+        .def("label",
+             [](const csr_type& dset, std::size_t idx) {
+                 if (idx >= dset.size())
+                     throw py::index_error();
+                 if (!dset.has_labels())
+                     throw py::value_error{"dataset has no labels"};
+                 return dset.label_name(dset.label_id(idx));
+             })
+        .def("label_names",
+             [](const csr_type& dset) {
+                 if (!dset.has_labels())
+                     return std::vector<std::string>{};
+                 return dset.label_names();
+             })
+        .def("indptr",
+             [](py::object self) {
+                 const auto& dset = self.cast<const csr_type&>();
+                 return py::array(dset.size() + 1, dset.offsets(), self);
+             })
+        .def("indices",
+             [](py::object self) {
+                 const auto& dset = self.cast<const csr_type&>();
+                 return py::array(dset.nnz(), dset.ids(), self);
+             })
+        .def("data",
+             [](py::object self) {
+                 const auto& dset = self.cast<const csr_type&>();
+                 return py::array(dset.nnz(), dset.values(), self);
+             })
+        .def("to_dataset",
+             [](const csr_type& dset) {
+                 py::gil_scoped_release release;
+                 return dset.to_dataset();
+             })
+        .def("to_binary_dataset",
+             [](const csr_type& dset) {
+                 py::gil_scoped_release release;
+                 return dset.to_binary_dataset();
+             })
+        .def("to_multiclass_dataset", [](const csr_type& dset) {
+            py::gil_scoped_release release;
+            return dset.to_multiclass_dataset();
+        });
+    return pycsr;
+}
+
+template <class FeatureId, class Value>
+void bind_csr_dataset_view(py::module& m, const char* name)
+{
+    using view_type = csr_dataset_view<FeatureId, Value>;
+
+    py::class_<view_type>{m, name}
+        .def(py::init<const csr_dataset<FeatureId, Value>&>())
+        .def("__len__", &view_type::size)
+        .def("total_features", &view_type::total_features)
+        .def("__getitem__",
+             [](const view_type& dv, int64_t offset) {
+                 std::size_t idx = offset >= 0
+                                       ? static_cast<std::size_t>(offset)
+                                       : dv.size() + offset;
+                 if (idx >= dv.size())
+                     throw py::index_error();
+                 return dv.feature_vector(idx);
+             })
+        .def("__getitem__",
+             [](const view_type& dv, py::slice slice) {
+                 return make_sliced_csr_view(dv, slice);
+             })
+        .def("label",
+             [](const view_type& dv, std::size_t idx) {
+                 if (idx >= dv.size())
+                     throw py::index_error();
+                 if (!dv.dataset().has_labels())
+                     throw py::value_error{"dataset has no labels"};
+                 return dv.dataset().label_name(dv.label_id(idx));
+             })
+        .def("shuffle",
+             [](view_type& dv, py::object seed) {
+                 std::mt19937_64 rng{seed.is_none() ? std::random_device{}()
+                                                    : seed.cast<uint64_t>()};
+                 dv.shuffle(rng);
+             },
+             py::arg("seed") = py::none())
+        .def("rotate", &view_type::rotate)
+        .def("is_strided", &view_type::is_strided)
+        .def("rows",
+             [](const view_type& dv) {
+                 auto rows = dv.rows();
+                 return py::array(rows.size(), rows.data());
+             })
+        .def_property_readonly("dataset", [](const view_type& dv) {
+            return dv.dataset();
+        });
+
+    py::implicitly_convertible<csr_dataset<FeatureId, Value>, view_type>();
+}
+
+template <class FeatureId, class Value>
+void bind_mapped_csr_dataset(py::module& m, const char* name,
+                             py::class_<csr_dataset<FeatureId, Value>>& base)
+{
+    using mapped_type = mapped_csr_dataset<FeatureId, Value>;
+    using access_pattern = typename mapped_type::access_pattern;
+
+    py::class_<mapped_type>{m, name, base}
+        .def(py::init<const std::string&>(), py::arg("path"))
+        .def_property_readonly("path", &mapped_type::path)
+        .def("advise",
+             [](const mapped_type& dset, const std::string& pattern) {
+                 if (pattern == "normal")
+                     dset.advise(access_pattern::normal);
+                 else if (pattern == "sequential")
+                     dset.advise(access_pattern::sequential);
+                 else if (pattern == "random")
+                     dset.advise(access_pattern::random);
+                 else if (pattern == "willneed")
+                     dset.advise(access_pattern::will_need);
+                 else
+                     throw py::value_error{"unknown access pattern: "
+                                           + pattern};
+             },
+             py::arg("pattern"));
+
+    m.def("write_csr_dataset",
+          [](const std::string& path,
+             const csr_dataset<FeatureId, Value>& dset) {
+              py::gil_scoped_release release;
+              write_csr_file(path, dset);
+          },
+          py::arg("path"), py::arg("dataset"));
+}
+
+/**
+ * An sgd_model that remembers its number of features, which sgd_model
+ * does not expose, so that batches with feature ids past the end of its
+ * weights can be rejected.
+ */
+class sized_sgd_model : public learn::sgd_model
+{
+  public:
+    sized_sgd_model(std::size_t num_features, options_type options)
+        : learn::sgd_model(num_features, options), num_features_{num_features}
+    {
+        // nothing
+    }
+
+    std::size_t num_features() const
+    {
+        return num_features_;
+    }
+
+  private:
+    std::size_t num_features_;
+};
+
+/**
+ * Throws if a batch may contain feature ids that the model has no
+ * weights for.
+ */
+template <class Batch>
+void check_sgd_batch_width(const sized_sgd_model& model, const Batch& batch)
+{
+    if (batch.total_features() > model.num_features())
+        throw py::value_error{"the batch has more features than the model"};
+}
+
+/**
+ * Trains an SGD model on a mini-batch with the GIL released. Instances
+ * are visited in order, exactly as repeated calls to train_one would.
+ * @return the average loss over the batch (each computed before its
+ * update)
+ */
+template <class Batch>
+double sgd_train_batch(sized_sgd_model& model, const Batch& batch,
+                       const py_value_array& targets,
+                       const learn::loss::loss_function& loss)
+{
+    if (static_cast<std::size_t>(targets.size()) != batch.size())
+        throw py::value_error{"there must be exactly one target per instance"};
+    check_sgd_batch_width(model, batch);
+
+    auto expected = targets.data();
+    py::gil_scoped_release rel;
+    double total_loss = 0;
+    for (std::size_t i = 0; i < batch.size(); ++i)
+        total_loss
+            += model.train_one(instance_features(batch, i), expected[i], loss);
+    return batch.size() > 0 ? total_loss / batch.size() : 0;
+}
+
+/**
+ * Predicts every instance of a batch on a thread pool with the GIL
+ * released.
+ * @return a numpy array of the predictions
+ */
+template <class Batch>
+py::array sgd_predict_batch(const sized_sgd_model& model, const Batch& batch,
+                            std::size_t num_threads)
+{
+    check_sgd_batch_width(model, batch);
+    std::vector<double> predictions(batch.size());
+    {
+        py::gil_scoped_release rel;
+        parallel_for_blocks(batch.size(), num_threads,
+                            [&](std::size_t start, std::size_t end) {
+                                for (auto i = start; i < end; ++i)
+                                    predictions[i] = model.predict(
+                                        instance_features(batch, i));
+                            });
+    }
+    return py::array(predictions.size(), predictions.data());
+}
+
+template <class Batch>
+void bind_sgd_batch_methods(py::class_<sized_sgd_model>& pysgd)
+{
+    pysgd
+        .def("train_batch", &sgd_train_batch<Batch>, py::arg("batch"),
+             py::arg("targets"), py::arg("loss"))
+        .def("predict_batch", &sgd_predict_batch<Batch>, py::arg("batch"),
+             py::arg("num_threads") = std::thread::hardware_concurrency());
+}
+
+/**
+ * Copies the rows of a batch for a pairwise similarity computation with
+ * the GIL released.
+ */
+template <class Batch>
+similarity_rows batch_similarity_rows(const Batch& batch,
+                                      similarity_metric metric)
+{
+    py::gil_scoped_release rel;
+    return make_similarity_rows(
+        batch.size(),
+        [&](std::size_t i) -> decltype(instance_features(batch, i)) {
+            return instance_features(batch, i);
+        },
+        metric);
+}
+
+template <class Batch>
+bool load_similarity_rows(py::handle obj, similarity_metric metric,
+                          similarity_rows& rows)
+{
+    std::unique_ptr<Batch> batch;
+    try
+    {
+        batch = make_unique<Batch>(obj.cast<Batch>());
+    }
+    catch (const py::cast_error&)
+    {
+        return false;
+    }
+    rows = batch_similarity_rows(*batch, metric);
+    return true;
+}
+
+/**
+ * Copies the rows of any of the batch types (a dataset or view of one, a
+ * CSR dataset or view of one, or a scipy.sparse matrix) for a pairwise
+ * similarity computation.
+ */
+similarity_rows py_similarity_rows(py::handle obj, similarity_metric metric)
+{
+    similarity_rows rows;
+    if (load_similarity_rows<csr_dataset_view64>(obj, metric, rows)
+        || load_similarity_rows<csr_dataset_view32>(obj, metric, rows)
+        || load_similarity_rows<learn::dataset_view>(obj, metric, rows))
+        return rows;
+
+    return with_scipy_csr(
+        py::reinterpret_borrow<py::object>(obj),
+        [&](const py_id_array& indptr, const py_id_array& indices,
+            const py_value_array& data, std::size_t num_columns) {
+            csr_arrays csr{indptr, indices, data, num_columns};
+            return batch_similarity_rows(csr, metric);
+        });
+}
+
+/**
+ * Borrows the feature vectors in a Python list without copying them; the
+ * list must outlive the result.
+ */
+std::vector<const learn::feature_vector*> borrow_feature_vectors(py::list lst)
+{
+    std::vector<const learn::feature_vector*> vectors(lst.size());
+    for (std::size_t i = 0; i < vectors.size(); ++i)
+        vectors[i] = &lst[i].cast<const learn::feature_vector&>();
+    return vectors;
+}
+
+/**
+ * Applies a kernel to every vector of a (or to every pair a[i], b[i])
+ * with the GIL released, so that the kernels can be timed without a
+ * Python call per vector.
+ * @return a numpy array of the results
+ */
+template <class Kernel>
+py::array kernel_batch(py::list a, Kernel&& kernel)
+{
+    auto vectors = borrow_feature_vectors(a);
+    std::vector<double> results(vectors.size());
+    {
+        py::gil_scoped_release rel;
+        for (std::size_t i = 0; i < vectors.size(); ++i)
+            results[i] = kernel(*vectors[i]);
+    }
+    return py::array(results.size(), results.data());
+}
+
+template <class Kernel>
+py::array kernel_batch(py::list a, py::list b, Kernel&& kernel)
+{
+    if (a.size() != b.size())
+        throw py::value_error{"a and b must have the same length"};
+
+    auto vectors_a = borrow_feature_vectors(a);
+    auto vectors_b = borrow_feature_vectors(b);
+    std::vector<double> results(vectors_a.size());
+    {
+        py::gil_scoped_release rel;
+        for (std::size_t i = 0; i < vectors_a.size(); ++i)
+            results[i] = kernel(*vectors_a[i], *vectors_b[i]);
+    }
+    return py::array(results.size(), results.data());
+}
+
+/**
+ * Computes the similarities between every instance of a and every
+ * instance of b (or of a, if b is None).
+ * @return a scipy.sparse.csr_matrix, or a dense numpy array if dense is
+ * true
+ */
+py::object py_pairwise_similarity(py::object a, py::object b,
+                                  const std::string& metric_name,
+                                  std::size_t top_k, std::size_t num_threads,
+                                  bool dense)
+{
+    auto metric = similarity_metric_from_string(metric_name);
+    auto rows_a = py_similarity_rows(a, metric);
+    auto rows_b = b.is_none() ? similarity_rows{}
+                              : py_similarity_rows(b, metric);
+
+    similarity_matrix result;
+    {
+        py::gil_scoped_release rel;
+        result = pairwise_similarity(rows_a, b.is_none() ? rows_a : rows_b,
+                                     top_k, num_threads);
+    }
+
+    if (dense)
+    {
+        std::vector<double> values(result.num_rows * result.num_columns);
+        for (std::size_t row = 0; row < result.num_rows; ++row)
+            for (auto i = result.offsets[row]; i < result.offsets[row + 1];
+                 ++i)
+                values[row * result.num_columns + result.columns[i]]
+                    = result.values[i];
+        py::object arr = py::array(values.size(), values.data());
+        return arr.attr("reshape")(result.num_rows, result.num_columns);
+    }
+
+    auto csr_matrix = py::module::import("scipy.sparse").attr("csr_matrix");
+    return csr_matrix(
+        py::make_tuple(
+            py::array(result.values.size(), result.values.data()),
+            py::array(result.columns.size(), result.columns.data()),
+            py::array(result.offsets.size(), result.offsets.data())),
+        py::make_tuple(result.num_rows, result.num_columns));
+}
+
+/**
+ * Builds the IDF weights for a fused TF-IDF transform: from the inverted
+ * index, if one is given, or else by counting the dataset's own document
+ * frequencies.
+ */
+template <class Dataset>
+idf_table make_py_idf_table(const Dataset& dset, py::object idx,
+                            std::size_t num_threads)
+{
+    if (idx.is_none())
+    {
+        py::gil_scoped_release rel;
+        return make_idf_table(dset, num_threads);
+    }
+
+    auto inv_idx = idx.cast<std::shared_ptr<index::inverted_index>>();
+    py::gil_scoped_release rel;
+    return make_idf_table(*inv_idx, dset.total_features());
+}
+
+/**
+ * Binds the fused TF-IDF and L2 normalization transform for CSR datasets,
+ * which returns a new dataset since CSR storage is immutable.
+ */
+template <class FeatureId, class Value>
+void bind_csr_tfidf_transform(py::module& m)
+{
+    m.def("tfidf_l2norm_transform",
+          [](const csr_dataset<FeatureId, Value>& dset, py::object idx,
+             bool sublinear_tf, bool normalize, std::size_t num_threads) {
+              auto idf = make_py_idf_table(dset, idx, num_threads);
+              tfidf_options options;
+              options.sublinear_tf = sublinear_tf;
+              options.normalize = normalize;
+
+              py::gil_scoped_release rel;
+              return tfidf_l2norm_transform(dset, idf, options, num_threads);
+          },
+          py::arg("dataset"), py::arg("idx") = py::none(),
+          py::arg("sublinear_tf") = false, py::arg("normalize") = true,
+          py::arg("num_threads") = std::thread::hardware_concurrency());
+}
+
 void metapy_bind_learn(py::module& m)
 {
     auto m_learn = m.def_submodule("learn");
@@ -70,6 +637,17 @@ void metapy_bind_learn(py::module& m)
                      util::make_transform_iterator(iter.begin(), cast_fn),
                      util::make_transform_iterator(iter.end(), cast_fn));
              })
+        .def("__init__",
+             [](learn::feature_vector& fv, const py_id_array& ids,
+                const py_value_array& values) {
+                 if (ids.size() != values.size())
+                     throw py::value_error{
+                         "ids and values must have the same length"};
+                 new (&fv) learn::feature_vector(make_feature_vector(
+                     ids.data(), values.data(),
+                     static_cast<std::size_t>(ids.size())));
+             },
+             py::arg("ids"), py::arg("values"))
         .def("__len__", &learn::feature_vector::size)
         .def("__iter__",
              [](learn::feature_vector& fv) {
@@ -86,16 +664,16 @@ void metapy_bind_learn(py::module& m)
         .def("dot",
              [](const learn::feature_vector& self,
                 const learn::feature_vector& other) {
-                 return util::dot_product(self, other);
+                 return simd::dot(self, other);
              })
         .def("cosine",
              [](const learn::feature_vector& self,
                 const learn::feature_vector& other) {
-                 return util::cosine_sim(self, other);
+                 return simd::cosine(self, other);
              })
         .def("l2norm",
              [](const learn::feature_vector& self) {
-                 return util::l2norm(self);
+                 return simd::l2norm(self);
              })
         .def("__str__", [](const learn::feature_vector& fv) {
             std::stringstream ss;
@@ -110,13 +688,62 @@ void metapy_bind_learn(py::module& m)
             return ss.str();
         });
 
-    m_learn.def("dot", &util::dot_product<const learn::feature_vector&,
-                                          const learn::feature_vector&>);
-    m_learn.def("cosine", &util::cosine_sim<const learn::feature_vector&,
-                                            const learn::feature_vector&>);
+    m_learn.def("dot", [](const learn::feature_vector& a,
+                          const learn::feature_vector& b) {
+        return simd::dot(a, b);
+    });
+    m_learn.def("cosine", [](const learn::feature_vector& a,
+                             const learn::feature_vector& b) {
+        return simd::cosine(a, b);
+    });
     m_learn.def("l2norm", [](const learn::feature_vector& vec) {
-        return util::l2norm(vec);
+        return simd::l2norm(vec);
+    });
+
+    // batched forms of the kernels above: one result per element (or
+    // pair of elements) of the given lists of FeatureVectors
+    m_learn.def("dot_batch", [](py::list a, py::list b) {
+        return kernel_batch(a, b, [](const learn::feature_vector& x,
+                                     const learn::feature_vector& y) {
+            return simd::dot(x, y);
+        });
+    });
+    m_learn.def("cosine_batch", [](py::list a, py::list b) {
+        return kernel_batch(a, b, [](const learn::feature_vector& x,
+                                     const learn::feature_vector& y) {
+            return simd::cosine(x, y);
+        });
     });
+    m_learn.def("l2norm_batch", [](py::list vectors) {
+        return kernel_batch(vectors, [](const learn::feature_vector& x) {
+            return simd::l2norm(x);
+        });
+    });
+
+    m_learn.def("pairwise_similarity", &py_pairwise_similarity,
+                "Computes the similarity (\"cosine\" or \"dot\") between "
+                "every instance of a and every instance of b (or of a, if b "
+                "is None). If top_k is nonzero, only the top_k highest "
+                "similarities of each row are kept. Returns a "
+                "scipy.sparse.csr_matrix, or a numpy array if dense is True.",
+                py::arg("a"), py::arg("b") = py::none(),
+                py::arg("metric") = "cosine", py::arg("top_k") = 0,
+                py::arg("num_threads") = std::thread::hardware_concurrency(),
+                py::arg("dense") = false);
+
+    m_learn.def("simd_level",
+                []() { return simd::to_string(simd::active_level()); },
+                "The instruction set the vector kernels currently use");
+    m_learn.def("detected_simd_level",
+                []() { return simd::to_string(simd::detected_level()); },
+                "The best instruction set the CPU supports");
+    m_learn.def("set_simd_level",
+                [](const std::string& name) {
+                    simd::set_active_level(simd::level_from_string(name));
+                },
+                "Forces the vector kernels to use the given instruction set "
+                "(one of 'generic', 'avx2', 'avx512')",
+                py::arg("level"));
 
     py::class_<learn::instance>{m_learn, "Instance"}
         .def(py::init<learn::instance_id>())
@@ -149,6 +776,31 @@ void metapy_bind_learn(py::module& m)
                                             featurizer(obj));
                                     });
              })
+        .def("__init__",
+             [](learn::dataset& dset, const py_id_array& indptr,
+                const py_id_array& indices, const py_value_array& data,
+                std::size_t total_features) {
+                 csr_arrays csr{indptr, indices, data, total_features};
+                 py::gil_scoped_release release;
+                 new (&dset)
+                     learn::dataset(make_csr_dataset<learn::dataset>(csr));
+             },
+             py::arg("indptr"), py::arg("indices"), py::arg("data"),
+             py::arg("total_features"))
+        .def_static("from_csr",
+                    [](py::object matrix) {
+                        return with_scipy_csr(
+                            matrix, [](const py_id_array& indptr,
+                                       const py_id_array& indices,
+                                       const py_value_array& data,
+                                       std::size_t total_features) {
+                                csr_arrays csr{indptr, indices, data,
+                                               total_features};
+                                py::gil_scoped_release release;
+                                return make_csr_dataset<learn::dataset>(csr);
+                            });
+                    },
+                    py::arg("matrix"))
         .def("__getitem__",
              [](learn::dataset& dset, int64_t offset) -> learn::instance& {
                  std::size_t idx = offset >= 0
@@ -173,8 +825,8 @@ void metapy_bind_learn(py::module& m)
              py::keep_alive<0, 1>())
         .def("total_features", &learn::dataset::total_features);
 
-    py::class_<learn::dataset_view>{m_learn, "DatasetView"}
-        .def(py::init<const learn::dataset&>(), py::keep_alive<0, 1>())
+    py::class_<learn::dataset_view> pydset_view{m_learn, "DatasetView"};
+    pydset_view.def(py::init<const learn::dataset&>(), py::keep_alive<0, 1>())
         .def("shuffle", &learn::dataset_view::shuffle)
         .def("rotate", &learn::dataset_view::rotate)
         .def("total_features", &learn::dataset_view::total_features)
@@ -201,8 +853,90 @@ void metapy_bind_learn(py::module& m)
 
     py::implicitly_convertible<learn::dataset, learn::dataset_view>();
 
+    auto pycsr = bind_csr_dataset<uint64_t, double>(m_learn, "CSRDataset");
+    auto pycompact_csr
+        = bind_csr_dataset<uint32_t, float>(m_learn, "CompactCSRDataset");
+    bind_csr_dataset_view<uint64_t, double>(m_learn, "CSRDatasetView");
+    bind_csr_dataset_view<uint32_t, float>(m_learn, "CompactCSRDatasetView");
+    bind_mapped_csr_dataset(m_learn, "MappedCSRDataset", pycsr);
+    bind_mapped_csr_dataset(m_learn, "MappedCompactCSRDataset",
+                            pycompact_csr);
+
+    m_learn.def(
+        "write_csr_dataset",
+        [](const std::string& path,
+           const std::shared_ptr<index::forward_index>& fidx, py::object docs,
+           bool labeled, bool compact) {
+            auto ids = docs.is_none() ? fidx->docs()
+                                      : docs.cast<std::vector<doc_id>>();
+            py::gil_scoped_release release;
+            if (compact)
+                write_csr_file<uint32_t, float>(path, *fidx, ids, labeled);
+            else
+                write_csr_file<uint64_t, double>(path, *fidx, ids, labeled);
+        },
+        py::arg("path"), py::arg("fidx"), py::arg("docs") = py::none(),
+        py::arg("labeled") = true, py::arg("compact") = false);
+
+    m_learn.def("open_csr_dataset",
+                [](const std::string& path) -> py::object {
+                    auto hdr = read_csr_file_header(path);
+                    if (hdr.id_bytes == sizeof(uint32_t))
+                        return py::cast(mapped_csr_dataset32{path});
+                    return py::cast(mapped_csr_dataset64{path});
+                },
+                py::arg("path"));
+    bind_csr_view_init(pydset_view, &csr_dataset64::materialized_dataset);
+    bind_csr_view_init(pydset_view, &csr_dataset32::materialized_dataset);
+    bind_csr_view_init<csr_dataset_view64>(
+        pydset_view, &csr_dataset64::materialized_dataset);
+    bind_csr_view_init<csr_dataset_view32>(
+        pydset_view, &csr_dataset32::materialized_dataset);
+
     m_learn.def("tfidf_transform", &learn::tfidf_transform);
     m_learn.def("l2norm_transform", &learn::l2norm_transform);
+    m_learn.def(
+        "hashing_transform",
+        [](learn::dataset& dset, uint64_t num_buckets, uint64_t seed,
+           bool signed_hash, std::size_t num_threads) {
+            feature_hasher hasher{num_buckets, seed, signed_hash};
+            hashing_stats stats;
+            {
+                py::gil_scoped_release release;
+                stats = hashing_transform(dset, hasher, num_threads);
+            }
+
+            py::dict ret;
+            ret["features"] = py::cast(stats.features);
+            ret["buckets_used"] = py::cast(stats.buckets_used);
+            ret["collision_rate"] = py::cast(stats.collision_rate());
+            ret["nonzeros"] = py::cast(stats.nonzeros);
+            ret["merged_nonzeros"] = py::cast(stats.merged_nonzeros);
+            ret["instance_collision_rate"]
+                = py::cast(stats.instance_collision_rate());
+            return ret;
+        },
+        py::arg("dataset"), py::arg("num_buckets"), py::arg("seed") = 0,
+        py::arg("signed") = true,
+        py::arg("num_threads") = std::thread::hardware_concurrency());
+
+    m_learn.def(
+        "tfidf_l2norm_transform",
+        [](learn::dataset& dset, py::object idx, bool sublinear_tf,
+           bool normalize, std::size_t num_threads) {
+            auto idf = make_py_idf_table(dset, idx, num_threads);
+            tfidf_options options;
+            options.sublinear_tf = sublinear_tf;
+            options.normalize = normalize;
+
+            py::gil_scoped_release rel;
+            tfidf_l2norm_transform(dset, idf, options, num_threads);
+        },
+        py::arg("dataset"), py::arg("idx") = py::none(),
+        py::arg("sublinear_tf") = false, py::arg("normalize") = true,
+        py::arg("num_threads") = std::thread::hardware_concurrency());
+    bind_csr_tfidf_transform<uint64_t, double>(m_learn);
+    bind_csr_tfidf_transform<uint32_t, float>(m_learn);
 
     auto m_loss = m_learn.def_submodule("loss");
 
@@ -224,7 +958,7 @@ void metapy_bind_learn(py::module& m)
     bind_loss_function<learn::loss::squared_hinge>(m_loss, "SquaredHinge",
                                                    pyloss);
 
-    py::class_<learn::sgd_model> py_sgdmodel{m_learn, "SGDModel"};
+    py::class_<sized_sgd_model> py_sgdmodel{m_learn, "SGDModel"};
     py::class_<learn::sgd_model::options_type>{py_sgdmodel, "Options"}
         .def(py::init<>())
         .def_readwrite("learning_rate",
@@ -241,6 +975,50 @@ void metapy_bind_learn(py::module& m)
         .def_readonly_static("default_l1_regularizer",
                              &learn::sgd_model::default_l1_regularizer)
         .def(py::init<std::size_t, learn::sgd_model::options_type>())
-        .def("predict", &learn::sgd_model::predict)
-        .def("train_one", &learn::sgd_model::train_one);
+        .def("num_features", &sized_sgd_model::num_features)
+        .def("predict",
+             [](const sized_sgd_model& model,
+                const learn::feature_vector& instance) {
+                 return model.predict(instance);
+             })
+        .def("train_one",
+             [](sized_sgd_model& model, const learn::feature_vector& instance,
+                double expected, const learn::loss::loss_function& loss) {
+                 return model.train_one(instance, expected, loss);
+             });
+
+    bind_sgd_batch_methods<csr_dataset_view64>(py_sgdmodel);
+    bind_sgd_batch_methods<csr_dataset_view32>(py_sgdmodel);
+    bind_sgd_batch_methods<learn::dataset_view>(py_sgdmodel);
+
+    // any scipy.sparse matrix (or anything else with CSR arrays)
+    py_sgdmodel
+        .def("train_batch",
+             [](sized_sgd_model& model, py::object matrix,
+                const py_value_array& targets,
+                const learn::loss::loss_function& loss) {
+                 return with_scipy_csr(
+                     matrix, [&](const py_id_array& indptr,
+                                 const py_id_array& indices,
+                                 const py_value_array& data,
+                                 std::size_t num_columns) {
+                         csr_arrays csr{indptr, indices, data, num_columns};
+                         return sgd_train_batch(model, csr, targets, loss);
+                     });
+             },
+             py::arg("batch"), py::arg("targets"), py::arg("loss"))
+        .def("predict_batch",
+             [](const sized_sgd_model& model, py::object matrix,
+                std::size_t num_threads) {
+                 return with_scipy_csr(
+                     matrix, [&](const py_id_array& indptr,
+                                 const py_id_array& indices,
+                                 const py_value_array& data,
+                                 std::size_t num_columns) {
+                         csr_arrays csr{indptr, indices, data, num_columns};
+                         return sgd_predict_batch(model, csr, num_threads);
+                     });
+             },
+             py::arg("batch"),
+             py::arg("num_threads") = std::thread::hardware_concurrency());
 }
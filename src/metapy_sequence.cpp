@@ -114,7 +114,10 @@ void metapy_bind_sequence(py::module& m)
     m_seq.def("extract_sequences", &sequence::extract_sequences);
 
     using sequence::perceptron;
-    py::class_<perceptron> perc_tagger{m_seq, "PerceptronTagger"};
+    py::class_<perceptron> perc_tagger{
+        m_seq, "PerceptronTagger",
+        "An averaged perceptron tagger trained inside MeTA, which reports no "
+        "progress and cannot stop early."};
 
     py::class_<perceptron::training_options>{perc_tagger, "TrainingOptions"}
         .def(py::init<>())
@@ -0,0 +1,362 @@
+/**
+ * @file metapy_simd.cpp
+ * @author Chase Geigle
+ *
+ * Sparse vectors are arrays of (feature_id, double) pairs, so the vector
+ * kernels load pairs two at a time and de-interleave the ids and values
+ * with unpack instructions.
+ */
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "metapy_simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__))                                \
+    && (defined(__GNUC__) || defined(__clang__))
+#define METAPY_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace simd
+{
+
+namespace
+{
+
+using pair_type = meta::learn::feature_vector::pair_type;
+static_assert(sizeof(pair_type) == 2 * sizeof(uint64_t),
+              "vector kernels assume 16-byte (id, value) pairs");
+
+const pair_type* data(const meta::learn::feature_vector& vec)
+{
+    return vec.size() > 0 ? &*vec.begin() : nullptr;
+}
+
+// the generic kernels are the original scalar loops
+
+double generic_sparse_dot(const pair_type* a, std::size_t na,
+                          const pair_type* b, std::size_t nb)
+{
+    double result = 0;
+    std::size_t i = 0, j = 0;
+    while (i < na && j < nb)
+    {
+        uint64_t ia = a[i].first;
+        uint64_t ib = b[j].first;
+        if (ia == ib)
+            result += a[i].second * b[j].second;
+        i += ia <= ib;
+        j += ib <= ia;
+    }
+    return result;
+}
+
+double generic_dense_dot(const pair_type* a, std::size_t na,
+                         const double* dense, uint64_t dense_size)
+{
+    double result = 0;
+    for (std::size_t i = 0; i < na; ++i)
+    {
+        uint64_t id = a[i].first;
+        if (id < dense_size)
+            result += a[i].second * dense[id];
+    }
+    return result;
+}
+
+double generic_squared_norm(const pair_type* a, std::size_t na)
+{
+    double result = 0;
+    for (std::size_t i = 0; i < na; ++i)
+        result += a[i].second * a[i].second;
+    return result;
+}
+
+#ifdef METAPY_SIMD_X86
+
+__attribute__((target("avx2,fma"))) double hsum(__m256d v)
+{
+    auto lo = _mm256_castpd256_pd128(v);
+    auto hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+/**
+ * Loads four consecutive pairs and splits them into ids and values. The
+ * lanes end up in the order 0, 2, 1, 3 for both, which is all that
+ * matters to the kernels.
+ */
+__attribute__((target("avx2,fma"))) void
+load4(const pair_type* p, __m256i& ids, __m256d& vals)
+{
+    auto first = _mm256_loadu_pd(reinterpret_cast<const double*>(p));
+    auto second = _mm256_loadu_pd(reinterpret_cast<const double*>(p + 2));
+    ids = _mm256_castpd_si256(_mm256_unpacklo_pd(first, second));
+    vals = _mm256_unpackhi_pd(first, second);
+}
+
+/**
+ * Intersects blocks of four ids from each vector by comparing one block
+ * against every rotation of the other (Schlegel et al., 2011). The block
+ * with the smaller maximum id is advanced, so each matching pair is found
+ * exactly once.
+ */
+__attribute__((target("avx2,fma"))) double
+avx2_sparse_dot(const pair_type* a, std::size_t na, const pair_type* b,
+                std::size_t nb)
+{
+    auto acc = _mm256_setzero_pd();
+    std::size_t i = 0, j = 0;
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m256i ids_a, ids_b;
+        __m256d vals_a, vals_b;
+        load4(a + i, ids_a, vals_a);
+        load4(b + j, ids_b, vals_b);
+
+        for (int r = 0; r < 4; ++r)
+        {
+            auto eq = _mm256_castsi256_pd(_mm256_cmpeq_epi64(ids_a, ids_b));
+            acc = _mm256_add_pd(
+                acc, _mm256_and_pd(eq, _mm256_mul_pd(vals_a, vals_b)));
+            ids_b = _mm256_permute4x64_epi64(ids_b, 0x39);
+            vals_b = _mm256_permute4x64_pd(vals_b, 0x39);
+        }
+
+        uint64_t max_a = a[i + 3].first;
+        uint64_t max_b = b[j + 3].first;
+        i += max_a <= max_b ? 4 : 0;
+        j += max_b <= max_a ? 4 : 0;
+    }
+    return hsum(acc) + generic_sparse_dot(a + i, na - i, b + j, nb - j);
+}
+
+__attribute__((target("avx2,fma"))) double
+avx2_dense_dot(const pair_type* a, std::size_t na, const double* dense,
+               uint64_t dense_size)
+{
+    auto acc = _mm256_setzero_pd();
+    // AVX2 only compares signed 64-bit integers; flipping the sign bit of
+    // both operands turns that into an unsigned compare
+    auto sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    auto limit = _mm256_xor_si256(
+        _mm256_set1_epi64x(static_cast<int64_t>(dense_size)), sign);
+    std::size_t i = 0;
+    for (; i + 4 <= na; i += 4)
+    {
+        __m256i ids;
+        __m256d vals;
+        load4(a + i, ids, vals);
+        auto in_range = _mm256_castsi256_pd(
+            _mm256_cmpgt_epi64(limit, _mm256_xor_si256(ids, sign)));
+        auto gathered = _mm256_mask_i64gather_pd(
+            _mm256_setzero_pd(), dense, ids, in_range, sizeof(double));
+        acc = _mm256_fmadd_pd(vals, gathered, acc);
+    }
+    return hsum(acc) + generic_dense_dot(a + i, na - i, dense, dense_size);
+}
+
+__attribute__((target("avx2,fma"))) double
+avx2_squared_norm(const pair_type* a, std::size_t na)
+{
+    auto acc = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= na; i += 4)
+    {
+        __m256i ids;
+        __m256d vals;
+        load4(a + i, ids, vals);
+        acc = _mm256_fmadd_pd(vals, vals, acc);
+    }
+    return hsum(acc) + generic_squared_norm(a + i, na - i);
+}
+
+/**
+ * Loads eight consecutive pairs and splits them into ids and values (in
+ * matching, permuted lane orders).
+ */
+__attribute__((target("avx512f,avx2,fma"))) void
+load8(const pair_type* p, __m512i& ids, __m512d& vals)
+{
+    auto first = _mm512_loadu_pd(reinterpret_cast<const double*>(p));
+    auto second = _mm512_loadu_pd(reinterpret_cast<const double*>(p + 4));
+    ids = _mm512_castpd_si512(_mm512_unpacklo_pd(first, second));
+    vals = _mm512_unpackhi_pd(first, second);
+}
+
+__attribute__((target("avx512f,avx2,fma"))) double
+avx512_dense_dot(const pair_type* a, std::size_t na, const double* dense,
+                 uint64_t dense_size)
+{
+    auto acc = _mm512_setzero_pd();
+    auto limit = _mm512_set1_epi64(static_cast<int64_t>(dense_size));
+    std::size_t i = 0;
+    for (; i + 8 <= na; i += 8)
+    {
+        __m512i ids;
+        __m512d vals;
+        load8(a + i, ids, vals);
+        auto in_range = _mm512_cmplt_epu64_mask(ids, limit);
+        auto gathered = _mm512_mask_i64gather_pd(
+            _mm512_setzero_pd(), in_range, ids, dense, sizeof(double));
+        acc = _mm512_fmadd_pd(vals, gathered, acc);
+    }
+    return _mm512_reduce_add_pd(acc)
+           + avx2_dense_dot(a + i, na - i, dense, dense_size);
+}
+
+__attribute__((target("avx512f,avx2,fma"))) double
+avx512_squared_norm(const pair_type* a, std::size_t na)
+{
+    auto acc = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 8 <= na; i += 8)
+    {
+        __m512i ids;
+        __m512d vals;
+        load8(a + i, ids, vals);
+        acc = _mm512_fmadd_pd(vals, vals, acc);
+    }
+    return _mm512_reduce_add_pd(acc) + avx2_squared_norm(a + i, na - i);
+}
+
+#endif
+
+struct kernel_table
+{
+    double (*sparse_dot)(const pair_type*, std::size_t, const pair_type*,
+                         std::size_t);
+    double (*dense_dot)(const pair_type*, std::size_t, const double*,
+                        uint64_t);
+    double (*squared_norm)(const pair_type*, std::size_t);
+};
+
+const kernel_table& kernels_for(level lvl)
+{
+    static const kernel_table generic{generic_sparse_dot, generic_dense_dot,
+                                      generic_squared_norm};
+#ifdef METAPY_SIMD_X86
+    // SIMD intersection of 64-bit ids gains nothing from wider registers,
+    // so the AVX-512 table reuses the AVX2 sparse-sparse kernel
+    static const kernel_table avx2{avx2_sparse_dot, avx2_dense_dot,
+                                   avx2_squared_norm};
+    static const kernel_table avx512{avx2_sparse_dot, avx512_dense_dot,
+                                     avx512_squared_norm};
+    switch (lvl)
+    {
+        case level::avx512:
+            return avx512;
+        case level::avx2:
+            return avx2;
+        case level::generic:
+            break;
+    }
+#else
+    (void)lvl;
+#endif
+    return generic;
+}
+
+level detect()
+{
+#ifdef METAPY_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("fma"))
+        return level::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return level::avx2;
+#endif
+    return level::generic;
+}
+
+std::atomic<const kernel_table*>& active_kernels()
+{
+    static std::atomic<const kernel_table*> table{
+        &kernels_for(detected_level())};
+    return table;
+}
+
+std::atomic<level>& active()
+{
+    static std::atomic<level> lvl{detected_level()};
+    return lvl;
+}
+}
+
+level detected_level()
+{
+    static const level lvl = detect();
+    return lvl;
+}
+
+level active_level()
+{
+    return active().load();
+}
+
+void set_active_level(level lvl)
+{
+    if (static_cast<int>(lvl) > static_cast<int>(detected_level()))
+        throw std::invalid_argument{"the CPU does not support "
+                                    + to_string(lvl)};
+    active().store(lvl);
+    active_kernels().store(&kernels_for(lvl));
+}
+
+std::string to_string(level lvl)
+{
+    switch (lvl)
+    {
+        case level::avx512:
+            return "avx512";
+        case level::avx2:
+            return "avx2";
+        case level::generic:
+            break;
+    }
+    return "generic";
+}
+
+level level_from_string(const std::string& name)
+{
+    if (name == "avx512")
+        return level::avx512;
+    if (name == "avx2")
+        return level::avx2;
+    if (name == "generic")
+        return level::generic;
+    throw std::invalid_argument{"unknown SIMD level: " + name};
+}
+
+double dot(const meta::learn::feature_vector& a,
+           const meta::learn::feature_vector& b)
+{
+    return active_kernels().load()->sparse_dot(data(a), a.size(), data(b),
+                                               b.size());
+}
+
+double dot(const meta::learn::feature_vector& a, const double* dense,
+           uint64_t dense_size)
+{
+    return active_kernels().load()->dense_dot(data(a), a.size(), dense,
+                                              dense_size);
+}
+
+double l2norm(const meta::learn::feature_vector& a)
+{
+    auto squared = active_kernels().load()->squared_norm(data(a), a.size());
+    return std::sqrt(squared);
+}
+
+double cosine(const meta::learn::feature_vector& a,
+              const meta::learn::feature_vector& b)
+{
+    auto norms = l2norm(a) * l2norm(b);
+    return norms > 0 ? dot(a, b) / norms : 0;
+}
+}